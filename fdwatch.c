@@ -1,45 +1,157 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 
-#define MAX_PROCS 2048
 #define NAME_LEN  32
+#define HIST      16                   /* growth samples per window */
+#define MAX_EVERY 32                   /* longest gap between walks, ticks */
+
+enum { T_SOCK, T_PIPE, T_FILE, T_ANON, T_OTHER, T_NTYPES };
 
 typedef struct {
-    pid_t pid;
-    char  name[NAME_LEN];
-    int   fd_count;
+    pid_t  pid;
+    char   name[NAME_LEN];
+    int    fd_count;
+    double growth;                     /* fds per second over the window */
+    int    growth_known;
+    size_t slot;                       /* entry in the fd cache */
 } ProcFD;
 
 static int cmp_fd(const void *a, const void *b) {
     return ((const ProcFD *)b)->fd_count - ((const ProcFD *)a)->fd_count;
 }
 
-static void read_comm(pid_t pid, char *name, int maxlen) {
+static int cmp_growth(const void *a, const void *b) {
+    double x = ((const ProcFD *)a)->growth, y = ((const ProcFD *)b)->growth;
+    if (x != y) return (x < y) - (x > y);
+    return cmp_fd(a, b);
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* ---- Per-process fd cache ----------------------------------------------- */
+/* /proc/<pid> and /proc/<pid>/fd stay open across ticks. Since Linux 6.2
+   fstat() on the fd directory reports the number of open fds as st_size,
+   so counting costs one syscall per process instead of opendir, a
+   getdents loop and closedir; older kernels report 0 and fall back to
+   re-reading the held directory. comm is only opened once a process makes
+   the displayed top N. Once a process is reaped its fds fail with ENOENT
+   and the entry is reopened, which also handles PID reuse. Each entry
+   also keeps a ring of HIST fd counts spaced window / HIST apart, from
+   which the growth rate over the window is taken, and the results and
+   schedule of its last fd directory walks. */
+typedef struct {
+    pid_t    pid;
+    int      dir;                      /* O_PATH /proc/<pid>, or -1 */
+    int      fd;                       /* /proc/<pid>/fd, -1 if not readable */
+    int      comm;                     /* /proc/<pid>/comm, opened on demand */
+    int      hist_n, hist_head;        /* oldest sample at hist_head */
+    int      hist_cnt[HIST];
+    double   hist_at[HIST];
+    int      count, fdsize;            /* last count walk, FDSize then */
+    int      cnt_every;                /* ticks between count walks */
+    unsigned cnt_due, cnt_tick;
+    int      types[T_NTYPES];          /* last type walk */
+    int      types_total, types_ok;
+    int      typ_every;
+    unsigned typ_due, typ_tick;
+    unsigned shown_tick;               /* last tick in the top N */
+} ProcFds;
+
+typedef struct {
+    ProcFds *v;
+    size_t   n, cap;
+} FdCache;
+
+static FdCache fdc, fdc_next;
+
+/* Entries allowed to hold fds; past it processes are read by path */
+static long fd_budget, fd_entries;
+
+static void fds_close(ProcFds *f) {
+    if (f->comm >= 0) close(f->comm);
+    if (f->fd >= 0)   close(f->fd);
+    if (f->dir >= 0) { close(f->dir); fd_entries--; }
+    f->comm = f->fd = f->dir = -1;
+    f->hist_n = f->hist_head = 0;
+    f->count = f->fdsize = f->cnt_every = f->types_ok = f->typ_every = 0;
+    f->cnt_due = f->typ_due = f->shown_tick = 0;
+}
+
+static void fds_open(ProcFds *f) {
+    f->comm = f->fd = f->dir = -1;
+    if (fd_entries >= fd_budget) return;
     char path[64];
-    snprintf(path, sizeof(path), "/proc/%d/comm", pid);
-    int fd = open(path, O_RDONLY);
-    if (fd < 0) { strncpy(name, "?", maxlen); return; }
-    ssize_t n = read(fd, name, maxlen - 1);
-    close(fd);
-    if (n > 0) {
-        name[n] = '\0';
-        if (name[n - 1] == '\n') name[n - 1] = '\0';
-    } else {
-        strncpy(name, "?", maxlen);
+    snprintf(path, sizeof(path), "/proc/%d", f->pid);
+    f->dir = open(path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (f->dir < 0) return;
+    fd_entries++;
+    f->fd = openat(f->dir, "fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+static void fdc_push(FdCache *c, const ProcFds *f) {
+    if (c->n == c->cap) {
+        size_t cap = c->cap ? c->cap * 2 : 1024;
+        ProcFds *v = realloc(c->v, cap * sizeof(*v));
+        if (!v) { perror("realloc"); exit(EXIT_FAILURE); }
+        c->v   = v;
+        c->cap = cap;
     }
+    c->v[c->n++] = *f;
+}
+
+/* Each entry holds up to three fds; lift the soft limit so large hosts fit */
+static void fd_limit_init(void) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0) return;
+    if (rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) < 0) getrlimit(RLIMIT_NOFILE, &rl);
+    }
+    rlim_t lim = rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > (1u << 30)
+               ? (1u << 30) : rl.rlim_cur;
+    fd_budget = lim > 256 ? (long)(lim - 256) / 3 : 0;
+}
+
+/* Whether st_size of an fd directory is its fd count (Linux 6.2+): ours
+   is never empty, so a 0 here means the kernel does not report it */
+static int size_is_count;
+
+static void size_is_count_init(void) {
+    struct stat st;
+    size_is_count = stat("/proc/self/fd", &st) == 0 && st.st_size > 0;
 }
 
-static int count_fds(pid_t pid) {
+/* -1 if gone, -2 if its fd table is not readable (kept cached as such),
+   -3 if the kernel does not report the count (before 6.2) */
+static int count_fds(ProcFds *f) {
+    struct stat st;
+    if (f->fd < 0) return fstat(f->dir, &st) == 0 ? -2 : -1;
+    if (fstat(f->fd, &st) < 0) return -1;
+    return size_is_count ? (int)st.st_size : -3;
+}
+
+/* Same, for processes over the fd budget */
+static int count_fds_path(pid_t pid) {
     char path[64];
     snprintf(path, sizeof(path), "/proc/%d/fd", pid);
+    struct stat st;
+    if (size_is_count && stat(path, &st) == 0) return (int)st.st_size;
     DIR *dir = opendir(path);
-    if (!dir) return -1;
+    if (!dir) return errno == EACCES ? -2 : -1;
     int count = 0;
     struct dirent *ent;
     while ((ent = readdir(dir)) != NULL)
@@ -48,6 +160,196 @@ static int count_fds(pid_t pid) {
     return count;
 }
 
+/* ---- Growth and exhaustion --------------------------------------------- */
+static double window = 60;             /* -w: growth measured over this */
+
+/* Records this tick's count and returns the growth since the oldest sample
+   still in the window; 0 when there is no sample old enough yet */
+static int hist_rate(ProcFds *f, int fds, double now, double *rate) {
+    int newest = (f->hist_head + f->hist_n - 1) % HIST;
+    if (f->hist_n == 0 || now - f->hist_at[newest] >= window / HIST) {
+        int slot = (f->hist_head + f->hist_n) % HIST;
+        if (f->hist_n == HIST) f->hist_head = (f->hist_head + 1) % HIST;
+        else f->hist_n++;
+        f->hist_cnt[slot] = fds;
+        f->hist_at[slot]  = now;
+    }
+    double dt = now - f->hist_at[f->hist_head];
+    if (dt <= 0) return 0;
+    *rate = (fds - f->hist_cnt[f->hist_head]) / dt;
+    return 1;
+}
+
+/* Soft "Max open files" of the process, -1 if unknown or unlimited */
+static long read_nofile(const ProcFds *f) {
+    char buf[4096];
+    int fd;
+    if (f->dir >= 0) {
+        fd = openat(f->dir, "limits", O_RDONLY | O_CLOEXEC);
+    } else {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/limits", f->pid);
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0) return -1;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return -1;
+    buf[n] = '\0';
+    char *v = strstr(buf, "Max open files");
+    if (!v) return -1;
+    v += strlen("Max open files");
+    while (*v == ' ') v++;
+    return *v >= '0' && *v <= '9' ? strtol(v, NULL, 10) : -1;
+}
+
+/* ---- Fd directory walks ------------------------------------------------ */
+/* One getdents64 pass over the fd directory with a 64 KB buffer, plus a
+   readlink per fd when types are wanted, classified by the link text.
+   Returns the number of fds, or -1 (gone, or links not readable). */
+static int walk_fds(const ProcFds *f, int types[T_NTYPES]) {
+    static char buf[65536];
+    if (types) memset(types, 0, T_NTYPES * sizeof(*types));
+    int d;
+    if (f->fd >= 0) {
+        d = dup(f->fd);
+        if (d >= 0) lseek(d, 0, SEEK_SET);
+    } else {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/fd", f->pid);
+        d = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+    if (d < 0) return -1;
+
+    ssize_t n;
+    int count = 0, denied = 0;
+    while (!denied && (n = getdents64(d, buf, sizeof(buf))) > 0) {
+        for (ssize_t off = 0; off < n && !denied; ) {
+            struct dirent64 *e = (struct dirent64 *)(buf + off);
+            off += e->d_reclen;
+            if (e->d_name[0] == '.') continue;
+            count++;
+            if (!types) continue;
+            char link[64];
+            ssize_t l = readlinkat(d, e->d_name, link, sizeof(link) - 1);
+            if (l < 0) {
+                denied = errno != ENOENT;          /* else closed meanwhile */
+                continue;
+            }
+            link[l] = '\0';
+            if (strncmp(link, "socket:", 7) == 0)         types[T_SOCK]++;
+            else if (strncmp(link, "pipe:", 5) == 0)      types[T_PIPE]++;
+            else if (strncmp(link, "anon_inode:", 11) == 0) types[T_ANON]++;
+            else if (link[0] == '/')                      types[T_FILE]++;
+            else                                          types[T_OTHER]++;
+        }
+    }
+    close(d);
+    return n < 0 || denied ? -1 : count;
+}
+
+/* ---- Scan schedule ------------------------------------------------------ */
+/* Walking a big fd directory costs a getdents per ~2,000 fds, and a
+   readlink per fd for the type breakdown; on a proxy with 100k sockets
+   that is most of a tick. So each process is walked on its own schedule:
+   every tick while its results keep changing, and twice as far apart
+   (up to MAX_EVERY ticks) each time a walk finds nothing new. Between
+   walks, cheap signals force an early one:
+     - type breakdown (top N only): the fd count, which fstat gives every
+       tick, moved by 1% or more since the walk; the process has just
+       entered the top N; or file-nr moved by over 1% system-wide.
+     - counts on kernels before 6.2, where fstat gives no count: FDSize in
+       status grew (the kernel resized the fd table), or file-nr moved.
+       Processes with at most 64 fds (the initial table) are walked every
+       tick, as that costs no more than reading status.
+   So no figure shown is older than MAX_EVERY ticks. */
+static unsigned tick;
+static long walks_done, walks_wanted;
+static int  sys_burst;                 /* file-nr moved by over 1% */
+
+static void sched(int *every, unsigned *due, int changed) {
+    int e = changed ? 1 : *every * 2;
+    if (e < 1) e = 1;
+    if (e > MAX_EVERY) e = MAX_EVERY;
+    *every = e;
+    *due   = tick + e;
+}
+
+static int read_fdsize(const ProcFds *f) {
+    char buf[4096];
+    int fd = openat(f->dir, "status", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return -1;
+    buf[n] = '\0';
+    char *v = strstr(buf, "\nFDSize:");
+    return v ? atoi(v + 8) : -1;
+}
+
+/* Count for kernels before 6.2: walked, or the last walk's if quiet */
+static int sched_count(ProcFds *f) {
+    walks_wanted++;
+    if (!sys_burst && tick < f->cnt_due && f->count > 64 &&
+        read_fdsize(f) == f->fdsize)
+        return f->count;
+    int n = walk_fds(f, NULL);
+    if (n < 0) return -1;
+    walks_done++;
+    sched(&f->cnt_every, &f->cnt_due, n != f->count);
+    f->count    = n;
+    f->cnt_tick = tick;
+    f->fdsize   = n > 64 ? read_fdsize(f) : 0;
+    return n;
+}
+
+/* Brings a displayed row's type breakdown up to date if it is due */
+static void sched_types(ProcFds *f, int fds) {
+    walks_wanted++;
+    int drift = fds > f->types_total ? fds - f->types_total : f->types_total - fds;
+    int limit = fds / 100 > 1 ? fds / 100 : 1;
+    if (f->types_ok && !sys_burst && tick < f->typ_due &&
+        f->shown_tick + 1 == tick && drift < limit)
+        return;
+    int types[T_NTYPES];
+    int n = walk_fds(f, types);
+    if (n < 0) { f->types_ok = 0; return; }
+    walks_done++;
+    sched(&f->typ_every, &f->typ_due,
+          !f->types_ok || memcmp(types, f->types, sizeof(types)) != 0);
+    memcpy(f->types, types, sizeof(types));
+    f->types_total = n;
+    f->types_ok    = 1;
+    f->typ_tick    = tick;
+}
+
+static void fmt_eta(double secs, char *out, size_t size) {
+    if (secs < 120)        snprintf(out, size, "%.0fs", secs);
+    else if (secs < 7200)  snprintf(out, size, "%.0fm", secs / 60);
+    else if (secs < 172800) snprintf(out, size, "%.1fh", secs / 3600);
+    else                   snprintf(out, size, "%.0fd", secs / 86400);
+}
+
+static void read_comm(ProcFds *f, char *name, int maxlen) {
+    ssize_t n = -1;
+    if (f->dir >= 0) {
+        if (f->comm < 0)
+            f->comm = openat(f->dir, "comm", O_RDONLY | O_CLOEXEC);
+        if (f->comm >= 0) n = pread(f->comm, name, maxlen - 1, 0);
+    } else {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/comm", f->pid);
+        int fd = open(path, O_RDONLY);
+        if (fd >= 0) { n = read(fd, name, maxlen - 1); close(fd); }
+    }
+    if (n > 0) {
+        name[n] = '\0';
+        if (name[n - 1] == '\n') name[n - 1] = '\0';
+    } else {
+        strncpy(name, "?", maxlen);
+    }
+}
+
 static void read_sys_fd(long *used, long *max_fds) {
     *used = -1; *max_fds = -1;
     char buf[128];
@@ -65,16 +367,19 @@ static void read_sys_fd(long *used, long *max_fds) {
 }
 
 static void usage(const char *prog) {
-    fprintf(stderr, "Usage: %s [-n N] [-t threshold] [-i seconds]\n", prog);
+    fprintf(stderr, "Usage: %s [-n N] [-t threshold] [-i seconds] [-w seconds] [-g]\n", prog);
     fprintf(stderr, "  -n N       show top N processes (default: 15)\n");
     fprintf(stderr, "  -t thresh  only show procs with >= thresh fds\n");
     fprintf(stderr, "  -i secs    refresh interval (default: 1)\n");
+    fprintf(stderr, "  -w secs    window for the growth rate (default: 60)\n");
+    fprintf(stderr, "  -g         sort by growth rate (default: open fds)\n");
 }
 
 int main(int argc, char *argv[]) {
     int top_n     = 15;
     int threshold = 0;
     int interval  = 1;
+    int sort_growth = 0;
 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
@@ -83,40 +388,90 @@ int main(int argc, char *argv[]) {
             threshold = atoi(argv[++i]);
         } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
             interval = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            window = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-g") == 0) {
+            sort_growth = 1;
         } else {
             usage(argv[0]); return EXIT_FAILURE;
         }
     }
     if (top_n < 1)    top_n = 1;
     if (interval < 1) interval = 1;
+    if (window < interval) window = interval;
+
+    ProcFD *procs = NULL;
+    size_t  procs_cap = 0;
 
-    static ProcFD procs[MAX_PROCS];
+    /* fdwatch itself is left out: its cache holds two fds per process */
+    pid_t self = getpid();
+    fd_limit_init();
+    size_is_count_init();
+    long prev_used = -1;
 
     while (1) {
         long sys_used, sys_max;
         read_sys_fd(&sys_used, &sys_max);
+        double now = now_sec();
+        tick++;
+        sys_burst = prev_used >= 0 && sys_used >= 0 &&
+                    labs(sys_used - prev_used) * 100 > sys_used;
+        prev_used = sys_used;
+        walks_done = walks_wanted = 0;
 
         int count = 0;
         DIR *dir = opendir("/proc");
         if (!dir) { perror("opendir /proc"); return EXIT_FAILURE; }
 
+        /* /proc lists PIDs in ascending order, so the cache (kept in the
+           same order) is matched with a single merge walk */
         struct dirent *ent;
-        while ((ent = readdir(dir)) != NULL && count < MAX_PROCS) {
+        size_t j = 0;
+        fdc_next.n = 0;
+        while ((ent = readdir(dir)) != NULL) {
             if (ent->d_name[0] < '1' || ent->d_name[0] > '9') continue;
             pid_t pid = (pid_t)atoi(ent->d_name);
             if (pid <= 0) continue;
 
-            int fds = count_fds(pid);
-            if (fds < 0 || fds < threshold) continue;
+            while (j < fdc.n && fdc.v[j].pid < pid) fds_close(&fdc.v[j++]);
+            ProcFds f = { .pid = pid, .dir = -1, .fd = -1, .comm = -1 };
+            int fds = -1;
+            if (j < fdc.n && fdc.v[j].pid == pid) {
+                f = fdc.v[j++];
+                if (f.dir >= 0 && (fds = count_fds(&f)) == -1)
+                    fds_close(&f);                 /* reaped, maybe reused */
+            }
+            if (f.dir < 0) {
+                fds_open(&f);
+                fds = f.dir >= 0 ? count_fds(&f) : count_fds_path(pid);
+            }
+            if (fds == -3) fds = sched_count(&f);
+            if (fds == -1) { fds_close(&f); continue; }   /* exited */
+            double rate = 0;
+            int rate_known = fds >= 0 && hist_rate(&f, fds, now, &rate);
+            fdc_push(&fdc_next, &f);
+            if (fds < 0 || fds < threshold || pid == self) continue;
 
+            if ((size_t)count == procs_cap) {
+                procs_cap = procs_cap ? procs_cap * 2 : 1024;
+                procs = realloc(procs, procs_cap * sizeof(*procs));
+                if (!procs) { perror("realloc"); return EXIT_FAILURE; }
+            }
             procs[count].pid      = pid;
             procs[count].fd_count = fds;
-            read_comm(pid, procs[count].name, NAME_LEN);
+            procs[count].growth   = rate;
+            procs[count].growth_known = rate_known;
+            procs[count].slot     = fdc_next.n - 1;
             count++;
         }
         closedir(dir);
+        while (j < fdc.n) fds_close(&fdc.v[j++]);
 
-        qsort(procs, count, sizeof(ProcFD), cmp_fd);
+        FdCache tmp = fdc;
+        fdc      = fdc_next;
+        fdc_next = tmp;
+
+        qsort(procs, count, sizeof(ProcFD), sort_growth ? cmp_growth : cmp_fd);
 
         printf("\033[2J\033[H");
 
@@ -128,14 +483,54 @@ int main(int argc, char *argv[]) {
         }
 
         int show = (count < top_n) ? count : top_n;
-        printf("%-8s %-20s %10s\n", "PID", "COMMAND", "OPEN FDs");
-        printf("%-8s %-20s %10s\n",
-               "--------", "--------------------", "--------");
+        printf("%-8s %-20s %10s %7s %7s %7s %7s %7s %10s %10s %8s\n",
+               "PID", "COMMAND", "OPEN FDs", "SOCK", "PIPE", "FILE", "ANON",
+               "OTHER", "LIMIT", "GROWTH/m", "FULL IN");
+        printf("%-8s %-20s %10s %7s %7s %7s %7s %7s %10s %10s %8s\n",
+               "--------", "--------------------", "--------", "-------",
+               "-------", "-------", "-------", "-------", "----------",
+               "----------", "--------");
 
+        unsigned oldest = 0;
         for (int i = 0; i < show; i++) {
-            printf("%-8d %-20.20s %10d\n",
+            ProcFds *f = &fdc.v[procs[i].slot];
+            read_comm(f, procs[i].name, NAME_LEN);
+            printf("%-8d %-20.20s %10d",
                    procs[i].pid, procs[i].name, procs[i].fd_count);
+
+            sched_types(f, procs[i].fd_count);
+            f->shown_tick = tick;
+            if (f->types_ok) {
+                const int *types = f->types;
+                printf(" %7d %7d %7d %7d %7d", types[T_SOCK], types[T_PIPE],
+                       types[T_FILE], types[T_ANON], types[T_OTHER]);
+                if (tick - f->typ_tick > oldest) oldest = tick - f->typ_tick;
+            } else
+                printf(" %7s %7s %7s %7s %7s", "-", "-", "-", "-", "-");
+
+            long limit = read_nofile(f);
+            if (limit > 0) printf(" %10ld", limit);
+            else           printf(" %10s", "-");
+
+            char eta[16] = "-";
+            if (procs[i].growth_known) {
+                printf(" %+10.1f", procs[i].growth * 60);
+                if (procs[i].growth > 0 && limit > procs[i].fd_count)
+                    fmt_eta((limit - procs[i].fd_count) / procs[i].growth,
+                            eta, sizeof(eta));
+                else if (limit > 0 && procs[i].fd_count >= limit)
+                    strcpy(eta, "now");
+            } else {
+                printf(" %10s", "-");
+            }
+            printf(" %8s\n", eta);
         }
+        if (walks_wanted > 0)
+            printf("\nfd dir walks: %ld of %ld due (%.0f%% skipped), types shown "
+                   "up to %u s old, at most %d s%s\n", walks_done, walks_wanted,
+                   (walks_wanted - walks_done) * 100.0 / walks_wanted,
+                   oldest * interval, MAX_EVERY * interval,
+                   sys_burst ? " (file-nr burst: all rewalked)" : "");
 
         fflush(stdout);
         sleep(interval);
@@ -6,22 +6,58 @@
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <signal.h>
 #include <libgen.h>
 
+#include "heaptrack.h"
+
 /*
  * heaptrack - wrap a command with heaptrack_inject.so to report
- *             malloc/free rates and live heap size every second.
+ *             malloc/free rates and live heap size every interval.
+ *
+ * Usage: heaptrack [-i ms] [-s bytes] [-n N] [-o out.folded] [-l N] [-H] [-L]
+ *                  [-T] [-M] [--record file] [--] <command> [args...]
  *
- * Usage: heaptrack <command> [args...]
+ *   -i ms     reporting interval in milliseconds (default: 1000)
+ *   -s bytes  sample one allocation per ~bytes allocated and attribute it
+ *             to its call stack (0 = off, default). 524288 keeps overhead
+ *             well under 2% on malloc-heavy servers.
+ *   -n N      show the top N sites by bytes/s and calls/s (default: 5)
+ *   -o file   write flamegraph-compatible folded stacks at exit
+ *   -l N      leak mode: keep up to N sampled live allocations and report
+ *             the top sites by retained bytes and by growth at exit, on
+ *             SIGUSR2 to the target, or on SIGUSR2 to heaptrack itself
+ *   -H        size-class histograms of requests and sampled lifetime
+ *             histograms, per interval and cumulative at exit
+ *   -L        time ~1 in 64 calls into the real allocator and report
+ *             p50/p99/p99.9/max alloc and free latency, with slow calls
+ *             (>= 10 us, or HEAPTRACK_LAT_SLOW_NS) by size class
+ *   -T        per-thread allocs, frees, bytes and net live bytes, plus the
+ *             sampled share of frees of blocks another thread allocated
+ *             and the top (allocating, freeing) thread pairs; -n sets the
+ *             number of rows shown per interval
+ *   -M        where the memory is: live heap vs malloc's arenas and mmapped
+ *             chunks vs the target's own mmap/brk, against resident and
+ *             anonymous resident bytes from /proc/<pid>/statm
+ *   --record file
+ *             also write every malloc/free to a compact binary trace for
+ *             offline analysis with heaptrack_analyze; with -s, sampled
+ *             events carry their call stack
  *
- * heaptrack_inject.so must be in the same directory as this binary.
+ * heaptrack_inject.so must be in the same directory as this binary. Stats
+ * arrive over a shared-memory ring (heaptrack.h); the wrapper sleeps on an
+ * eventfd and a pidfd, so it uses no CPU between intervals.
  */
 
 static volatile sig_atomic_t child_done = 0;
+static volatile sig_atomic_t leak_asked = 0;
 static pid_t child_pid = -1;
 
 static void on_sigchld(int sig) {
@@ -29,6 +65,11 @@ static void on_sigchld(int sig) {
     child_done = 1;
 }
 
+static void on_sigusr2(int sig) {
+    (void)sig;
+    leak_asked = 1;
+}
+
 static void on_sigint(int sig) {
     (void)sig;
     if (child_pid > 0) kill(child_pid, SIGINT);
@@ -51,12 +92,586 @@ static void format_bytes(long b, char *out, size_t len) {
     else                       snprintf(out, len, "%ld B",   b);
 }
 
+static void format_ns(double ns, char *out, size_t len) {
+    if      (ns >= 1e9) snprintf(out, len, "%.3g s",  ns / 1e9);
+    else if (ns >= 1e6) snprintf(out, len, "%.3g ms", ns / 1e6);
+    else if (ns >= 1e3) snprintf(out, len, "%.3g us", ns / 1e3);
+    else                snprintf(out, len, "%.0f ns", ns);
+}
+
+static void format_class(int c, char *out, size_t len) {
+    uint64_t max = ht_class_max(c);
+    if (!max) {
+        snprintf(out, len, "larger");
+        return;
+    }
+    char b[24];
+    format_bytes((long)max, b, sizeof(b));
+    snprintf(out, len, "<= %s", b);
+}
+
+/* ---- Histograms --------------------------------------------------------- */
+#define SHORT_LIVED_BUCKETS 20   /* buckets 0..19: lifetimes < 2^20 ns (~1 ms) */
+
+static HtHist hist_total;        /* cumulative over the run */
+
+static void print_hist_interval(const HtHist *h) {
+    int64_t n = 0;
+    for (int c = 0; c < HT_NCLASSES; c++) n += h->sizes[c];
+
+    printf("  sizes:");
+    if (n > 0) {
+        /* three busiest classes */
+        int used[3] = { -1, -1, -1 };
+        for (int k = 0; k < 3; k++) {
+            int best = -1;
+            for (int c = 0; c < HT_NCLASSES; c++) {
+                if (c == used[0] || c == used[1] || !h->sizes[c]) continue;
+                if (best < 0 || h->sizes[c] > h->sizes[best]) best = c;
+            }
+            if (best < 0) break;
+            used[k] = best;
+            char label[32];
+            format_class(best, label, sizeof(label));
+            printf("  %s %.0f%%", label, h->sizes[best] * 100.0 / n);
+        }
+    }
+
+    int64_t life = 0, short_small = 0;
+    for (int g = 0; g < HT_NGROUPS; g++)
+        for (int b = 0; b < HT_NLIFE; b++) {
+            life += h->life[g][b];
+            if (g <= 1 && b < SHORT_LIVED_BUCKETS) short_small += h->life[g][b];
+        }
+    if (life > 0)
+        printf("  | short-lived small: %.0f%% of %lld sampled frees",
+               short_small * 100.0 / life, (long long)life);
+    printf("\n");
+}
+
+static void print_hist_total(void) {
+    const HtHist *h = &hist_total;
+    int64_t n = 0, cum = 0;
+    for (int c = 0; c < HT_NCLASSES; c++) n += h->sizes[c];
+    if (n == 0) return;
+
+    printf("\nRequest size classes (cumulative)\n");
+    printf("%-12s %14s %8s %8s\n", "class", "requests", "%", "cum%");
+    for (int c = 0; c < HT_NCLASSES; c++) {
+        if (!h->sizes[c]) continue;
+        cum += h->sizes[c];
+        char label[32];
+        format_class(c, label, sizeof(label));
+        printf("%-12s %14lld %7.1f%% %7.1f%%\n", label,
+               (long long)h->sizes[c], h->sizes[c] * 100.0 / n, cum * 100.0 / n);
+    }
+
+    int64_t life = 0, short_small = 0, small = 0;
+    for (int g = 0; g < HT_NGROUPS; g++)
+        for (int b = 0; b < HT_NLIFE; b++) {
+            life += h->life[g][b];
+            if (g <= 1) small += h->life[g][b];
+            if (g <= 1 && b < SHORT_LIVED_BUCKETS) short_small += h->life[g][b];
+        }
+    if (life == 0) return;
+
+    printf("\nSampled lifetimes (cumulative, %lld frees)\n", (long long)life);
+    printf("%-12s %10s %10s %10s %10s\n",
+           "lifetime <", "<=64 B", "<=256 B", "<=4 KB", "larger");
+    for (int b = 0; b < HT_NLIFE; b++) {
+        int64_t row = 0;
+        for (int g = 0; g < HT_NGROUPS; g++) row += h->life[g][b];
+        if (!row) continue;
+        char label[32];
+        if (b == HT_NLIFE - 1) snprintf(label, sizeof(label), "longer");
+        else format_ns((double)(1ull << (b + 1)), label, sizeof(label));
+        printf("%-12s", label);
+        for (int g = 0; g < HT_NGROUPS; g++)
+            printf(" %9.1f%%", h->life[g][b] * 100.0 / life);
+        printf("\n");
+    }
+    printf("\nShort-lived small objects (<= 256 B, freed within ~1 ms): "
+           "%.1f%% of sampled frees, %.1f%% of small ones.\n",
+           short_small * 100.0 / life,
+           small ? short_small * 100.0 / small : 0.0);
+    printf("A high share favours an arena or pool allocator on those paths.\n");
+}
+
+/* ---- Allocator latency ------------------------------------------------- */
+static HtLat lat_total;          /* cumulative; max_ns is the overall max */
+
+/* Upper edge of the bucket holding quantile q, capped by the max seen */
+static double lat_quantile(const int64_t *h, int64_t n, double q, int64_t max) {
+    int64_t want = (int64_t)(q * (double)n + 0.999999), cum = 0;
+    if (want < 1) want = 1;
+    for (int b = 0; b < HT_NLAT; b++) {
+        cum += h[b];
+        if (cum < want) continue;
+        double up = b + 1 < HT_NLAT ? (double)ht_lat_min(b + 1) : (double)max;
+        return max > 0 && up > (double)max ? (double)max : up;
+    }
+    return (double)max;
+}
+
+static void print_lat_ops(const HtLat *l, int cumulative) {
+    static const char *op[] = { "alloc", "free" };
+    for (int o = 0; o < HT_NLATOPS; o++) {
+        int64_t n = 0;
+        for (int b = 0; b < HT_NLAT; b++) n += l->hist[o][b];
+        if (!n) continue;
+        char p50[16], p99[16], p999[16], mx[16];
+        format_ns(lat_quantile(l->hist[o], n, 0.50,  l->max_ns[o]), p50,  sizeof(p50));
+        format_ns(lat_quantile(l->hist[o], n, 0.99,  l->max_ns[o]), p99,  sizeof(p99));
+        format_ns(lat_quantile(l->hist[o], n, 0.999, l->max_ns[o]), p999, sizeof(p999));
+        format_ns((double)l->max_ns[o], mx, sizeof(mx));
+        printf("%s%-6s p50 %-8s p99 %-8s p99.9 %-8s max %-8s (%lld timed)\n",
+               cumulative ? "" : "  ", op[o], p50, p99, p999, mx, (long long)n);
+    }
+}
+
+static void print_lat_interval(const HtLat *l) {
+    print_lat_ops(l, 0);
+
+    int64_t slow = 0;
+    for (int o = 0; o < HT_NLATOPS; o++)
+        for (int c = 0; c < HT_NCLASSES; c++) slow += l->slow[o][c];
+    if (!slow) return;
+    char thr[16];
+    format_ns((double)l->slow_ns, thr, sizeof(thr));
+    printf("  slow >= %s:", thr);
+    /* three classes with the most slow calls, alloc and free together */
+    int used[3] = { -1, -1, -1 };
+    for (int k = 0; k < 3; k++) {
+        int best = -1;
+        int64_t best_n = 0;
+        for (int c = 0; c < HT_NCLASSES; c++) {
+            if (c == used[0] || c == used[1]) continue;
+            int64_t n = l->slow[HT_LAT_ALLOC][c] + l->slow[HT_LAT_FREE][c];
+            if (n > best_n) { best = c; best_n = n; }
+        }
+        if (best < 0) break;
+        used[k] = best;
+        char label[32];
+        format_class(best, label, sizeof(label));
+        printf("  %s %lld", label, (long long)best_n);
+    }
+    printf("\n");
+}
+
+static void print_lat_total(void) {
+    const HtLat *l = &lat_total;
+    int64_t timed = 0, slow = 0;
+    for (int o = 0; o < HT_NLATOPS; o++) {
+        for (int b = 0; b < HT_NLAT; b++) timed += l->hist[o][b];
+        for (int c = 0; c < HT_NCLASSES; c++) slow += l->slow[o][c];
+    }
+    if (!timed) return;
+
+    printf("\nAllocator latency (cumulative, 1 in ~%u calls timed)\n", l->every);
+    print_lat_ops(l, 1);
+    if (!slow) return;
+
+    char thr[16];
+    format_ns((double)l->slow_ns, thr, sizeof(thr));
+    printf("\nSlow calls (>= %s) by size class\n", thr);
+    printf("%-12s %10s %10s %8s\n", "class", "alloc", "free", "%");
+    for (int c = 0; c < HT_NCLASSES; c++) {
+        int64_t a = l->slow[HT_LAT_ALLOC][c], f = l->slow[HT_LAT_FREE][c];
+        if (!a && !f) continue;
+        char label[32];
+        format_class(c, label, sizeof(label));
+        printf("%-12s %10lld %10lld %7.1f%%\n", label, (long long)a, (long long)f,
+               (a + f) * 100.0 / slow);
+    }
+}
+
+/* ---- Per-thread report ------------------------------------------------- */
+typedef struct {
+    uint32_t tid;
+    int      alive;
+    char     name[16];
+    int64_t  allocs, frees, alloc_bytes, free_bytes, sfrees, xfrees;
+} ThreadTotal;
+
+typedef struct {
+    uint32_t alloc_tid, free_tid;
+    int64_t  est;                      /* sampled count * every */
+} PairTotal;
+
+static ThreadTotal *thr;
+static size_t       nthr, thr_cap;
+static PairTotal   *pairs;
+static size_t       npairs, pairs_cap;
+static int          top_threads = 5;
+static int          thread_rank = 0;   /* rows printed this interval */
+static int          pair_rank = 0;
+
+static void *grow(void *p, size_t *cap, size_t elem) {
+    *cap = *cap ? *cap * 2 : 64;
+    p = realloc(p, *cap * elem);
+    if (!p) { perror("realloc"); exit(EXIT_FAILURE); }
+    return p;
+}
+
+/* Latest live entry for tid; tids are reused once a thread has exited */
+static ThreadTotal *thread_total(uint32_t tid) {
+    for (size_t i = nthr; i-- > 0; )
+        if (thr[i].tid == tid && thr[i].alive) return &thr[i];
+    if (nthr == thr_cap) thr = grow(thr, &thr_cap, sizeof(*thr));
+    ThreadTotal *t = &thr[nthr++];
+    memset(t, 0, sizeof(*t));
+    t->tid   = tid;
+    t->alive = 1;
+    return t;
+}
+
+static const char *thread_label(uint32_t tid) {
+    for (size_t i = nthr; i-- > 0; )
+        if (thr[i].tid == tid && thr[i].name[0]) return thr[i].name;
+    return "?";
+}
+
+static void handle_thread(const HtThread *r, double secs) {
+    ThreadTotal *t = thread_total(r->tid);
+    if (r->name[0]) {
+        memcpy(t->name, r->name, sizeof(t->name));
+        t->name[sizeof(t->name) - 1] = '\0';
+    }
+    t->allocs      += r->allocs;
+    t->frees       += r->frees;
+    t->alloc_bytes += r->alloc_bytes;
+    t->free_bytes  += r->free_bytes;
+    t->sfrees      += r->sfrees;
+    t->xfrees      += r->xfrees;
+    t->alive        = r->alive != 0;
+
+    if (thread_rank++ >= top_threads) return;
+    if (thread_rank == 1)
+        printf("  %-16s %7s %11s %11s %12s %12s %7s\n", "thread", "tid",
+               "allocs/s", "frees/s", "alloc/s", "net", "xfree%");
+    char rate[32], net[32], xf[16];
+    format_bytes((long)(r->alloc_bytes / secs), rate, sizeof(rate));
+    int64_t n = t->alloc_bytes - t->free_bytes;
+    format_bytes((long)(n < 0 ? -n : n), net, sizeof(net));
+    if (r->sfrees) snprintf(xf, sizeof(xf), "%.1f%%", r->xfrees * 100.0 / r->sfrees);
+    else           snprintf(xf, sizeof(xf), "-");
+    printf("  %-16s %7u %11.0f %11.0f %10s/s %s%11s %7s%s\n",
+           t->name[0] ? t->name : "?", r->tid, r->allocs / secs, r->frees / secs,
+           rate, n < 0 ? "-" : " ", net, xf, r->alive ? "" : "  (exited)");
+}
+
+static void handle_xpair(const HtXPair *x, double secs) {
+    PairTotal *p = NULL;
+    for (size_t i = 0; i < npairs; i++)
+        if (pairs[i].alloc_tid == x->alloc_tid && pairs[i].free_tid == x->free_tid) {
+            p = &pairs[i];
+            break;
+        }
+    if (!p) {
+        if (npairs == pairs_cap) pairs = grow(pairs, &pairs_cap, sizeof(*pairs));
+        p = &pairs[npairs++];
+        *p = (PairTotal){ x->alloc_tid, x->free_tid, 0 };
+    }
+    p->est += x->count * (int64_t)x->every;
+
+    if (pair_rank++ >= 3) return;
+    printf("  xfree  %s(%u) -> %s(%u)  ~%.0f/s\n",
+           thread_label(x->alloc_tid), x->alloc_tid,
+           thread_label(x->free_tid), x->free_tid,
+           x->count * (double)x->every / secs);
+}
+
+static int cmp_thread(const void *a, const void *b) {
+    const ThreadTotal *x = a, *y = b;
+    int64_t kx = x->allocs + x->frees, ky = y->allocs + y->frees;
+    return kx < ky ? 1 : kx > ky ? -1 : 0;
+}
+
+static int cmp_pair(const void *a, const void *b) {
+    const PairTotal *x = a, *y = b;
+    return x->est < y->est ? 1 : x->est > y->est ? -1 : 0;
+}
+
+#define THREAD_ROWS 30
+
+static void print_threads_total(void) {
+    if (!nthr) return;
+    qsort(thr, nthr, sizeof(*thr), cmp_thread);
+
+    int64_t sfrees = 0, xfrees = 0;
+    printf("\nPer-thread totals (net = bytes allocated - bytes freed by the thread)\n");
+    printf("%-16s %7s %12s %12s %12s %12s %7s\n", "thread", "tid",
+           "allocs", "frees", "allocated", "net", "xfree%");
+    for (size_t i = 0; i < nthr; i++) {
+        ThreadTotal *t = &thr[i];
+        sfrees += t->sfrees;
+        xfrees += t->xfrees;
+        if (i >= THREAD_ROWS) continue;
+        char by[32], net[32], xf[16];
+        int64_t n = t->alloc_bytes - t->free_bytes;
+        format_bytes((long)t->alloc_bytes, by, sizeof(by));
+        format_bytes((long)(n < 0 ? -n : n), net, sizeof(net));
+        if (t->sfrees) snprintf(xf, sizeof(xf), "%.1f%%", t->xfrees * 100.0 / t->sfrees);
+        else           snprintf(xf, sizeof(xf), "-");
+        printf("%-16s %7u %12lld %12lld %12s %s%11s %7s\n",
+               t->name[0] ? t->name : "?", t->tid, (long long)t->allocs,
+               (long long)t->frees, by, n < 0 ? "-" : " ", net, xf);
+    }
+    if (nthr > THREAD_ROWS)
+        printf("... %zu more threads\n", nthr - THREAD_ROWS);
+    if (!sfrees) return;
+
+    printf("\nCross-thread frees: %.1f%% of %lld sampled frees were of blocks "
+           "another thread allocated\n", xfrees * 100.0 / sfrees, (long long)sfrees);
+    if (!npairs) return;
+    qsort(pairs, npairs, sizeof(*pairs), cmp_pair);
+    printf("%12s  %s\n", "est. frees", "allocating thread -> freeing thread");
+    for (size_t i = 0; i < npairs && i < (size_t)top_threads; i++)
+        printf("%12lld  %s(%u) -> %s(%u)\n", (long long)pairs[i].est,
+               thread_label(pairs[i].alloc_tid), pairs[i].alloc_tid,
+               thread_label(pairs[i].free_tid), pairs[i].free_tid);
+}
+
+/* ---- Mappings and resident memory -------------------------------------- */
+static int64_t last_live = 0;  /* live heap from the latest interval */
+
+/* Resident and file/shmem-backed resident bytes from /proc/<pid>/statm */
+static int read_statm(pid_t pid, int64_t *resident, int64_t *shared) {
+    char path[64], buf[256];
+    snprintf(path, sizeof(path), "/proc/%d/statm", (int)pid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return -1;
+    buf[n] = '\0';
+    long size, res, shr;
+    if (sscanf(buf, "%ld %ld %ld", &size, &res, &shr) != 3) return -1;
+    long pg = sysconf(_SC_PAGESIZE);
+    *resident = (int64_t)res * pg;
+    *shared   = (int64_t)shr * pg;
+    return 0;
+}
+
+static void print_mem(const HtMem *m) {
+    char live[32], heap[32], hfree[32], app[32], rss[32], anon[32];
+    int64_t heap_bytes = m->heap_arena + m->heap_mmap;
+    format_bytes((long)last_live,   live,  sizeof(live));
+    format_bytes((long)heap_bytes,  heap,  sizeof(heap));
+    format_bytes((long)m->heap_free, hfree, sizeof(hfree));
+    format_bytes((long)(m->app_mapped < 0 ? 0 : m->app_mapped), app, sizeof(app));
+    printf("  mapped: live %s  malloc heap %s (%s free)  own mmap %s",
+           live, heap, hfree, app);
+
+    int64_t res, shr;
+    if (read_statm(child_pid, &res, &shr) == 0) {
+        format_bytes((long)res, rss, sizeof(rss));
+        format_bytes((long)(res - shr), anon, sizeof(anon));
+        printf("  | resident %s (anon %s)", rss, anon);
+        if (last_live > 0)
+            printf("  anon/live %.2fx", (double)(res - shr) / (double)last_live);
+    }
+    printf("\n");
+
+    if (m->mmaps || m->munmaps || m->mremaps || m->brks || m->madvises) {
+        char rel[32];
+        format_bytes((long)m->madv_bytes, rel, sizeof(rel));
+        printf("  calls:  mmap %lld  munmap %lld  mremap %lld  brk %lld  "
+               "madvise %lld (%s released)\n",
+               (long long)m->mmaps, (long long)m->munmaps, (long long)m->mremaps,
+               (long long)m->brks, (long long)m->madvises, rel);
+    }
+}
+
+/* ---- Leak reports ------------------------------------------------------- */
+static void print_leak_hdr(const HtLeakHdr *h) {
+    static const char *why[] = { "at exit", "on SIGUSR2", "on request" };
+    char ret[32], grow[32];
+    format_bytes((long)h->retained, ret, sizeof(ret));
+    format_bytes((long)(h->growth < 0 ? -h->growth : h->growth), grow, sizeof(grow));
+    printf("\nLeak report #%u %s: %s retained by sampled sites, %s%s since last report\n",
+           h->seq, h->reason < 3 ? why[h->reason] : "", ret,
+           h->growth < 0 ? "-" : "+", grow);
+    printf("  tracking %lld of %lld sampled allocations",
+           (long long)h->tracked, (long long)h->capacity);
+    if (h->dropped)
+        printf(" (%lld not tracked: table full, raise -l)", (long long)h->dropped);
+    printf("\n");
+}
+
+static void print_leak_site(const HtLeakSite *s) {
+    char sym[HT_SYM_LEN], bytes[32], grow[32];
+    memcpy(sym, s->sym, sizeof(sym));
+    sym[sizeof(sym) - 1] = '\0';
+    format_bytes((long)s->bytes, bytes, sizeof(bytes));
+    format_bytes((long)(s->growth < 0 ? -s->growth : s->growth), grow, sizeof(grow));
+    if (s->rank == 0)
+        printf("  %-9s %12s %10s %12s  %s\n",
+               s->kind == HT_LEAK_RETAINED ? "retained" : "growth",
+               "bytes", "blocks", "growth", "site");
+    printf("  %-9s %12s %10lld %s%11s  %s\n", "", bytes, (long long)s->count,
+           s->growth < 0 ? "-" : "+", grow, sym);
+}
+
+static double elapsed = 0.0;   /* seconds covered by interval records */
+static double last_secs = 0.0; /* length of the latest interval */
+
+static void handle_record(const HtRec *rec) {
+    size_t len = rec->len - sizeof(HtRec);
+
+    if (rec->type == HT_REC_INTERVAL && len >= sizeof(HtInterval)) {
+        const HtInterval *iv = (const HtInterval *)(rec + 1);
+        double secs = iv->interval_ns / 1e9;
+        if (secs <= 0) return;
+        elapsed += secs;
+
+        char abytes_str[32], live_str[32];
+        format_bytes((long)(iv->alloc_bytes / secs), abytes_str, sizeof(abytes_str));
+        format_bytes((long)iv->live_bytes,           live_str,   sizeof(live_str));
+        printf("%-12.1f %12.0f %12.0f %14s %14s\n",
+               elapsed, iv->allocs / secs, iv->frees / secs,
+               abytes_str, live_str);
+        last_secs   = secs;
+        last_live   = iv->live_bytes;
+        thread_rank = 0;
+        pair_rank   = 0;
+    } else if (rec->type == HT_REC_SITE && len >= sizeof(HtSite)) {
+        const HtSite *s = (const HtSite *)(rec + 1);
+        double secs = last_secs > 0 ? last_secs : 1.0;
+        char abytes_str[32], sym[HT_SYM_LEN];
+        memcpy(sym, s->sym, sizeof(sym));
+        sym[sizeof(sym) - 1] = '\0';
+        format_bytes((long)(s->bytes / secs), abytes_str, sizeof(abytes_str));
+        printf("  %-10s %12s/s %10.0f calls/s  %s\n",
+               s->kind == HT_SITE_BYTES ? "top bytes" : "top calls",
+               abytes_str, s->calls / secs, sym);
+    } else if (rec->type == HT_REC_LEAK_HDR && len >= sizeof(HtLeakHdr)) {
+        print_leak_hdr((const HtLeakHdr *)(rec + 1));
+    } else if (rec->type == HT_REC_LEAK_SITE && len >= sizeof(HtLeakSite)) {
+        print_leak_site((const HtLeakSite *)(rec + 1));
+    } else if (rec->type == HT_REC_HIST && len >= sizeof(HtHist)) {
+        const HtHist *h = (const HtHist *)(rec + 1);
+        for (int c = 0; c < HT_NCLASSES; c++) hist_total.sizes[c] += h->sizes[c];
+        for (int g = 0; g < HT_NGROUPS; g++)
+            for (int b = 0; b < HT_NLIFE; b++)
+                hist_total.life[g][b] += h->life[g][b];
+        print_hist_interval(h);
+    } else if (rec->type == HT_REC_LAT && len >= sizeof(HtLat)) {
+        const HtLat *l = (const HtLat *)(rec + 1);
+        lat_total.every   = l->every;
+        lat_total.slow_ns = l->slow_ns;
+        for (int o = 0; o < HT_NLATOPS; o++) {
+            if (l->max_ns[o] > lat_total.max_ns[o]) lat_total.max_ns[o] = l->max_ns[o];
+            for (int b = 0; b < HT_NLAT; b++) lat_total.hist[o][b] += l->hist[o][b];
+            for (int c = 0; c < HT_NCLASSES; c++) lat_total.slow[o][c] += l->slow[o][c];
+        }
+        print_lat_interval(l);
+    } else if (rec->type == HT_REC_THREAD && len >= sizeof(HtThread)) {
+        handle_thread((const HtThread *)(rec + 1), last_secs > 0 ? last_secs : 1.0);
+    } else if (rec->type == HT_REC_XPAIR && len >= sizeof(HtXPair)) {
+        handle_xpair((const HtXPair *)(rec + 1), last_secs > 0 ? last_secs : 1.0);
+    } else if (rec->type == HT_REC_MEM && len >= sizeof(HtMem)) {
+        print_mem((const HtMem *)(rec + 1));
+    }
+}
+
+/* Consume every published record. The target is untrusted, so record
+   lengths are checked before use. */
+static void drain(HtRing *r) {
+    uint64_t tail = atomic_load_explicit(&r->hdr.tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&r->hdr.head, memory_order_acquire);
+
+    while (tail < head) {
+        uint32_t pos = (uint32_t)(tail & (HT_RING_SIZE - 1));
+        const HtRec *rec = (const HtRec *)(r->data + pos);
+        if (rec->len < sizeof(HtRec) || (rec->len & 7) ||
+            rec->len > HT_RING_SIZE - pos) {
+            fprintf(stderr, "heaptrack: corrupt ring record, resyncing\n");
+            tail = head;
+            break;
+        }
+        handle_record(rec);
+        tail += rec->len;
+    }
+    atomic_store_explicit(&r->hdr.tail, tail, memory_order_release);
+    fflush(stdout);
+}
+
+static HtRing *ring_create(int *fd_out) {
+    int fd = (int)syscall(SYS_memfd_create, "heaptrack", 0);
+    if (fd < 0) { perror("memfd_create"); return NULL; }
+    if (ftruncate(fd, sizeof(HtRing)) < 0) {
+        perror("ftruncate"); close(fd); return NULL;
+    }
+    HtRing *r = mmap(NULL, sizeof(HtRing), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+    if (r == MAP_FAILED) { perror("mmap"); close(fd); return NULL; }
+
+    r->hdr.magic     = HT_MAGIC;
+    r->hdr.version   = HT_VERSION;
+    r->hdr.ring_size = HT_RING_SIZE;
+    *fd_out = fd;
+    return r;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-i ms] [-s bytes] [-n N] [-o file] [-l N] [-H] [-L] [-T] [-M] [--record file] [--] <command> [args...]\n", prog);
+    fprintf(stderr, "  -i ms     reporting interval in milliseconds (default: 1000)\n");
+    fprintf(stderr, "  -s bytes  sample ~1 allocation per bytes and attribute to call sites\n");
+    fprintf(stderr, "  -n N      top N sites by bytes/s and calls/s (default: 5)\n");
+    fprintf(stderr, "  -o file   write folded stacks for flamegraph.pl at exit (needs -s)\n");
+    fprintf(stderr, "  -l N      leak report: track up to N sampled live allocations\n");
+    fprintf(stderr, "            (send SIGUSR2 to heaptrack or the target for a report)\n");
+    fprintf(stderr, "  -H        size-class and sampled lifetime histograms\n");
+    fprintf(stderr, "  -L        sampled allocator call latency (p50/p99/p99.9/max)\n");
+    fprintf(stderr, "  -T        per-thread table and cross-thread frees\n");
+    fprintf(stderr, "  -M        live vs mapped vs resident memory, mmap/brk/madvise calls\n");
+    fprintf(stderr, "  --record file  write a binary trace of every malloc/free\n");
+    fprintf(stderr, "            (read it with heaptrack_analyze)\n");
+    fprintf(stderr, "  heaptrack_inject.so must be in the same directory.\n");
+}
+
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <command> [args...]\n", argv[0]);
-        fprintf(stderr, "  heaptrack_inject.so must be in the same directory.\n");
-        return EXIT_FAILURE;
+    const char *sample = NULL, *topn = NULL, *folded = NULL, *leak = NULL;
+    const char *record = NULL;
+    long interval_ms = 1000;
+    int hist = 0, lat = 0, threads = 0, maps = 0;
+    int argi = 1;
+
+    for (; argi < argc && argv[argi][0] == '-'; argi++) {
+        if (strcmp(argv[argi], "--") == 0) {
+            argi++; break;
+        } else if (strcmp(argv[argi], "-i") == 0 && argi + 1 < argc) {
+            interval_ms = atol(argv[++argi]);
+        } else if (strcmp(argv[argi], "-s") == 0 && argi + 1 < argc) {
+            sample = argv[++argi];
+        } else if (strcmp(argv[argi], "-n") == 0 && argi + 1 < argc) {
+            topn = argv[++argi];
+        } else if (strcmp(argv[argi], "-o") == 0 && argi + 1 < argc) {
+            folded = argv[++argi];
+        } else if (strcmp(argv[argi], "-l") == 0 && argi + 1 < argc) {
+            leak = argv[++argi];
+        } else if (strcmp(argv[argi], "-H") == 0) {
+            hist = 1;
+        } else if (strcmp(argv[argi], "-L") == 0) {
+            lat = 1;
+        } else if (strcmp(argv[argi], "-T") == 0) {
+            threads = 1;
+        } else if (strcmp(argv[argi], "-M") == 0) {
+            maps = 1;
+        } else if (strcmp(argv[argi], "--record") == 0 && argi + 1 < argc) {
+            record = argv[++argi];
+        } else {
+            usage(argv[0]); return EXIT_FAILURE;
+        }
     }
+    if (argi >= argc) {
+        usage(argv[0]); return EXIT_FAILURE;
+    }
+    if (interval_ms < 10) interval_ms = 10;
+    if ((folded || leak) && !sample) sample = "524288";
+    if (topn && atoi(topn) > 0) top_threads = atoi(topn);
+    char **cmd = &argv[argi];
 
     /* Locate inject library */
     char exe_dir[4096];
@@ -70,36 +685,26 @@ int main(int argc, char *argv[]) {
         return EXIT_FAILURE;
     }
 
-    /* Create a FIFO for stats delivery */
-    char fifo[64];
-    snprintf(fifo, sizeof(fifo), "/tmp/heaptrack_%d", (int)getpid());
-    if (mkfifo(fifo, 0600) < 0) {
-        perror("mkfifo");
-        return EXIT_FAILURE;
-    }
-
-    /* Open FIFO for reading (non-blocking so we don't block before fork) */
-    int fifo_rd = open(fifo, O_RDONLY | O_NONBLOCK);
-    if (fifo_rd < 0) {
-        perror("open fifo");
-        unlink(fifo);
-        return EXIT_FAILURE;
-    }
+    /* Shared ring and wakeup eventfd; both are inherited by the child */
+    int shm_fd;
+    HtRing *ring = ring_create(&shm_fd);
+    if (!ring) return EXIT_FAILURE;
+    int efd = eventfd(0, EFD_NONBLOCK);
+    if (efd < 0) { perror("eventfd"); return EXIT_FAILURE; }
 
     /* Fork the target process */
     signal(SIGCHLD, on_sigchld);
     signal(SIGINT,  on_sigint);
+    signal(SIGUSR2, on_sigusr2);
 
     child_pid = fork();
     if (child_pid < 0) {
         perror("fork");
-        close(fifo_rd); unlink(fifo);
         return EXIT_FAILURE;
     }
 
     if (child_pid == 0) {
         /* Child: set env vars and exec target */
-        close(fifo_rd);
 
         /* Prepend our .so to any existing LD_PRELOAD */
         const char *old_preload = getenv("LD_PRELOAD");
@@ -109,92 +714,89 @@ int main(int argc, char *argv[]) {
         else
             snprintf(new_preload, sizeof(new_preload), "%s", so_path);
 
-        setenv("LD_PRELOAD",     new_preload, 1);
-        setenv("HEAPTRACK_FIFO", fifo,        1);
+        char num[32];
+        setenv("LD_PRELOAD", new_preload, 1);
+        snprintf(num, sizeof(num), "%d", shm_fd);
+        setenv("HEAPTRACK_SHM_FD", num, 1);
+        snprintf(num, sizeof(num), "%d", efd);
+        setenv("HEAPTRACK_EVENTFD", num, 1);
+        snprintf(num, sizeof(num), "%ld", interval_ms);
+        setenv("HEAPTRACK_INTERVAL_MS", num, 1);
+        snprintf(num, sizeof(num), "%d", (int)getpid());
+        setenv("HEAPTRACK_PID", num, 1);
+        if (sample) setenv("HEAPTRACK_SAMPLE", sample, 1);
+        if (topn)   setenv("HEAPTRACK_TOPN",   topn,   1);
+        if (folded) setenv("HEAPTRACK_FOLDED", folded, 1);
+        if (hist)   setenv("HEAPTRACK_HIST",   "1",    1);
+        if (leak)   setenv("HEAPTRACK_LEAK",   leak,   1);
+        if (lat)    setenv("HEAPTRACK_LATENCY", "64",   1);
+        if (threads) setenv("HEAPTRACK_THREADS", "1",   1);
+        if (maps)   setenv("HEAPTRACK_MAPS",   "1",    1);
+        if (record) setenv("HEAPTRACK_RECORD", record, 1);
 
-        execvp(argv[1], &argv[1]);
+        execvp(cmd[0], cmd);
         perror("execvp");
         _exit(EXIT_FAILURE);
     }
+    close(shm_fd);
 
-    /* Parent: read stats from FIFO and display */
-    printf("heaptrack: attached to '%s' (pid %d)\n", argv[1], child_pid);
+    /* pidfd becomes readable when the child exits (Linux 5.3+). Without it
+       we rely on SIGCHLD interrupting poll(). */
+    int pidfd = (int)syscall(SYS_pidfd_open, child_pid, 0);
+
+    /* Parent: consume records and display */
+    printf("heaptrack: attached to '%s' (pid %d)\n", cmd[0], child_pid);
     printf("%-12s %12s %12s %14s %14s\n",
            "time(s)", "malloc/s", "free/s", "alloc/s (bytes)", "live heap");
     printf("%-12s %12s %12s %14s %14s\n",
            "------------", "------------", "------------",
            "--------------", "--------------");
 
-    char line_buf[256];
-    int  line_pos = 0;
-    int  elapsed  = 0;
+    struct pollfd pfd[2] = {
+        { .fd = efd,   .events = POLLIN },
+        { .fd = pidfd, .events = POLLIN },
+    };
+    /* Backstop timeout in case the target closes its copy of the eventfd */
+    int backstop_ms = interval_ms * 4 > 1000 ? (int)interval_ms * 4 : 1000;
 
     while (!child_done) {
-        char ch;
-        ssize_t n = read(fifo_rd, &ch, 1);
-        if (n < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                usleep(10000); /* 10 ms */
-                continue;
-            }
-            break;
-        }
-        if (n == 0) { usleep(10000); continue; }
-
-        if (ch == '\n' || line_pos >= (int)sizeof(line_buf) - 1) {
-            line_buf[line_pos] = '\0';
-            line_pos = 0;
-
-            long allocs, frees, abytes, live;
-            if (sscanf(line_buf, "%ld %ld %ld %ld",
-                       &allocs, &frees, &abytes, &live) == 4) {
-                char abytes_str[32], live_str[32];
-                format_bytes(abytes, abytes_str, sizeof(abytes_str));
-                format_bytes(live,   live_str,   sizeof(live_str));
-                printf("%-12d %12ld %12ld %14s %14s\n",
-                       ++elapsed, allocs, frees, abytes_str, live_str);
-                fflush(stdout);
-            }
-        } else {
-            line_buf[line_pos++] = ch;
+        int n = poll(pfd, pidfd >= 0 ? 2 : 1, backstop_ms);
+        if (n < 0 && errno != EINTR) { perror("poll"); break; }
+        if (leak_asked) {
+            /* served by the target's reporter on its next interval */
+            leak_asked = 0;
+            atomic_fetch_add_explicit(&ring->hdr.dump_req, 1, memory_order_release);
         }
-    }
-
-    /* Drain any remaining output */
-    {
-        char drain[256];
-        ssize_t r;
-        while ((r = read(fifo_rd, drain, sizeof(drain))) > 0) {
-            /* parse last partial lines if any */
-            for (ssize_t i = 0; i < r; i++) {
-                char ch = drain[i];
-                if (ch == '\n' || line_pos >= (int)sizeof(line_buf) - 1) {
-                    line_buf[line_pos] = '\0';
-                    line_pos = 0;
-                    long allocs, frees, abytes, live;
-                    if (sscanf(line_buf, "%ld %ld %ld %ld",
-                               &allocs, &frees, &abytes, &live) == 4) {
-                        char abytes_str[32], live_str[32];
-                        format_bytes(abytes, abytes_str, sizeof(abytes_str));
-                        format_bytes(live,   live_str,   sizeof(live_str));
-                        printf("%-12d %12ld %12ld %14s %14s\n",
-                               ++elapsed, allocs, frees, abytes_str, live_str);
-                    }
-                } else {
-                    line_buf[line_pos++] = ch;
-                }
-            }
+        if (n > 0 && (pfd[0].revents & POLLIN)) {
+            uint64_t cnt;
+            ssize_t r = read(efd, &cnt, sizeof(cnt));
+            (void)r;
         }
+        drain(ring);
+        if (n > 0 && (pfd[1].revents & POLLIN)) break;
     }
 
-    close(fifo_rd);
-    unlink(fifo);
-
     int status = 0;
     waitpid(child_pid, &status, 0);
-    printf("\nheaptrack: '%s' exited (status %d) after %d second%s\n",
-           argv[1], WIFEXITED(status) ? WEXITSTATUS(status) : -1,
-           elapsed, elapsed == 1 ? "" : "s");
+    drain(ring);   /* final records written by the library's destructor */
+
+    uint64_t dropped = atomic_load(&ring->hdr.dropped);
+    if (dropped)
+        printf("heaptrack: %llu record%s dropped (ring full)\n",
+               (unsigned long long)dropped, dropped == 1 ? "" : "s");
+
+    if (hist) print_hist_total();
+    if (lat)  print_lat_total();
+    if (threads) print_threads_total();
+
+    printf("\nheaptrack: '%s' exited (status %d) after %.1f seconds\n",
+           cmd[0], WIFEXITED(status) ? WEXITSTATUS(status) : -1, elapsed);
+
+    if (folded)
+        printf("heaptrack: folded stacks written to %s\n", folded);
 
+    close(efd);
+    if (pidfd >= 0) close(pidfd);
+    munmap(ring, sizeof(HtRing));
     return EXIT_SUCCESS;
 }
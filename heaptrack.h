@@ -0,0 +1,289 @@
+/*
+ * heaptrack.h - shared-memory transport between heaptrack_inject.so and
+ *               the heaptrack wrapper, and the --record trace file format
+ *
+ * The wrapper creates a memfd holding one HtRing (header + data area) and an
+ * eventfd, and passes both descriptors to the target in HEAPTRACK_SHM_FD and
+ * HEAPTRACK_EVENTFD. The injected library is the single producer: it appends
+ * fixed-layout records and signals the eventfd once per batch. The wrapper is
+ * the single consumer and sleeps in poll() until signalled.
+ *
+ * Offsets are monotonic byte counts; (offset & (HT_RING_SIZE - 1)) indexes
+ * data[]. A record never wraps: if it does not fit before the end of data[],
+ * the producer fills the gap with an HT_REC_PAD record and starts at 0.
+ */
+#ifndef HEAPTRACK_H
+#define HEAPTRACK_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+#define HT_MAGIC      0x31525448u      /* "HTR1" little-endian */
+#define HT_VERSION    2
+#define HT_RING_SIZE  (1u << 20)       /* data bytes, power of two */
+#define HT_SYM_LEN    128
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ring_size;                /* HT_RING_SIZE                      */
+    uint32_t interval_ms;              /* producer's reporting interval     */
+    _Atomic uint64_t head;             /* written by the producer only      */
+    char     pad0[40];
+    _Atomic uint64_t tail;             /* written by the consumer only      */
+    _Atomic uint32_t dump_req;         /* consumer bumps to request a leak
+                                          report (HtLeakHdr + HtLeakSite)   */
+    char     pad1[52];
+    _Atomic uint64_t dropped;          /* records lost to a full ring       */
+    char     pad2[56];
+} HtRingHdr;
+
+typedef struct {
+    HtRingHdr hdr;
+    char      data[HT_RING_SIZE];
+} HtRing;
+
+/* ---- Records ------------------------------------------------------------ */
+
+enum {
+    HT_REC_PAD      = 0,               /* skip to the end of data[]         */
+    HT_REC_INTERVAL = 1,               /* HtInterval                        */
+    HT_REC_SITE     = 2,               /* HtSite                            */
+    HT_REC_HIST     = 3,               /* HtHist                            */
+    HT_REC_LEAK_HDR = 4,               /* HtLeakHdr, then its HtLeakSites   */
+    HT_REC_LEAK_SITE = 5,              /* HtLeakSite                        */
+    HT_REC_LAT      = 6,               /* HtLat                             */
+    HT_REC_THREAD   = 7,               /* HtThread, busiest first           */
+    HT_REC_XPAIR    = 8,               /* HtXPair, most first               */
+    HT_REC_MEM      = 9,               /* HtMem                             */
+};
+
+typedef struct {
+    uint32_t type;
+    uint32_t len;                      /* total bytes incl. this header,
+                                          multiple of 8                     */
+} HtRec;
+
+/* Counters are deltas over the interval unless noted */
+typedef struct {
+    uint64_t ts_ns;                    /* CLOCK_MONOTONIC at end of interval */
+    uint64_t interval_ns;
+    int64_t  allocs;
+    int64_t  frees;
+    int64_t  alloc_bytes;
+    int64_t  free_bytes;
+    int64_t  live_bytes;               /* absolute                          */
+    int64_t  threads;                  /* absolute: live counter blocks     */
+} HtInterval;
+
+enum { HT_SITE_BYTES = 0, HT_SITE_CALLS = 1 };
+
+typedef struct {
+    uint32_t kind;                     /* HT_SITE_BYTES or HT_SITE_CALLS    */
+    uint32_t rank;                     /* 0 = hottest                       */
+    int64_t  bytes;                    /* estimated, this interval          */
+    int64_t  calls;                    /* estimated, this interval          */
+    char     sym[HT_SYM_LEN];          /* leaf frame, NUL-terminated        */
+} HtSite;
+
+/* ---- Leak reports ------------------------------------------------------- */
+/* Built from byte-sampled allocations that are still live; all byte and
+   count figures are estimates scaled up from the samples. */
+
+enum { HT_DUMP_EXIT = 0, HT_DUMP_SIGNAL = 1, HT_DUMP_REQUEST = 2 };
+
+typedef struct {
+    uint32_t reason;                   /* HT_DUMP_*                         */
+    uint32_t seq;                      /* 1 for the first report            */
+    int64_t  tracked;                  /* sampled allocations held          */
+    int64_t  capacity;                 /* table limit                       */
+    int64_t  dropped;                  /* samples not held: table full      */
+    int64_t  retained;                 /* bytes, all sites                  */
+    int64_t  growth;                   /* bytes since the previous report   */
+} HtLeakHdr;
+
+enum { HT_LEAK_RETAINED = 0, HT_LEAK_GROWTH = 1 };
+
+typedef struct {
+    uint32_t kind;                     /* HT_LEAK_RETAINED or HT_LEAK_GROWTH */
+    uint32_t rank;
+    int64_t  bytes;                    /* retained now                      */
+    int64_t  count;                    /* live allocations                  */
+    int64_t  growth;                   /* bytes since the previous report   */
+    char     sym[HT_SYM_LEN];          /* "leaf < caller"                   */
+} HtLeakSite;
+
+/* ---- Histograms --------------------------------------------------------- */
+
+/* Request size classes: 16-byte linear steps up to 256 B (where pool and
+   slab allocators live), then powers of two; the last class is open. */
+#define HT_NCLASSES   40
+
+static inline int ht_size_class(uint64_t size) {
+    if (size <= 256) return size ? (int)((size - 1) >> 4) : 0;
+    int c = 16 + (64 - __builtin_clzll(size - 1)) - 9;  /* ceil(log2) >= 9 */
+    return c < HT_NCLASSES ? c : HT_NCLASSES - 1;
+}
+
+/* Largest request in class c (inclusive); 0 for the open last class */
+static inline uint64_t ht_class_max(int c) {
+    if (c < 16) return (uint64_t)(c + 1) * 16;
+    if (c < HT_NCLASSES - 1) return 1ull << (c - 16 + 9);
+    return 0;
+}
+
+/* Lifetimes (allocation to free, sampled) in log2 ns buckets per size
+   group: bucket b holds [2^b, 2^(b+1)) ns, the last bucket is open. */
+#define HT_NLIFE      40
+#define HT_NGROUPS    4                /* <=64 B, <=256 B, <=4 KB, larger   */
+
+static inline int ht_size_group(uint64_t size) {
+    return size <= 64 ? 0 : size <= 256 ? 1 : size <= 4096 ? 2 : 3;
+}
+
+static inline int ht_life_bucket(uint64_t ns) {
+    int b = ns ? 63 - __builtin_clzll(ns) : 0;
+    return b < HT_NLIFE ? b : HT_NLIFE - 1;
+}
+
+typedef struct {
+    int64_t  sizes[HT_NCLASSES];            /* requests this interval     */
+    int64_t  life[HT_NGROUPS][HT_NLIFE];    /* sampled frees this interval */
+} HtHist;
+
+/* ---- Allocator latency ------------------------------------------------- */
+/* Sampled durations of the real allocator calls, in log-linear buckets:
+   four per power of two from 16 ns (bucket 0 is everything faster), so a
+   percentile read off a bucket is within 19% of the true value. The last
+   bucket (~1 s and up) is open. */
+#define HT_NLAT       104
+
+enum { HT_LAT_ALLOC = 0, HT_LAT_FREE = 1, HT_NLATOPS = 2 };
+
+static inline int ht_lat_bucket(uint64_t ns) {
+    if (ns < 16) return 0;
+    int e = 63 - __builtin_clzll(ns);                  /* >= 4 */
+    int b = (e - 4) * 4 + (int)((ns >> (e - 2)) & 3) + 1;
+    return b < HT_NLAT ? b : HT_NLAT - 1;
+}
+
+/* Smallest duration in bucket b */
+static inline uint64_t ht_lat_min(int b) {
+    if (b <= 0) return 0;
+    int e = (b - 1) / 4 + 4;
+    return (1ull << e) + (uint64_t)((b - 1) % 4) * (1ull << (e - 2));
+}
+
+typedef struct {
+    uint32_t every;                    /* one call in ~every is timed      */
+    uint32_t slow_ns;                  /* threshold for slow[]             */
+    int64_t  max_ns[HT_NLATOPS];       /* slowest timed call this interval */
+    int64_t  hist[HT_NLATOPS][HT_NLAT];     /* timed calls this interval    */
+    int64_t  slow[HT_NLATOPS][HT_NCLASSES]; /* timed calls >= slow_ns by
+                                               size class                  */
+} HtLat;
+
+/* ---- Per-thread statistics --------------------------------------------- */
+/* One HtThread per thread that allocated or freed this interval (and one
+   final row when a thread's counter block passes to a new thread). The
+   sfrees/xfrees columns come from the same 1-in-N counting samples as the
+   lifetime histograms: xfrees are sampled blocks this thread freed that
+   another thread allocated. */
+typedef struct {
+    uint32_t tid;
+    uint32_t alive;                    /* 0 once the thread has exited      */
+    int64_t  allocs;                   /* deltas over the interval          */
+    int64_t  frees;
+    int64_t  alloc_bytes;
+    int64_t  free_bytes;
+    int64_t  sfrees;                   /* sampled frees                     */
+    int64_t  xfrees;                   /* ... of another thread's block     */
+    char     name[16];                 /* comm, NUL-terminated              */
+} HtThread;
+
+/* Sampled cross-thread frees between one pair of threads this interval;
+   count * every estimates the real number. */
+typedef struct {
+    uint32_t alloc_tid;
+    uint32_t free_tid;
+    uint32_t every;
+    uint32_t pad;
+    int64_t  count;
+} HtXPair;
+
+/* ---- Mappings ---------------------------------------------------------- */
+/* Where the heap's memory comes from. glibc's malloc maps through internal
+   aliases the shim cannot hook, so its side comes from mallinfo2(); the
+   mapping calls the target makes itself (or another allocator linked into
+   it) are hooked. Resident memory is read by the wrapper from /proc. */
+typedef struct {
+    int64_t  heap_arena;               /* malloc: brk/arena bytes (absolute) */
+    int64_t  heap_mmap;                /* malloc: mmapped chunks (absolute)  */
+    int64_t  heap_free;                /* malloc: free inside arenas         */
+    int64_t  heap_top;                 /* malloc: trimmable top of heap      */
+    int64_t  app_mapped;               /* net bytes mapped by hooked calls   */
+    int64_t  mmaps;                    /* hooked calls this interval         */
+    int64_t  munmaps;
+    int64_t  mremaps;
+    int64_t  brks;                     /* brk and sbrk                       */
+    int64_t  madvises;                 /* MADV_DONTNEED / MADV_FREE          */
+    int64_t  madv_bytes;               /* bytes those released               */
+} HtMem;
+
+#define HT_REC_LEN(payload) \
+    ((uint32_t)((sizeof(HtRec) + (payload) + 7) & ~(size_t)7))
+
+/* ---- Trace file (heaptrack --record) ------------------------------------ */
+/*
+ * An HtTraceHdr followed by blocks. Each thread buffers its events and
+ * appends them as one HT_TBLK_EVENTS block, so blocks from different
+ * threads interleave and overlap in time; within a thread they are in
+ * order. Readers merge threads by timestamp.
+ *
+ * Events are varint-encoded and delta-coded against the previous event in
+ * the same block (the block header holds the bases):
+ *
+ *   varint  (dticks << 2) | kind        kind: HT_EV_*
+ *   varint  zigzag(ptr - prev_ptr)
+ *   varint  size                        HT_EV_ALLOC, HT_EV_ALLOC_STACK
+ *   varint  stack id                    HT_EV_ALLOC_STACK
+ *
+ * A realloc is a free of the old block followed by an allocation. Stack
+ * ids refer to the HT_TBLK_STACKS block written at exit, whose frames are
+ * named by the HT_TBLK_SYMS block after it.
+ */
+#define HT_TRACE_MAGIC    0x43525448u  /* "HTRC" little-endian */
+#define HT_TRACE_VERSION  1
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t start_ticks;
+    double   ns_per_tick;              /* ticks -> ns                       */
+    uint64_t sample_mean;              /* byte-sampling mean, 0 = no stacks */
+    uint32_t pid;
+    uint32_t reserved;
+} HtTraceHdr;
+
+enum {
+    HT_TBLK_EVENTS = 1,
+    HT_TBLK_STACKS = 2,                /* { u32 id, u32 depth, u64 pc[] }*   */
+    HT_TBLK_SYMS   = 3,                /* { u64 pc, u16 len, char name[] }*  */
+};
+
+typedef struct {
+    uint32_t type;                     /* HT_TBLK_*                         */
+    uint32_t len;                      /* payload bytes after this header   */
+    uint32_t tid;
+    uint32_t nevents;
+    uint64_t t0;                       /* ticks base for the first event    */
+    uint64_t p0;                       /* pointer base for the first event  */
+} HtTraceBlock;
+
+enum {
+    HT_EV_ALLOC       = 0,
+    HT_EV_FREE        = 1,
+    HT_EV_ALLOC_STACK = 2,
+};
+
+#endif /* HEAPTRACK_H */
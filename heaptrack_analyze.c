@@ -0,0 +1,672 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "heaptrack.h"
+
+/*
+ * heaptrack_analyze - offline analysis of a heaptrack --record trace
+ *
+ * Replays every malloc/free in the trace in timestamp order (threads are
+ * merged) and prints:
+ *   - a timeline of allocation rate and live heap per time bucket
+ *   - exact request size classes and lifetimes by size group
+ *   - the top call sites by bytes, by calls and by bytes still live at the
+ *     end of the trace (needs -s at record time; estimates from samples)
+ *
+ * Usage: heaptrack_analyze [-n N] [-b ms] <file>
+ *
+ *   -n N   top N sites in each table (default: 10)
+ *   -b ms  timeline bucket width (default: ~20 buckets over the trace)
+ *
+ * Traces from forked children are written next to the parent's as
+ * <file>.<pid>; analyze each separately.
+ */
+
+/* ---- Formatting --------------------------------------------------------- */
+static void format_bytes(long b, char *out, size_t len) {
+    if      (b >= 1073741824L) snprintf(out, len, "%.2f GB", b / 1073741824.0);
+    else if (b >= 1048576L)    snprintf(out, len, "%.2f MB", b / 1048576.0);
+    else if (b >= 1024L)       snprintf(out, len, "%.2f KB", b / 1024.0);
+    else                       snprintf(out, len, "%ld B",   b);
+}
+
+static void format_ns(double ns, char *out, size_t len) {
+    if      (ns >= 1e9) snprintf(out, len, "%.3g s",  ns / 1e9);
+    else if (ns >= 1e6) snprintf(out, len, "%.3g ms", ns / 1e6);
+    else if (ns >= 1e3) snprintf(out, len, "%.3g us", ns / 1e3);
+    else                snprintf(out, len, "%.0f ns", ns);
+}
+
+static void format_class(int c, char *out, size_t len) {
+    uint64_t max = ht_class_max(c);
+    if (!max) {
+        snprintf(out, len, "larger");
+        return;
+    }
+    char b[24];
+    format_bytes((long)max, b, sizeof(b));
+    snprintf(out, len, "<= %s", b);
+}
+
+/* ---- Trace file --------------------------------------------------------- */
+static const unsigned char *base;
+static size_t               file_len;
+static HtTraceHdr           hdr;
+
+/* Event streams: one per thread id, each a list of block offsets in file
+   order, which is the thread's own time order. */
+typedef struct {
+    uint32_t tid;
+    size_t  *blocks;
+    size_t   nblocks, cap;
+    /* replay cursor */
+    size_t   bi;
+    const unsigned char *p, *end;
+    uint32_t left;
+    uint64_t t, ptr;
+    /* decoded next event */
+    unsigned kind;
+    uint64_t size;
+    uint32_t stack;
+} Stream;
+
+static Stream *streams;
+static size_t  nstreams, streams_cap;
+
+static Stream *stream_for(uint32_t tid) {
+    for (size_t i = 0; i < nstreams; i++)
+        if (streams[i].tid == tid) return &streams[i];
+    if (nstreams == streams_cap) {
+        streams_cap = streams_cap ? streams_cap * 2 : 16;
+        streams = realloc(streams, streams_cap * sizeof(*streams));
+        if (!streams) { perror("realloc"); exit(EXIT_FAILURE); }
+    }
+    Stream *s = &streams[nstreams++];
+    memset(s, 0, sizeof(*s));
+    s->tid = tid;
+    return s;
+}
+
+/* Sampled stacks: id -> frames in the file */
+typedef struct {
+    uint32_t depth;
+    const unsigned char *pcs;
+    int64_t  bytes, calls;             /* estimated over the trace        */
+    int64_t  live_bytes, live_calls;   /* estimated, still live at end    */
+} Site;
+
+static Site  *sites;
+static size_t nsites;
+
+/* Frame names: open-addressed pc -> name */
+typedef struct {
+    uint64_t pc;
+    const char *name;
+    uint16_t len;
+} Sym;
+
+#define SYM_SLOTS (1u << 16)
+static Sym syms[SYM_SLOTS];
+
+static inline uint64_t mix64(uint64_t x) {
+    x ^= x >> 33; x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33; x *= 0xc4ceb9fe1a85ec53ull;
+    return x ^ (x >> 33);
+}
+
+static void sym_add(uint64_t pc, const char *name, uint16_t len) {
+    unsigned k = (unsigned)mix64(pc) & (SYM_SLOTS - 1);
+    for (unsigned n = 0; n < SYM_SLOTS; n++, k = (k + 1) & (SYM_SLOTS - 1)) {
+        if (syms[k].pc == pc || !syms[k].pc) {
+            syms[k] = (Sym){ pc, name, len };
+            return;
+        }
+    }
+}
+
+static const Sym *sym_find(uint64_t pc) {
+    unsigned k = (unsigned)mix64(pc) & (SYM_SLOTS - 1);
+    for (unsigned n = 0; n < SYM_SLOTS; n++, k = (k + 1) & (SYM_SLOTS - 1)) {
+        if (syms[k].pc == pc) return &syms[k];
+        if (!syms[k].pc) return NULL;
+    }
+    return NULL;
+}
+
+static void frame_name(const Site *s, uint32_t d, char *out, size_t len) {
+    uint64_t pc;
+    memcpy(&pc, s->pcs + (size_t)d * 8, 8);
+    const Sym *y = sym_find(pc);
+    if (y) snprintf(out, len, "%.*s", (int)y->len, y->name);
+    else   snprintf(out, len, "0x%llx", (unsigned long long)pc);
+}
+
+/* "leaf < caller", as in heaptrack's leak report */
+static void site_name(const Site *s, char *out, size_t len) {
+    char leaf[HT_SYM_LEN], caller[HT_SYM_LEN];
+    if (!s->depth) { snprintf(out, len, "?"); return; }
+    frame_name(s, 0, leaf, sizeof(leaf));
+    if (s->depth < 2) { snprintf(out, len, "%s", leaf); return; }
+    frame_name(s, 1, caller, sizeof(caller));
+    snprintf(out, len, "%s < %s", leaf, caller);
+}
+
+static void load_stacks(const unsigned char *p, const unsigned char *end) {
+    while (end - p >= 8) {
+        uint32_t id, depth;
+        memcpy(&id, p, 4);
+        memcpy(&depth, p + 4, 4);
+        if (depth > 256 || (size_t)(end - p - 8) < (size_t)depth * 8) return;
+        if (id && id < (1u << 24)) {
+            if (id >= nsites) {
+                size_t n = nsites ? nsites : 256;
+                while (n <= id) n *= 2;
+                sites = realloc(sites, n * sizeof(*sites));
+                if (!sites) { perror("realloc"); exit(EXIT_FAILURE); }
+                memset(sites + nsites, 0, (n - nsites) * sizeof(*sites));
+                nsites = n;
+            }
+            sites[id].depth = depth;
+            sites[id].pcs   = p + 8;
+        }
+        p += 8 + (size_t)depth * 8;
+    }
+}
+
+static void load_syms(const unsigned char *p, const unsigned char *end) {
+    while (end - p >= 10) {
+        uint64_t pc;
+        uint16_t len;
+        memcpy(&pc, p, 8);
+        memcpy(&len, p + 8, 2);
+        if ((size_t)(end - p - 10) < len) return;
+        if (pc) sym_add(pc, (const char *)p + 10, len);
+        p += 10 + len;
+    }
+}
+
+/* Pass 1: index event blocks per thread and load stacks and names */
+static int scan(void) {
+    if (file_len < sizeof(hdr)) return -1;
+    memcpy(&hdr, base, sizeof(hdr));
+    if (hdr.magic != HT_TRACE_MAGIC || hdr.version != HT_TRACE_VERSION)
+        return -1;
+    if (!(hdr.ns_per_tick > 0)) hdr.ns_per_tick = 1.0;
+
+    size_t off = sizeof(hdr);
+    while (file_len - off >= sizeof(HtTraceBlock)) {
+        HtTraceBlock b;
+        memcpy(&b, base + off, sizeof(b));
+        size_t data = off + sizeof(b);
+        if (b.len > file_len - data) {
+            fprintf(stderr, "heaptrack_analyze: truncated block at offset %zu\n", off);
+            break;
+        }
+        if (b.type == HT_TBLK_EVENTS) {
+            Stream *s = stream_for(b.tid);
+            if (s->nblocks == s->cap) {
+                s->cap = s->cap ? s->cap * 2 : 16;
+                s->blocks = realloc(s->blocks, s->cap * sizeof(size_t));
+                if (!s->blocks) { perror("realloc"); exit(EXIT_FAILURE); }
+            }
+            s->blocks[s->nblocks++] = off;
+        } else if (b.type == HT_TBLK_STACKS) {
+            load_stacks(base + data, base + data + b.len);
+        } else if (b.type == HT_TBLK_SYMS) {
+            load_syms(base + data, base + data + b.len);
+        }
+        off = data + b.len;
+    }
+    return 0;
+}
+
+/* ---- Event decoding ----------------------------------------------------- */
+static int get_varint(Stream *s, uint64_t *v) {
+    uint64_t x = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (s->p >= s->end) return -1;
+        unsigned char c = *s->p++;
+        x |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80)) { *v = x; return 0; }
+    }
+    return -1;
+}
+
+/* Decode the stream's next event into its cursor; 0 when exhausted */
+static int stream_next(Stream *s) {
+    for (;;) {
+        while (!s->left) {
+            if (s->bi == s->nblocks) return 0;
+            HtTraceBlock b;
+            size_t off = s->blocks[s->bi++];
+            memcpy(&b, base + off, sizeof(b));
+            s->p    = base + off + sizeof(b);
+            s->end  = s->p + b.len;
+            s->left = b.nevents;
+            s->t    = b.t0;
+            s->ptr  = b.p0;
+        }
+        uint64_t tk, dp;
+        if (get_varint(s, &tk) < 0 || get_varint(s, &dp) < 0) goto bad;
+        s->kind = (unsigned)(tk & 3);
+        s->t   += tk >> 2;
+        s->ptr += (dp >> 1) ^ (0 - (dp & 1));
+        s->size = 0;
+        s->stack = 0;
+        if (s->kind != HT_EV_FREE && get_varint(s, &s->size) < 0) goto bad;
+        if (s->kind == HT_EV_ALLOC_STACK) {
+            uint64_t id;
+            if (get_varint(s, &id) < 0) goto bad;
+            s->stack = (uint32_t)id;
+        }
+        s->left--;
+        return 1;
+bad:
+        fprintf(stderr, "heaptrack_analyze: corrupt events in thread %u, skipping block\n",
+                s->tid);
+        s->left = 0;
+    }
+}
+
+/* ---- Live pointer map --------------------------------------------------- */
+typedef struct {
+    uint64_t ptr;                      /* 0 = empty */
+    uint64_t t;
+    uint64_t size;
+    uint32_t stack;
+} Live;
+
+static Live  *live;
+static size_t live_mask, live_n;
+
+static void live_grow(void);
+
+static void live_put(uint64_t ptr, uint64_t t, uint64_t size, uint32_t stack) {
+    if (!ptr) return;
+    if ((live_n + 1) * 4 > (live_mask + 1) * 3) live_grow();
+    size_t i = mix64(ptr) & live_mask;
+    while (live[i].ptr && live[i].ptr != ptr) i = (i + 1) & live_mask;
+    if (!live[i].ptr) live_n++;
+    live[i] = (Live){ ptr, t, size, stack };
+}
+
+static void live_grow(void) {
+    Live  *old = live;
+    size_t n   = old ? live_mask + 1 : 0;
+    live_mask  = old ? n * 2 - 1 : (1u << 16) - 1;
+    live       = calloc(live_mask + 1, sizeof(Live));
+    if (!live) { perror("calloc"); exit(EXIT_FAILURE); }
+    live_n = 0;
+    for (size_t i = 0; i < n; i++)
+        if (old[i].ptr) live_put(old[i].ptr, old[i].t, old[i].size, old[i].stack);
+    free(old);
+}
+
+/* Remove ptr; returns 0 and fills *out if it was live */
+static int live_take(uint64_t ptr, Live *out) {
+    if (!live || !ptr) return -1;
+    size_t i = mix64(ptr) & live_mask;
+    while (live[i].ptr != ptr) {
+        if (!live[i].ptr) return -1;
+        i = (i + 1) & live_mask;
+    }
+    *out = live[i];
+    live_n--;
+    /* backward-shift deletion keeps probe chains intact */
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & live_mask;
+        if (!live[j].ptr) break;
+        size_t home = mix64(live[j].ptr) & live_mask;
+        if (((j - home) & live_mask) >= ((j - i) & live_mask)) {
+            live[i] = live[j];
+            i = j;
+        }
+    }
+    live[i].ptr = 0;
+    return 0;
+}
+
+/* ---- Replay ------------------------------------------------------------- */
+typedef struct {
+    int64_t allocs, frees, bytes;
+    int64_t live;                      /* at the end of the bucket */
+} Bucket;
+
+static Bucket  *buckets;
+static size_t   nbuckets;
+static uint64_t bucket_ticks;
+
+static int64_t  n_allocs, n_frees, n_unmatched, alloc_bytes, free_bytes;
+static int64_t  live_bytes, peak_bytes;
+static uint64_t peak_t, first_t, last_t;
+static int64_t  sizes[HT_NCLASSES], size_bytes[HT_NCLASSES];
+static int64_t  life[HT_NGROUPS][HT_NLIFE];
+
+/* Same estimator as the sampler in heaptrack_inject.c */
+static int64_t sample_weight(uint64_t size) {
+    if (!hdr.sample_mean) return (int64_t)size;
+    double w = 1.0 - exp(-(double)size / (double)hdr.sample_mean);
+    return w > 0 ? (int64_t)((double)size / w) : (int64_t)size;
+}
+
+static Site *site_get(uint32_t id) {
+    return id && id < nsites && sites[id].pcs ? &sites[id] : NULL;
+}
+
+static void bucket_at(uint64_t t, Bucket **b) {
+    size_t i = (size_t)((t - first_t) / bucket_ticks);
+    if (i >= nbuckets) {
+        size_t n = nbuckets ? nbuckets : 32;
+        while (n <= i) n *= 2;
+        buckets = realloc(buckets, n * sizeof(*buckets));
+        if (!buckets) { perror("realloc"); exit(EXIT_FAILURE); }
+        memset(buckets + nbuckets, 0, (n - nbuckets) * sizeof(*buckets));
+        nbuckets = n;
+    }
+    *b = &buckets[i];
+}
+
+static void apply(const Stream *s) {
+    Bucket *b;
+    Live old;
+    bucket_at(s->t, &b);
+
+    if (s->kind == HT_EV_FREE) {
+        if (live_take(s->ptr, &old) < 0) {
+            n_unmatched++;             /* allocated before recording began */
+            return;
+        }
+        n_frees++;
+        b->frees++;
+        free_bytes += (int64_t)old.size;
+        live_bytes -= (int64_t)old.size;
+        uint64_t ns = (uint64_t)((double)(s->t - old.t) * hdr.ns_per_tick);
+        life[ht_size_group(old.size)][ht_life_bucket(ns)]++;
+        Site *site = site_get(old.stack);
+        if (site) {
+            int64_t w = sample_weight(old.size);
+            site->live_bytes -= w;
+            site->live_calls -= old.size ? w / (int64_t)old.size : 1;
+        }
+        return;
+    }
+
+    if (live_take(s->ptr, &old) == 0) {
+        /* missed free (e.g. freed inside the bootstrap path) */
+        live_bytes -= (int64_t)old.size;
+        Site *site = site_get(old.stack);
+        if (site) {
+            int64_t w = sample_weight(old.size);
+            site->live_bytes -= w;
+            site->live_calls -= old.size ? w / (int64_t)old.size : 1;
+        }
+    }
+    n_allocs++;
+    b->allocs++;
+    b->bytes += (int64_t)s->size;
+    alloc_bytes += (int64_t)s->size;
+    live_bytes  += (int64_t)s->size;
+    if (live_bytes > peak_bytes) {
+        peak_bytes = live_bytes;
+        peak_t     = s->t;
+    }
+    int c = ht_size_class(s->size);
+    sizes[c]++;
+    size_bytes[c] += (int64_t)s->size;
+
+    Site *site = site_get(s->stack);
+    live_put(s->ptr, s->t, s->size, site ? s->stack : 0);
+    if (site) {
+        int64_t w = sample_weight(s->size);
+        int64_t n = s->size ? w / (int64_t)s->size : 1;
+        site->bytes      += w;
+        site->calls      += n;
+        site->live_bytes += w;
+        site->live_calls += n;
+    }
+}
+
+/* Min-heap of streams keyed by the timestamp of their next event */
+static Stream **heap;
+static size_t   heap_n;
+
+static void heap_sift(size_t i) {
+    for (;;) {
+        size_t l = 2 * i + 1, r = l + 1, m = i;
+        if (l < heap_n && heap[l]->t < heap[m]->t) m = l;
+        if (r < heap_n && heap[r]->t < heap[m]->t) m = r;
+        if (m == i) return;
+        Stream *tmp = heap[i]; heap[i] = heap[m]; heap[m] = tmp;
+        i = m;
+    }
+}
+
+/* Pass 2: k-way merge of the per-thread streams */
+static void replay(uint64_t bucket_ns) {
+    heap = malloc((nstreams ? nstreams : 1) * sizeof(*heap));
+    if (!heap) { perror("malloc"); exit(EXIT_FAILURE); }
+    for (size_t i = 0; i < nstreams; i++)
+        if (stream_next(&streams[i])) heap[heap_n++] = &streams[i];
+    if (!heap_n) return;
+
+    first_t = heap[0]->t;
+    for (size_t i = 1; i < heap_n; i++)
+        if (heap[i]->t < first_t) first_t = heap[i]->t;
+    for (size_t i = heap_n; i-- > 0; ) heap_sift(i);
+
+    /* Default bucket: ~20 over the trace, from the latest block start */
+    if (!bucket_ns) {
+        uint64_t end = first_t;
+        for (size_t i = 0; i < nstreams; i++) {
+            Stream *s = &streams[i];
+            if (!s->nblocks) continue;
+            HtTraceBlock b;
+            memcpy(&b, base + s->blocks[s->nblocks - 1], sizeof(b));
+            if (b.t0 > end) end = b.t0;
+        }
+        bucket_ns = (uint64_t)((double)(end - first_t) * hdr.ns_per_tick / 19);
+        if (bucket_ns < 1000000) bucket_ns = 1000000;
+    }
+    bucket_ticks = (uint64_t)((double)bucket_ns / hdr.ns_per_tick);
+    if (!bucket_ticks) bucket_ticks = 1;
+
+    while (heap_n) {
+        Stream *s = heap[0];
+        if (s->t < first_t) s->t = first_t;   /* unsynchronised TSCs */
+        apply(s);
+        last_t = s->t;
+        Bucket *b;
+        bucket_at(s->t, &b);
+        b->live = live_bytes;
+        if (!stream_next(s)) heap[0] = heap[--heap_n];
+        heap_sift(0);
+    }
+}
+
+/* ---- Reports ------------------------------------------------------------ */
+static void print_summary(void) {
+    char a[32], f[32], pk[32], lv[32], t[32], d[32];
+    double ns = (double)(last_t - first_t) * hdr.ns_per_tick;
+    format_bytes((long)alloc_bytes, a, sizeof(a));
+    format_bytes((long)free_bytes, f, sizeof(f));
+    format_bytes((long)peak_bytes, pk, sizeof(pk));
+    format_bytes((long)live_bytes, lv, sizeof(lv));
+    format_ns((double)(peak_t - first_t) * hdr.ns_per_tick, t, sizeof(t));
+    format_ns(ns, d, sizeof(d));
+
+    printf("Trace of pid %u: %s, %zu thread%s\n",
+           hdr.pid, d, nstreams, nstreams == 1 ? "" : "s");
+    printf("  allocs %lld (%s)  frees %lld (%s)\n",
+           (long long)n_allocs, a, (long long)n_frees, f);
+    printf("  peak live %s at +%s  live at end %s (%zu blocks)\n",
+           pk, t, lv, live_n);
+    if (n_unmatched)
+        printf("  %lld frees of blocks allocated before recording began\n",
+               (long long)n_unmatched);
+}
+
+static void print_timeline(void) {
+    size_t used = (size_t)((last_t - first_t) / bucket_ticks) + 1;
+    if (used > nbuckets) used = nbuckets;
+    char w[32];
+    format_ns((double)bucket_ticks * hdr.ns_per_tick, w, sizeof(w));
+
+    printf("\nTimeline (%s buckets)\n", w);
+    printf("%-10s %12s %12s %12s %12s\n", "time", "allocs", "frees", "alloc'd", "live");
+    int64_t live_now = 0;
+    for (size_t i = 0; i < used; i++) {
+        Bucket *b = &buckets[i];
+        if (b->allocs || b->frees) live_now = b->live;
+        char t[32], by[32], lv[32];
+        format_ns((double)(i * bucket_ticks) * hdr.ns_per_tick, t, sizeof(t));
+        format_bytes((long)b->bytes, by, sizeof(by));
+        format_bytes((long)live_now, lv, sizeof(lv));
+        printf("+%-9s %12lld %12lld %12s %12s\n", t,
+               (long long)b->allocs, (long long)b->frees, by, lv);
+    }
+}
+
+static void print_hist(void) {
+    if (!n_allocs) return;
+    int64_t cum = 0;
+    printf("\nRequest size classes\n");
+    printf("%-12s %14s %8s %8s %12s\n", "class", "requests", "%", "cum%", "bytes");
+    for (int c = 0; c < HT_NCLASSES; c++) {
+        if (!sizes[c]) continue;
+        cum += sizes[c];
+        char label[32], by[32];
+        format_class(c, label, sizeof(label));
+        format_bytes((long)size_bytes[c], by, sizeof(by));
+        printf("%-12s %14lld %7.1f%% %7.1f%% %12s\n", label, (long long)sizes[c],
+               sizes[c] * 100.0 / n_allocs, cum * 100.0 / n_allocs, by);
+    }
+
+    if (!n_frees) return;
+    printf("\nLifetimes (%lld frees)\n", (long long)n_frees);
+    printf("%-12s %10s %10s %10s %10s\n",
+           "lifetime <", "<=64 B", "<=256 B", "<=4 KB", "larger");
+    for (int b = 0; b < HT_NLIFE; b++) {
+        int64_t row = 0;
+        for (int g = 0; g < HT_NGROUPS; g++) row += life[g][b];
+        if (!row) continue;
+        char label[32];
+        if (b == HT_NLIFE - 1) snprintf(label, sizeof(label), "longer");
+        else format_ns((double)(1ull << (b + 1)), label, sizeof(label));
+        printf("%-12s", label);
+        for (int g = 0; g < HT_NGROUPS; g++)
+            printf(" %9.1f%%", life[g][b] * 100.0 / n_frees);
+        printf("\n");
+    }
+}
+
+enum { BY_BYTES, BY_CALLS, BY_LIVE };
+
+static int64_t site_key(const Site *s, int by) {
+    return by == BY_BYTES ? s->bytes : by == BY_CALLS ? s->calls : s->live_bytes;
+}
+
+static void print_sites(int by, int topn) {
+    static const char *title[] = {
+        "Top sites by bytes allocated",
+        "Top sites by calls",
+        "Top sites by bytes live at end",
+    };
+    uint32_t *top = calloc((size_t)topn, sizeof(uint32_t));
+    if (!top) return;
+    int n = 0;
+    for (uint32_t id = 1; id < nsites; id++) {
+        Site *s = &sites[id];
+        int64_t k = site_key(s, by);
+        if (!s->pcs || k <= 0) continue;
+        if (n < topn) n++;
+        else if (k <= site_key(&sites[top[n - 1]], by)) continue;
+        int j = n - 1;
+        while (j > 0 && site_key(&sites[top[j - 1]], by) < k) {
+            top[j] = top[j - 1];
+            j--;
+        }
+        top[j] = id;
+    }
+    if (n) {
+        printf("\n%s (estimated from samples)\n", title[by]);
+        printf("  %12s %12s  %s\n", by == BY_LIVE ? "live" : "bytes", "calls", "site");
+    }
+    for (int i = 0; i < n; i++) {
+        Site *s = &sites[top[i]];
+        char by_s[32], name[2 * HT_SYM_LEN + 4];
+        format_bytes((long)(by == BY_LIVE ? s->live_bytes : s->bytes), by_s, sizeof(by_s));
+        site_name(s, name, sizeof(name));
+        printf("  %12s %12lld  %s\n", by_s,
+               (long long)(by == BY_LIVE ? s->live_calls : s->calls), name);
+    }
+    free(top);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n N] [-b ms] <file>\n", prog);
+    fprintf(stderr, "  -n N   top N sites per table (default: 10)\n");
+    fprintf(stderr, "  -b ms  timeline bucket width (default: ~20 buckets)\n");
+    fprintf(stderr, "  Record a trace with: heaptrack --record file [-s bytes] <command>\n");
+}
+
+int main(int argc, char *argv[]) {
+    int topn = 10;
+    long bucket_ms = 0;
+    const char *path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            topn = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            bucket_ms = atol(argv[++i]);
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (!path) {
+        usage(argv[0]); return EXIT_FAILURE;
+    }
+    if (topn < 1) topn = 1;
+    if (bucket_ms < 0) bucket_ms = 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { perror(path); return EXIT_FAILURE; }
+    struct stat st;
+    if (fstat(fd, &st) < 0) { perror("fstat"); return EXIT_FAILURE; }
+    file_len = (size_t)st.st_size;
+    if (file_len) {
+        void *m = mmap(NULL, file_len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED) { perror("mmap"); return EXIT_FAILURE; }
+        base = m;
+    }
+    close(fd);
+
+    if (scan() < 0) {
+        fprintf(stderr, "%s: not a heaptrack trace (version %d)\n", path, HT_TRACE_VERSION);
+        return EXIT_FAILURE;
+    }
+    replay((uint64_t)bucket_ms * 1000000);
+
+    print_summary();
+    if (!n_allocs && !n_frees) return EXIT_SUCCESS;
+    print_timeline();
+    print_hist();
+    if (!hdr.sample_mean) {
+        printf("\nNo call sites: record with -s to sample stacks.\n");
+        return EXIT_SUCCESS;
+    }
+    print_sites(BY_BYTES, topn);
+    print_sites(BY_CALLS, topn);
+    print_sites(BY_LIVE,  topn);
+    return EXIT_SUCCESS;
+}
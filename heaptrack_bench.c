@@ -0,0 +1,167 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
+
+/*
+ * heaptrack_bench - malloc/free throughput across thread counts
+ *
+ * Each thread keeps a small window of live blocks and replaces one per
+ * iteration (free + malloc), so the allocator sees a steady mix of both
+ * calls. Run it bare and under heaptrack to see the shim's per-call cost
+ * and how it scales with threads:
+ *
+ *   ./heaptrack_bench -t 8
+ *   ./heaptrack ./heaptrack_bench -t 8
+ *
+ * Use a large -w with a small -s to compare per-block memory overhead
+ * (max RSS) between shim versions.
+ *
+ * With -x, threads run as producer/consumer pairs instead: the producer
+ * allocates and hands each block to its consumer over a ring, and the
+ * consumer frees it (what heaptrack -T reports as cross-thread frees).
+ *
+ * Usage: heaptrack_bench [-t max_threads] [-n ops] [-s size] [-w window] [-x]
+ */
+
+static long   ops_per_thread = 2000000;
+static size_t max_size       = 256;
+static long   window         = 64;
+static int    cross          = 0;
+
+/* Single-producer, single-consumer ring for -x */
+#define XRING 1024
+
+typedef struct {
+    _Atomic unsigned long head, tail;
+    void *slot[XRING];
+} XRing;
+
+static XRing *xrings;
+
+static void *worker(void *arg) {
+    unsigned int seed = (unsigned int)(long)arg * 2654435761u + 1;
+    void **live = calloc(window, sizeof(void *));
+    if (!live) return NULL;
+
+    for (long i = 0; i < ops_per_thread; i++) {
+        long slot = i % window;
+        free(live[slot]);
+        seed = seed * 1103515245u + 12345u;
+        size_t size = 1 + (seed >> 8) % max_size;
+        live[slot] = malloc(size);
+        if (live[slot]) *(volatile char *)live[slot] = 0;
+    }
+    for (long i = 0; i < window; i++) free(live[i]);
+    free(live);
+    return NULL;
+}
+
+static void *producer(void *arg) {
+    XRing *q = &xrings[(long)arg / 2];
+    unsigned int seed = (unsigned int)(long)arg * 2654435761u + 1;
+
+    for (long i = 0; i < ops_per_thread; i++) {
+        unsigned long h = atomic_load_explicit(&q->head, memory_order_relaxed);
+        while (h - atomic_load_explicit(&q->tail, memory_order_acquire) == XRING)
+            sched_yield();
+        seed = seed * 1103515245u + 12345u;
+        void *p = malloc(1 + (seed >> 8) % max_size);
+        if (p) *(volatile char *)p = 0;
+        q->slot[h % XRING] = p;
+        atomic_store_explicit(&q->head, h + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+static void *consumer(void *arg) {
+    XRing *q = &xrings[(long)arg / 2];
+
+    for (long i = 0; i < ops_per_thread; i++) {
+        unsigned long t = atomic_load_explicit(&q->tail, memory_order_relaxed);
+        while (atomic_load_explicit(&q->head, memory_order_acquire) == t)
+            sched_yield();
+        free(q->slot[t % XRING]);
+        atomic_store_explicit(&q->tail, t + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+static double run(int nthreads) {
+    pthread_t tids[nthreads];
+    struct timespec t0, t1;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (cross) memset(xrings, 0, sizeof(XRing) * (size_t)(nthreads / 2));
+    for (int i = 0; i < nthreads; i++) {
+        void *(*fn)(void *) = worker;
+        if (cross && i + 1 - i % 2 < nthreads) fn = i % 2 ? consumer : producer;
+        pthread_create(&tids[i], NULL, fn, (void *)(long)i);
+    }
+    for (int i = 0; i < nthreads; i++)
+        pthread_join(tids[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-t max_threads] [-n ops] [-s size] [-w window] [-x]\n", prog);
+    fprintf(stderr, "  -t N     scale 1,2,4.. up to N threads (default: 8)\n");
+    fprintf(stderr, "  -n ops   malloc+free pairs per thread (default: 2000000)\n");
+    fprintf(stderr, "  -s size  max request size in bytes (default: 256)\n");
+    fprintf(stderr, "  -w N     live blocks kept per thread (default: 64)\n");
+    fprintf(stderr, "  -x       producer/consumer pairs: one thread allocates, the other frees\n");
+}
+
+int main(int argc, char *argv[]) {
+    int max_threads = 8;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            max_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            ops_per_thread = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            max_size = (size_t)atol(argv[++i]);
+        } else if (strcmp(argv[i], "-w") == 0 && i + 1 < argc) {
+            window = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-x") == 0) {
+            cross = 1;
+        } else {
+            usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (max_threads < 1)    max_threads = 1;
+    if (ops_per_thread < 1) ops_per_thread = 1;
+    if (max_size < 1)       max_size = 1;
+    if (window < 1)         window = 1;
+    if (cross && !(xrings = calloc((size_t)max_threads / 2 + 1, sizeof(XRing)))) {
+        perror("calloc"); return EXIT_FAILURE;
+    }
+
+    printf("%-8s %12s %14s %14s\n",
+           "threads", "wall (s)", "ns/op/thread", "Mops/s total");
+    printf("%-8s %12s %14s %14s\n",
+           "--------", "------------", "--------------", "--------------");
+
+    for (int t = 1; t <= max_threads; t = t < max_threads && t * 2 > max_threads
+                                          ? max_threads : t * 2) {
+        double secs = run(t);
+        double ops  = (double)ops_per_thread * t;
+        printf("%-8d %12.3f %14.1f %14.2f\n",
+               t, secs, secs * 1e9 / ops_per_thread, ops / secs / 1e6);
+        fflush(stdout);
+    }
+
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    printf("\nmax RSS: %ld KB\n", ru.ru_maxrss);
+
+    return EXIT_SUCCESS;
+}
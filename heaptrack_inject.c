@@ -2,19 +2,38 @@
  * heaptrack_inject.c - LD_PRELOAD library for malloc tracking
  *
  * Compile as a shared library:
- *   gcc -O2 -shared -fPIC -o heaptrack_inject.so heaptrack_inject.c -ldl -lpthread
+ *   gcc -O2 -shared -fPIC -o heaptrack_inject.so heaptrack_inject.c -ldl -lpthread -lm
  *
- * Do not use directly; the 'heaptrack' wrapper sets LD_PRELOAD and HEAPTRACK_FIFO.
+ * Do not use directly; the 'heaptrack' wrapper sets LD_PRELOAD and hands
+ * over a shared-memory ring (see heaptrack.h) in HEAPTRACK_SHM_FD.
  */
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <malloc.h>
 #include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdarg.h>
 #include <stdatomic.h>
+#include <math.h>
 #include <dlfcn.h>
+#include <link.h>
+#include <execinfo.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "heaptrack.h"
 
 /* ---- Bootstrap buffer --------------------------------------------------- */
 /* dlsym() calls calloc internally. We serve those early allocations from a
@@ -29,54 +48,1321 @@ static void *(*real_malloc) (size_t)           = NULL;
 static void *(*real_calloc) (size_t, size_t)   = NULL;
 static void *(*real_realloc)(void *, size_t)   = NULL;
 static void  (*real_free)   (void *)           = NULL;
+static int   (*real_posix_memalign)(void **, size_t, size_t) = NULL;
+static void *(*real_aligned_alloc) (size_t, size_t)          = NULL;
+static void *(*real_memalign)      (size_t, size_t)          = NULL;
+static void *(*real_valloc)        (size_t)                  = NULL;
+static void *(*real_pvalloc)       (size_t)                  = NULL;
+static size_t (*real_usable_size)  (void *)                  = NULL;
+static void *(*real_mmap)  (void *, size_t, int, int, int, off_t) = NULL;
+static int   (*real_munmap)(void *, size_t)                      = NULL;
+static void *(*real_mremap)(void *, size_t, size_t, int, ...)    = NULL;
+static int   (*real_madvise)(void *, size_t, int)                = NULL;
+static int   (*real_brk)   (void *)                              = NULL;
+static void *(*real_sbrk)  (intptr_t)                            = NULL;
+
+/* The shim's own memory bypasses the mmap hooks below, so it is never
+   counted as the target's. */
+static void *shim_map(size_t len) {
+    return (void *)syscall(SYS_mmap, NULL, len, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+}
+
+static void shim_unmap(void *p, size_t len) {
+    syscall(SYS_munmap, p, len);
+}
+
+/* ---- Per-thread counter blocks ----------------------------------------- */
+/* Each thread owns one cache-line-aligned block of monotonic counters that
+   only it writes, so the hot path is a few plain loads and stores with no
+   shared cache line. The reporter sums every block once per interval and
+   diffs against the previous sum.
+
+   Blocks live on a lock-free, push-only list. A thread that exits marks its
+   block free (via a pthread key destructor) and the next new thread claims
+   it with a CAS, so the list is bounded by the peak thread count and the
+   exited thread's totals stay in the sums. */
+
+/* The counters the per-thread report (-T) diffs */
+typedef struct {
+    long allocs, frees, alloc_bytes, free_bytes, sfrees, xfrees;
+} ThreadSnap;
+
+typedef struct ThreadStats {
+    atomic_long allocs;       /* allocation calls                    */
+    atomic_long frees;        /* free calls                          */
+    atomic_long alloc_bytes;  /* bytes handed out                    */
+    atomic_long free_bytes;   /* bytes returned                      */
+    atomic_long size_hist[HT_NCLASSES];           /* requests by class */
+    atomic_long life_hist[HT_NGROUPS][HT_NLIFE];  /* sampled lifetimes */
+    atomic_long lat_hist[HT_NLATOPS][HT_NLAT];    /* timed calls       */
+    atomic_long lat_slow[HT_NLATOPS][HT_NCLASSES];
+    atomic_long lat_max[HT_NLATOPS];  /* ns; reporter swaps it to 0     */
+    atomic_long sfrees;       /* frees of lifetime-sampled blocks    */
+    atomic_long xfrees;       /* ... that another thread allocated   */
+    _Atomic uint32_t tid;     /* owner's kernel tid                  */
+    char        name[16];     /* owner's comm when it claimed the block */
+    uint32_t    prev_tid;     /* previous owner, 0 for a fresh block */
+    char        prev_name[16];
+    ThreadSnap  claim;        /* counters when the owner claimed it  */
+    ThreadSnap  rep;          /* reporter only: as last reported     */
+    uint32_t    rep_tid;      /* reporter only: tid rep belongs to   */
+    int         rep_alive;    /* reporter only: in_use last reported */
+    struct TraceBuf    *trace;/* --record event buffer, owner only   */
+    struct ThreadStats *next; /* immutable once published            */
+    atomic_int  in_use;       /* 1 while owned by a live thread      */
+} __attribute__((aligned(64))) ThreadStats;
+
+static _Atomic(ThreadStats *) stats_head = NULL;
+static pthread_key_t          stats_key;
+static int                    stats_key_ok = 0;
+
+static __thread ThreadStats *tls_stats
+    __attribute__((tls_model("initial-exec"))) = NULL;
+static __thread uint32_t tls_tid
+    __attribute__((tls_model("initial-exec"))) = 0;
+
+/* Owner-only increment: a relaxed load/store pair compiles to a plain add,
+   while still giving the reporter a tear-free read. */
+#define TS_ADD(ts, field, v)                                              \
+    atomic_store_explicit(&(ts)->field,                                   \
+        atomic_load_explicit(&(ts)->field, memory_order_relaxed) + (v),   \
+        memory_order_relaxed)
+
+static void trace_flush(struct TraceBuf *tb);
+
+static void stats_release(void *arg) {
+    ThreadStats *ts = arg;
+    if (ts->trace) trace_flush(ts->trace);
+    tls_stats = NULL;
+    atomic_store_explicit(&ts->in_use, 0, memory_order_release);
+}
+
+static void snap_read(ThreadStats *ts, ThreadSnap *s) {
+    s->allocs      = atomic_load_explicit(&ts->allocs,      memory_order_relaxed);
+    s->frees       = atomic_load_explicit(&ts->frees,       memory_order_relaxed);
+    s->alloc_bytes = atomic_load_explicit(&ts->alloc_bytes, memory_order_relaxed);
+    s->free_bytes  = atomic_load_explicit(&ts->free_bytes,  memory_order_relaxed);
+    s->sfrees      = atomic_load_explicit(&ts->sfrees,      memory_order_relaxed);
+    s->xfrees      = atomic_load_explicit(&ts->xfrees,      memory_order_relaxed);
+}
+
+static ThreadStats *stats_register(void) {
+    if (!tls_tid) tls_tid = (uint32_t)syscall(SYS_gettid);
+
+    /* Reuse a block left behind by an exited thread. The counters carry
+       on; claim marks where this owner's share starts. */
+    for (ThreadStats *ts = atomic_load_explicit(&stats_head, memory_order_acquire);
+         ts; ts = ts->next) {
+        int expected = 0;
+        if (atomic_load_explicit(&ts->in_use, memory_order_relaxed) == 0 &&
+            atomic_compare_exchange_strong(&ts->in_use, &expected, 1)) {
+            ts->prev_tid = atomic_load_explicit(&ts->tid, memory_order_relaxed);
+            memcpy(ts->prev_name, ts->name, sizeof(ts->name));
+            prctl(PR_GET_NAME, ts->name);
+            snap_read(ts, &ts->claim);
+            atomic_store_explicit(&ts->tid, tls_tid, memory_order_release);
+            tls_stats = ts;
+            if (stats_key_ok) pthread_setspecific(stats_key, ts);
+            return ts;
+        }
+    }
+
+    ThreadStats *ts = shim_map(sizeof(ThreadStats));
+    if (ts == MAP_FAILED) return NULL;
+    atomic_store_explicit(&ts->in_use, 1, memory_order_relaxed);
+    prctl(PR_GET_NAME, ts->name);
+    atomic_store_explicit(&ts->tid, tls_tid, memory_order_relaxed);
+
+    ThreadStats *head = atomic_load_explicit(&stats_head, memory_order_relaxed);
+    do {
+        ts->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&stats_head, &head, ts,
+                 memory_order_release, memory_order_relaxed));
+
+    tls_stats = ts;
+    if (stats_key_ok) pthread_setspecific(stats_key, ts);
+    return ts;
+}
+
+static inline ThreadStats *thread_stats(void) {
+    ThreadStats *ts = tls_stats;
+    return ts ? ts : stats_register();
+}
+
+/* Byte-interval sampling state; see the sampler section below */
+static long sample_mean = 0;           /* 0 = sampling disabled */
+static __thread long tls_sample_left
+    __attribute__((tls_model("initial-exec"))) = 0;
+static uint32_t sample_alloc(void *p, long size);
+
+/* Trace recording state; see the trace section below */
+static int trace_fd = -1;              /* -1 = not recording */
+static void trace_event(ThreadStats *ts, unsigned kind, void *p,
+                        uint64_t size, uint32_t stack);
+
+/* Lifetime sampling state; see the live-allocation section below */
+#define LIVE_LIFE 1u                   /* lifetime sample           */
+#define LIVE_SITE 2u                   /* leak-mode byte sample     */
+static long life_every = 0;            /* 0 = lifetime sampling off */
+static __thread long tls_life_left
+    __attribute__((tls_model("initial-exec"))) = 0;
+static atomic_uchar *live_filter = NULL;
+static void live_track(void *p, size_t req, uint32_t stack, uint32_t flags);
+static void live_untrack(void *p, ThreadStats *ts);
+static int  report_threads = 0;        /* send HtThread/HtXPair records */
+static void xpair_add(uint32_t alloc_tid, uint32_t free_tid);
+static inline int live_filter_hit(void *p);
+
+/* Sizes are taken from the allocator itself (malloc_usable_size), so no
+   per-block header is needed. Byte counters are in usable bytes, which is
+   what the block really costs; sampling is driven by the requested size. */
+static inline void count_alloc(void *p, size_t req) {
+    ThreadStats *ts = thread_stats();
+    if (!ts) return;
+    TS_ADD(ts, allocs, 1);
+    TS_ADD(ts, alloc_bytes, (long)real_usable_size(p));
+    TS_ADD(ts, size_hist[ht_size_class(req)], 1);
+    uint32_t stack = 0;
+    if (sample_mean && (tls_sample_left -= (long)req) < 0)
+        stack = sample_alloc(p, (long)req);
+    if (life_every && --tls_life_left <= 0) {
+        tls_life_left = life_every;
+        live_track(p, req, 0, LIVE_LIFE);
+    }
+    if (trace_fd >= 0)
+        trace_event(ts, stack ? HT_EV_ALLOC_STACK : HT_EV_ALLOC, p, req, stack);
+}
+
+/* Must run before the block is handed back to the allocator, so a racing
+   allocation at the same address cannot meet our stale live entry. */
+static inline void count_free(void *p, size_t usable) {
+    ThreadStats *ts = thread_stats();
+    if (!ts) return;
+    TS_ADD(ts, frees, 1);
+    TS_ADD(ts, free_bytes, (long)usable);
+    if (live_filter && live_filter_hit(p))
+        live_untrack(p, ts);
+    if (trace_fd >= 0)
+        trace_event(ts, HT_EV_FREE, p, 0, 0);
+}
+
+typedef struct {
+    long allocs, frees, alloc_bytes, free_bytes, threads;
+    long size_hist[HT_NCLASSES];
+    long life_hist[HT_NGROUPS][HT_NLIFE];
+    long lat_hist[HT_NLATOPS][HT_NLAT];
+    long lat_slow[HT_NLATOPS][HT_NCLASSES];
+} Totals;
+
+static void sum_stats(Totals *t) {
+    memset(t, 0, sizeof(*t));
+    for (ThreadStats *ts = atomic_load_explicit(&stats_head, memory_order_acquire);
+         ts; ts = ts->next) {
+        t->allocs      += atomic_load_explicit(&ts->allocs,      memory_order_relaxed);
+        t->frees       += atomic_load_explicit(&ts->frees,       memory_order_relaxed);
+        t->alloc_bytes += atomic_load_explicit(&ts->alloc_bytes, memory_order_relaxed);
+        t->free_bytes  += atomic_load_explicit(&ts->free_bytes,  memory_order_relaxed);
+        t->threads     += atomic_load_explicit(&ts->in_use,      memory_order_relaxed);
+        for (int c = 0; c < HT_NCLASSES; c++)
+            t->size_hist[c] += atomic_load_explicit(&ts->size_hist[c],
+                                                    memory_order_relaxed);
+        for (int g = 0; g < HT_NGROUPS; g++)
+            for (int b = 0; b < HT_NLIFE; b++)
+                t->life_hist[g][b] += atomic_load_explicit(&ts->life_hist[g][b],
+                                                           memory_order_relaxed);
+        for (int o = 0; o < HT_NLATOPS; o++) {
+            for (int b = 0; b < HT_NLAT; b++)
+                t->lat_hist[o][b] += atomic_load_explicit(&ts->lat_hist[o][b],
+                                                          memory_order_relaxed);
+            for (int c = 0; c < HT_NCLASSES; c++)
+                t->lat_slow[o][c] += atomic_load_explicit(&ts->lat_slow[o][c],
+                                                          memory_order_relaxed);
+        }
+    }
+}
+
+/* ---- Cheap clock -------------------------------------------------------- */
+/* Lifetimes are stamped with the TSC when it is invariant (constant_tsc and
+   nonstop_tsc in /proc/cpuinfo), calibrated once against CLOCK_MONOTONIC;
+   otherwise with the vDSO clock_gettime. */
+static int    use_tsc = 0;
+static double ns_per_tick = 1.0;
+
+static uint64_t mono_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static inline uint64_t ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (use_tsc) return __rdtsc();
+#endif
+    return mono_ns();
+}
+
+static inline uint64_t ticks_to_ns(uint64_t t) {
+    return use_tsc ? (uint64_t)(t * ns_per_tick) : t;
+}
+
+static void clock_init(void) {
+    static int done = 0;
+    if (done) return;
+    done = 1;
+#if defined(__x86_64__) || defined(__i386__)
+    /* cpuinfo flags are on the first processor's block, well within 8 KB */
+    static char buf[8192];
+    int fd = open("/proc/cpuinfo", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return;
+    buf[n] = '\0';
+    if (!strstr(buf, " constant_tsc") || !strstr(buf, " nonstop_tsc")) return;
+
+    uint64_t n0 = mono_ns(), t0 = __rdtsc();
+    struct timespec d = { 0, 2000000 };  /* 2 ms */
+    nanosleep(&d, NULL);
+    uint64_t n1 = mono_ns(), t1 = __rdtsc();
+    if (t1 <= t0) return;
+    ns_per_tick = (double)(n1 - n0) / (double)(t1 - t0);
+    use_tsc = 1;
+#endif
+}
+
+/* ---- Allocator call latency ---------------------------------------------- */
+/* One call in ~lat_every per thread is timed around the real allocator call
+   and binned into the thread's log-linear histogram. The countdown is
+   jittered so call patterns with a fixed period (free, malloc, free, ...)
+   are not sampled on one side only. */
+static long     lat_every = 0;         /* 0 = latency timing off */
+static uint64_t lat_slow_ns = 10000;
+static __thread long tls_lat_left
+    __attribute__((tls_model("initial-exec"))) = 0;
+static __thread uint32_t tls_lat_rng
+    __attribute__((tls_model("initial-exec"))) = 0;
+
+/* Start ticks if this call is to be timed, else 0 */
+static inline uint64_t lat_start(void) {
+    if (!lat_every || --tls_lat_left > 0) return 0;
+    tls_lat_rng = tls_lat_rng * 1664525u + 1013904223u;
+    tls_lat_left = lat_every / 2 + (long)(tls_lat_rng >> 8) % lat_every + 1;
+    return ticks();
+}
+
+static __attribute__((noinline)) void lat_end(int op, uint64_t t0, size_t size) {
+    uint64_t ns = ticks_to_ns(ticks() - t0);
+    ThreadStats *ts = thread_stats();
+    if (!ts) return;
+    TS_ADD(ts, lat_hist[op][ht_lat_bucket(ns)], 1);
+    if (ns >= lat_slow_ns)
+        TS_ADD(ts, lat_slow[op][ht_size_class(size)], 1);
+    if ((long)ns > atomic_load_explicit(&ts->lat_max[op], memory_order_relaxed))
+        atomic_store_explicit(&ts->lat_max[op], (long)ns, memory_order_relaxed);
+}
+
+/* Slowest timed call per op since the last call, over all threads. An
+   update racing with the swap lands in the next interval instead. */
+static void lat_take_max(int64_t max_ns[HT_NLATOPS]) {
+    for (int o = 0; o < HT_NLATOPS; o++) max_ns[o] = 0;
+    for (ThreadStats *ts = atomic_load_explicit(&stats_head, memory_order_acquire);
+         ts; ts = ts->next)
+        for (int o = 0; o < HT_NLATOPS; o++) {
+            long m = atomic_exchange_explicit(&ts->lat_max[o], 0,
+                                              memory_order_relaxed);
+            if (m > max_ns[o]) max_ns[o] = m;
+        }
+}
+
+/* ---- Sampled live allocations ------------------------------------------- */
+/* Two kinds of sampled allocation are remembered in a lock-striped hash
+   table keyed by address until they are freed:
+     LIVE_LIFE  every life_every-th allocation per thread; its free lands a
+                lifetime in the freeing thread's histogram. Counting (not
+                byte) sampling keeps small objects fairly represented.
+     LIVE_SITE  byte-sampled allocations in leak mode; they keep their
+                stack's retained-bytes estimate up while live.
+
+   free() must find out cheaply whether an address is tracked. A table of
+   small per-hash counters (a counting Bloom filter) answers that with one
+   load; only hits take a stripe lock. Capacity is fixed at start-up, so
+   memory is bounded; samples that find their stripe full are dropped. */
+#define LIVE_STRIPES   64
+#define FILTER_BITS    20              /* 1 Mi one-byte counters */
+#define LIVE_DEFAULT   65536           /* tracked allocations     */
+
+typedef struct {
+    uintptr_t ptr;                     /* 0 = empty               */
+    uint64_t  t_alloc;                 /* ticks()                 */
+    uint64_t  size;                    /* requested bytes         */
+    uint32_t  stack;                   /* stacks[] index + 1      */
+    uint32_t  flags : 8;               /* LIVE_*                  */
+    uint32_t  tid   : 24;              /* allocating thread       */
+} LiveEntry;
+
+typedef struct {
+    atomic_flag lock;
+    unsigned    used;
+    LiveEntry  *slots;                 /* live_slots entries      */
+} __attribute__((aligned(64))) LiveStripe;
+
+static LiveStripe  live_stripes[LIVE_STRIPES];
+static unsigned    live_slots   = 0;   /* per stripe, power of two */
+static atomic_long live_dropped = 0;
+static atomic_long live_count   = 0;
+
+static void site_release(uint32_t stack, uint64_t size);
+
+static inline uint64_t ptr_hash(uintptr_t p) {
+    uint64_t h = (uint64_t)p * 0x9E3779B97F4A7C15ull;
+    return h ^ (h >> 29);
+}
+
+static inline int live_filter_hit(void *p) {
+    uint64_t h = ptr_hash((uintptr_t)p);
+    return atomic_load_explicit(&live_filter[h >> (64 - FILTER_BITS)],
+                                memory_order_relaxed) != 0;
+}
+
+static void filter_adjust(uint64_t h, int delta) {
+    atomic_uchar *c = &live_filter[h >> (64 - FILTER_BITS)];
+    unsigned char v = atomic_load_explicit(c, memory_order_relaxed);
+    /* 255 is sticky: once saturated the counter can no longer be trusted
+       to reach zero, so it stays set (costing only false positives). */
+    while (v != 255 && !atomic_compare_exchange_weak(c, &v, v + delta))
+        ;
+}
+
+static inline void stripe_lock(LiveStripe *s) {
+    while (atomic_flag_test_and_set_explicit(&s->lock, memory_order_acquire))
+        ;
+}
+
+static inline void stripe_unlock(LiveStripe *s) {
+    atomic_flag_clear_explicit(&s->lock, memory_order_release);
+}
+
+static int live_init(long capacity) {
+    unsigned per = 8;
+    while ((long)per * LIVE_STRIPES * 3 / 4 < capacity) per <<= 1;
+
+    size_t bytes = (size_t)per * LIVE_STRIPES * sizeof(LiveEntry);
+    char *mem = shim_map(bytes);
+    if (mem == MAP_FAILED) return -1;
+    void *f = shim_map((size_t)1 << FILTER_BITS);
+    if (f == MAP_FAILED) { shim_unmap(mem, bytes); return -1; }
+
+    for (int i = 0; i < LIVE_STRIPES; i++)
+        live_stripes[i].slots = (LiveEntry *)mem + (size_t)i * per;
+    live_slots  = per;
+    live_filter = f;
+    return 0;
+}
+
+static __attribute__((noinline)) void live_track(void *p, size_t req,
+                                                 uint32_t stack, uint32_t flags) {
+    uint64_t h = ptr_hash((uintptr_t)p);
+    LiveStripe *s = &live_stripes[h & (LIVE_STRIPES - 1)];
+    unsigned mask = live_slots - 1;
+
+    stripe_lock(s);
+    unsigned i = (unsigned)(h >> 32) & mask;
+    while (s->slots[i].ptr && s->slots[i].ptr != (uintptr_t)p)
+        i = (i + 1) & mask;
+    if (s->slots[i].ptr) {
+        /* sampled both ways */
+        s->slots[i].flags |= flags;
+        if (stack) s->slots[i].stack = stack;
+        stripe_unlock(s);
+        return;
+    }
+    if (s->used >= live_slots * 3 / 4) {
+        stripe_unlock(s);
+        atomic_fetch_add_explicit(&live_dropped, 1, memory_order_relaxed);
+        if (stack) site_release(stack, req);
+        return;
+    }
+    s->slots[i].ptr     = (uintptr_t)p;
+    s->slots[i].t_alloc = ticks();
+    s->slots[i].size    = req;
+    s->slots[i].stack   = stack;
+    s->slots[i].flags   = flags;
+    s->slots[i].tid     = tls_tid;
+    s->used++;
+    filter_adjust(h, 1);
+    stripe_unlock(s);
+    atomic_fetch_add_explicit(&live_count, 1, memory_order_relaxed);
+}
+
+static __attribute__((noinline)) void live_untrack(void *p, ThreadStats *ts) {
+    uint64_t h = ptr_hash((uintptr_t)p);
+    LiveStripe *s = &live_stripes[h & (LIVE_STRIPES - 1)];
+    unsigned mask = live_slots - 1;
+
+    stripe_lock(s);
+    unsigned i = (unsigned)(h >> 32) & mask;
+    while (s->slots[i].ptr && s->slots[i].ptr != (uintptr_t)p)
+        i = (i + 1) & mask;
+    if (!s->slots[i].ptr) {            /* filter false positive */
+        stripe_unlock(s);
+        return;
+    }
+    LiveEntry e = s->slots[i];
+
+    /* Backward-shift deletion keeps probe chains intact without tombstones */
+    unsigned j = i;
+    for (;;) {
+        j = (j + 1) & mask;
+        if (!s->slots[j].ptr) break;
+        unsigned home = (unsigned)(ptr_hash(s->slots[j].ptr) >> 32) & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            s->slots[i] = s->slots[j];
+            i = j;
+        }
+    }
+    s->slots[i].ptr = 0;
+    s->used--;
+    filter_adjust(h, -1);
+    stripe_unlock(s);
+    atomic_fetch_sub_explicit(&live_count, 1, memory_order_relaxed);
+
+    if (e.flags & LIVE_LIFE) {
+        uint64_t now = ticks();
+        uint64_t ns  = now > e.t_alloc ? ticks_to_ns(now - e.t_alloc) : 0;
+        TS_ADD(ts, life_hist[ht_size_group(e.size)][ht_life_bucket(ns)], 1);
+        TS_ADD(ts, sfrees, 1);
+        if (e.tid != (tls_tid & 0xffffff)) {
+            TS_ADD(ts, xfrees, 1);
+            if (report_threads) xpair_add(e.tid, tls_tid);
+        }
+    }
+    if (e.flags & LIVE_SITE) site_release(e.stack, e.size);
+}
+
+/* ---- Cross-thread frees ------------------------------------------------- */
+/* A lifetime sample freed by a thread other than the one that allocated it
+   is counted per (allocating, freeing) pair. Only 1 in life_every frees
+   gets here, so a spinlocked table is cheap enough; the reporter empties
+   it every interval, so threads that come and go do not fill it up. */
+#define XPAIRS 256
+
+typedef struct {
+    uint32_t alloc_tid, free_tid;
+    long     count;
+} XPair;
+
+static XPair       xpairs[XPAIRS];
+static unsigned    xpairs_used = 0;
+static atomic_flag xpairs_lock = ATOMIC_FLAG_INIT;
+
+static void xpair_add(uint32_t alloc_tid, uint32_t free_tid) {
+    uint64_t h = ptr_hash(((uintptr_t)alloc_tid << 32) | free_tid);
+    unsigned i = (unsigned)(h >> 32) & (XPAIRS - 1);
+
+    while (atomic_flag_test_and_set_explicit(&xpairs_lock, memory_order_acquire))
+        ;
+    while (xpairs[i].count &&
+           (xpairs[i].alloc_tid != alloc_tid || xpairs[i].free_tid != free_tid))
+        i = (i + 1) & (XPAIRS - 1);
+    if (xpairs[i].count) {
+        xpairs[i].count++;
+    } else if (xpairs_used < XPAIRS * 3 / 4) {   /* else dropped */
+        xpairs[i] = (XPair){ alloc_tid, free_tid, 1 };
+        xpairs_used++;
+    }
+    atomic_flag_clear_explicit(&xpairs_lock, memory_order_release);
+}
+
+/* ---- Trace recording (heaptrack --record) ------------------------------- */
+/* Each thread encodes its events (format in heaptrack.h) into a private
+   64 KB buffer and appends it to the file with one writev() when full or
+   when the thread exits, so recording takes no locks. The exit path also
+   flushes buffers of threads still running; that is best effort, as they
+   may keep allocating while the process tears down. */
+#define TRACE_BUF    (64 * 1024)
+#define TRACE_SLACK  32                /* worst-case bytes for one event  */
+
+typedef struct TraceBuf {
+    uint32_t tid;                      /* owner the block belongs to      */
+    uint32_t len, nevents;
+    uint64_t t0, p0;                   /* bases of the block being built  */
+    uint64_t last_t, last_p;
+    unsigned char data[TRACE_BUF];
+} TraceBuf;
+
+static inline unsigned char *put_varint(unsigned char *o, uint64_t v) {
+    while (v >= 0x80) {
+        *o++ = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    *o++ = (unsigned char)v;
+    return o;
+}
+
+static void trace_write(const void *a, size_t alen, const void *b, size_t blen) {
+    struct iovec iov[2] = {
+        { (void *)a, alen },
+        { (void *)b, blen },
+    };
+    ssize_t w = writev(trace_fd, iov, blen ? 2 : 1);
+    (void)w;
+}
+
+static void trace_flush(TraceBuf *tb) {
+    if (!tb->nevents || trace_fd < 0) return;
+    HtTraceBlock hdr = {
+        .type = HT_TBLK_EVENTS, .len = tb->len, .tid = tb->tid,
+        .nevents = tb->nevents, .t0 = tb->t0, .p0 = tb->p0,
+    };
+    trace_write(&hdr, sizeof(hdr), tb->data, tb->len);
+    tb->len = tb->nevents = 0;
+}
+
+static __attribute__((noinline)) TraceBuf *trace_buf_new(ThreadStats *ts) {
+    TraceBuf *tb = shim_map(sizeof(TraceBuf));
+    if (tb == MAP_FAILED) return NULL;
+    ts->trace = tb;
+    return tb;
+}
+
+static void trace_event(ThreadStats *ts, unsigned kind, void *p,
+                        uint64_t size, uint32_t stack) {
+    TraceBuf *tb = ts->trace;
+    if (!tb && !(tb = trace_buf_new(ts))) return;
+
+    if (tb->tid != tls_tid) {
+        /* counter block (and buffer) inherited from an exited thread */
+        trace_flush(tb);
+        tb->tid = tls_tid;
+    }
+    if (tb->len + TRACE_SLACK > TRACE_BUF) trace_flush(tb);
+
+    uint64_t t = ticks();
+    if (!tb->nevents) {
+        tb->t0 = tb->last_t = t;
+        tb->p0 = tb->last_p = (uintptr_t)p;
+    }
+    if (t < tb->last_t) t = tb->last_t;
+
+    unsigned char *o = tb->data + tb->len;
+    int64_t dp = (int64_t)((uintptr_t)p - tb->last_p);
+    o = put_varint(o, ((t - tb->last_t) << 2) | kind);
+    o = put_varint(o, ((uint64_t)dp << 1) ^ (uint64_t)(dp >> 63));
+    if (kind != HT_EV_FREE)        o = put_varint(o, size);
+    if (kind == HT_EV_ALLOC_STACK) o = put_varint(o, stack);
+
+    tb->len    = (uint32_t)(o - tb->data);
+    tb->last_t = t;
+    tb->last_p = (uintptr_t)p;
+    tb->nevents++;
+}
+
+/* A child forked without exec would write the parent's buffered events a
+   second time; it stops recording instead. Exec'd children record to
+   <file>.<pid> from their own constructor. */
+static void trace_atfork_child(void) {
+    for (ThreadStats *ts = atomic_load(&stats_head); ts; ts = ts->next)
+        if (ts->trace) ts->trace->len = ts->trace->nevents = 0;
+    close(trace_fd);
+    trace_fd = -1;
+}
+
+static int trace_open(const char *path) {
+    char buf[4096];
+    const char *owner = getenv("HEAPTRACK_PID");
+    if (owner && atoi(owner) != (int)getpid()) {
+        snprintf(buf, sizeof(buf), "%s.%d", path, (int)getpid());
+        path = buf;
+    }
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+                  0644);
+    if (fd < 0) return -1;
+
+    clock_init();
+    HtTraceHdr hdr = {
+        .magic       = HT_TRACE_MAGIC,
+        .version     = HT_TRACE_VERSION,
+        .start_ticks = ticks(),
+        .ns_per_tick = use_tsc ? ns_per_tick : 1.0,
+        .sample_mean = (uint64_t)sample_mean,
+        .pid         = (uint32_t)getpid(),
+    };
+    trace_fd = fd;
+    trace_write(&hdr, sizeof(hdr), NULL, 0);
+    pthread_atfork(NULL, NULL, trace_atfork_child);
+    return 0;
+}
+
+/* ---- Shared-memory ring (producer side) --------------------------------- */
+/* Only the reporter thread and the exit path produce, serialised by
+   report_lock, so the ring itself needs no atomics beyond head/tail. */
+static HtRing         *ring     = NULL;
+static int             ring_efd = -1;
+static uint64_t        ring_pending;       /* reserved, not yet published */
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* The ring has a single producer: a child forked without exec detaches
+   rather than racing the parent on head. Its exit report is lost, as for
+   any process the wrapper did not start. */
+static void ring_atfork_child(void) {
+    shim_unmap(ring, sizeof(HtRing));
+    close(ring_efd);
+    ring         = NULL;
+    ring_efd     = -1;
+    ring_pending = 0;
+}
+
+static int ring_attach(void) {
+    const char *shm = getenv("HEAPTRACK_SHM_FD");
+    const char *efd = getenv("HEAPTRACK_EVENTFD");
+    const char *own = getenv("HEAPTRACK_PID");
+    /* Forked children inherit the environment; only the wrapper's direct
+       child attaches, so the ring keeps a single producer. */
+    if (!shm || !efd || !own || atoi(own) != (int)getpid()) return -1;
+
+    int fd = atoi(shm);
+    void *p = (void *)syscall(SYS_mmap, NULL, sizeof(HtRing),
+                              PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) return -1;
+    HtRing *r = p;
+    if (r->hdr.magic != HT_MAGIC || r->hdr.version != HT_VERSION ||
+        r->hdr.ring_size != HT_RING_SIZE) {
+        shim_unmap(p, sizeof(HtRing));
+        return -1;
+    }
+    ring     = r;
+    ring_efd = atoi(efd);
+    /* The mapping outlives the descriptors; don't leak them into exec'd
+       grandchildren. */
+    fcntl(fd,       F_SETFD, FD_CLOEXEC);
+    fcntl(ring_efd, F_SETFD, FD_CLOEXEC);
+    pthread_atfork(NULL, NULL, ring_atfork_child);
+    return 0;
+}
+
+/* Reserve a record with len payload bytes; returns the payload or NULL if
+   the consumer has fallen a full ring behind. Publish with ring_commit(). */
+
+static void *ring_reserve(uint32_t type, size_t len) {
+    uint32_t need = HT_REC_LEN(len);
+    uint64_t head = atomic_load_explicit(&ring->hdr.head, memory_order_relaxed) +
+                    ring_pending;
+    uint64_t tail = atomic_load_explicit(&ring->hdr.tail, memory_order_acquire);
+    uint32_t pos  = (uint32_t)(head & (HT_RING_SIZE - 1));
+    uint32_t gap  = pos + need > HT_RING_SIZE ? HT_RING_SIZE - pos : 0;
+
+    if (head + gap + need - tail > HT_RING_SIZE) {
+        atomic_fetch_add_explicit(&ring->hdr.dropped, 1, memory_order_relaxed);
+        return NULL;
+    }
+    if (gap) {
+        HtRec *pad = (HtRec *)(ring->data + pos);
+        pad->type = HT_REC_PAD;
+        pad->len  = gap;
+        pos = 0;
+    }
+    HtRec *rec = (HtRec *)(ring->data + pos);
+    rec->type = type;
+    rec->len  = need;
+    ring_pending += gap + need;
+    return rec + 1;
+}
+
+static void ring_commit(void) {
+    if (!ring_pending) return;
+    atomic_fetch_add_explicit(&ring->hdr.head, ring_pending, memory_order_release);
+    ring_pending = 0;
+    uint64_t one = 1;
+    ssize_t w = write(ring_efd, &one, sizeof(one));
+    (void)w;
+}
+
+/* ---- Allocation-site sampler -------------------------------------------- */
+/* Randomized byte-interval sampling (as in tcmalloc): each thread counts
+   down a byte budget drawn from an exponential distribution with mean
+   sample_mean, and takes a backtrace when it crosses zero. A sample of an
+   allocation of size s stands for s / (1 - e^(-s/mean)) bytes, which keeps
+   the per-site estimates unbiased for both small and large requests.
+
+   The fast path is one thread-local subtract and compare. Samples go into
+   a fixed open-addressed table keyed by stack hash; it is only touched on
+   a sample (one per sample_mean bytes), so a spinlock is enough. */
+#define MAX_DEPTH   32
+#define MAX_STACKS  4096              /* power of two                    */
+#define SYM_LEN     128
+
+typedef struct {
+    uint64_t    hash;                 /* 0 = empty slot                  */
+    int         depth;
+    void       *frames[MAX_DEPTH];    /* leaf first, our frames stripped */
+    atomic_long est_bytes;            /* estimated bytes allocated       */
+    atomic_long est_calls;            /* estimated allocation calls      */
+    atomic_long live_bytes;           /* leak mode: estimated retained   */
+    atomic_long live_calls;           /* leak mode: estimated live blocks */
+    long        rep_bytes, rep_calls; /* reporter: values at last report */
+    long        dump_bytes;           /* reporter: retained at last dump */
+} StackEntry;
+
+static int         top_n         = 5;
+static int         leak_mode     = 0;     /* track live byte samples      */
+static StackEntry *stacks        = NULL;
+static atomic_flag stacks_lock   = ATOMIC_FLAG_INIT;
+static atomic_long stacks_dropped = 0;    /* samples lost to a full table */
+static uintptr_t   self_lo, self_hi;      /* our own text, to strip      */
+
+static __thread int      tls_sample_armed
+    __attribute__((tls_model("initial-exec"))) = 0;
+static __thread uint64_t tls_rng
+    __attribute__((tls_model("initial-exec"))) = 0;
+static __thread int      tls_in_hook      /* re-entrancy guard */
+    __attribute__((tls_model("initial-exec"))) = 0;
+
+static long next_sample_interval(void) {
+    if (!tls_rng)
+        tls_rng = ((uint64_t)(uintptr_t)&tls_rng * 0x9E3779B97F4A7C15ull) |
+                  1;
+    /* xorshift64* */
+    tls_rng ^= tls_rng >> 12;
+    tls_rng ^= tls_rng << 25;
+    tls_rng ^= tls_rng >> 27;
+    uint64_t r = tls_rng * 0x2545F4914F6CDD1Dull;
+    double u = ((r >> 11) + 1) * (1.0 / 9007199254740992.0); /* (0, 1] */
+    long n = (long)(-log(u) * (double)sample_mean);
+    return n < 1 ? 1 : n;
+}
+
+static uint64_t hash_frames(void **frames, int depth) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (int i = 0; i < depth; i++) {
+        h ^= (uint64_t)(uintptr_t)frames[i];
+        h *= 0x100000001b3ull;
+    }
+    return h ? h : 1;
+}
+
+static StackEntry *stack_lookup(void **frames, int depth) {
+    uint64_t h = hash_frames(frames, depth);
+    StackEntry *found = NULL;
+
+    while (atomic_flag_test_and_set_explicit(&stacks_lock, memory_order_acquire))
+        ;
+    for (unsigned i = 0; i < MAX_STACKS; i++) {
+        StackEntry *e = &stacks[(h + i) & (MAX_STACKS - 1)];
+        if (e->hash == 0) {
+            e->depth = depth;
+            memcpy(e->frames, frames, depth * sizeof(void *));
+            e->hash = h;
+            found = e;
+            break;
+        }
+        if (e->hash == h && e->depth == depth &&
+            memcmp(e->frames, frames, depth * sizeof(void *)) == 0) {
+            found = e;
+            break;
+        }
+    }
+    atomic_flag_clear_explicit(&stacks_lock, memory_order_release);
+    return found;
+}
+
+/* A sample of size s stands for s / (1 - e^(-s/mean)) bytes */
+static long sample_weight(uint64_t size) {
+    double w = 1.0 - exp(-(double)size / (double)sample_mean);
+    return w > 0 ? (long)((double)size / w) : (long)size;
+}
+
+/* Returns the sample's stacks[] index + 1, or 0 if none was taken */
+static __attribute__((noinline)) uint32_t sample_alloc(void *p, long size) {
+    int armed = tls_sample_armed;
+    tls_sample_left  = next_sample_interval();
+    tls_sample_armed = 1;
+    if (!armed || tls_in_hook || !stacks) return 0;
+    tls_in_hook = 1;
+
+    void *raw[MAX_DEPTH + 4];
+    int n = backtrace(raw, MAX_DEPTH + 4);
+    int skip = 0;
+    while (skip < n && (uintptr_t)raw[skip] >= self_lo &&
+           (uintptr_t)raw[skip] <  self_hi)
+        skip++;
+    int depth = n - skip;
+    if (depth > MAX_DEPTH) depth = MAX_DEPTH;
+
+    StackEntry *e = depth > 0 ? stack_lookup(raw + skip, depth) : NULL;
+    uint32_t id = e ? (uint32_t)(e - stacks) + 1 : 0;
+    if (e) {
+        long bytes = sample_weight((uint64_t)size);
+        long calls = size > 0 ? bytes / size : 1;
+        atomic_fetch_add_explicit(&e->est_bytes, bytes, memory_order_relaxed);
+        atomic_fetch_add_explicit(&e->est_calls, calls, memory_order_relaxed);
+        if (leak_mode) {
+            atomic_fetch_add_explicit(&e->live_bytes, bytes, memory_order_relaxed);
+            atomic_fetch_add_explicit(&e->live_calls, calls, memory_order_relaxed);
+            live_track(p, (size_t)size, id, LIVE_SITE);
+        }
+    } else {
+        atomic_fetch_add(&stacks_dropped, 1);
+    }
+    tls_in_hook = 0;
+    return id;
+}
 
-/* ---- Per-second counters (reset by reporter) ---------------------------- */
-static atomic_long ps_allocs = 0;  /* allocations this second         */
-static atomic_long ps_frees  = 0;  /* frees this second               */
-static atomic_long ps_bytes  = 0;  /* bytes allocated this second     */
-static atomic_long live_bytes = 0; /* current live heap bytes         */
+static void site_release(uint32_t stack, uint64_t size) {
+    StackEntry *e = &stacks[stack - 1];
+    long bytes = sample_weight(size);
+    atomic_fetch_sub_explicit(&e->live_bytes, bytes, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&e->live_calls, size > 0 ? bytes / (long)size : 1,
+                              memory_order_relaxed);
+}
 
-/* ---- Allocation header -------------------------------------------------- */
-/* We prepend 16 bytes (size_t padded to 16 for alignment) to every
-   allocation so we know the size when free() is called. */
-#define HDR 16
+static int find_self(struct dl_phdr_info *info, size_t sz, void *arg) {
+    (void)sz;
+    uintptr_t me = (uintptr_t)arg;
+    for (int i = 0; i < info->dlpi_phnum; i++) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        if (ph->p_type != PT_LOAD || !(ph->p_flags & PF_X)) continue;
+        uintptr_t lo = info->dlpi_addr + ph->p_vaddr;
+        uintptr_t hi = lo + ph->p_memsz;
+        if (me >= lo && me < hi) { self_lo = lo; self_hi = hi; return 1; }
+    }
+    return 0;
+}
+
+/* Name a return address as "func" or "[object+0xoff]" for folded output.
+   Static functions in the target only resolve if it was linked -rdynamic. */
+static void symbolize(void *addr, char *out, size_t len) {
+    Dl_info info;
+    void *pc = (char *)addr - 1;  /* return address -> call site */
+    if (dladdr(pc, &info) && info.dli_sname) {
+        snprintf(out, len, "%s", info.dli_sname);
+    } else if (info.dli_fname && info.dli_fbase) {
+        const char *base = strrchr(info.dli_fname, '/');
+        snprintf(out, len, "[%s+0x%lx]", base ? base + 1 : info.dli_fname,
+                 (unsigned long)((uintptr_t)pc - (uintptr_t)info.dli_fbase));
+    } else {
+        snprintf(out, len, "[%p]", pc);
+    }
+}
+
+/* Write every sampled stack as "root;...;leaf bytes", the folded format
+   consumed by flamegraph.pl. Uses write(2) on a static buffer so it cannot
+   recurse into the allocator. */
+static void dump_folded(const char *path) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+
+    static char line[MAX_DEPTH * SYM_LEN + 64];
+    char sym[SYM_LEN];
+    for (unsigned i = 0; i < MAX_STACKS; i++) {
+        StackEntry *e = &stacks[i];
+        if (!e->hash) continue;
+        long bytes = atomic_load(&e->est_bytes);
+        if (bytes <= 0) continue;
+
+        size_t pos = 0;
+        for (int d = e->depth - 1; d >= 0; d--) {
+            symbolize(e->frames[d], sym, sizeof(sym));
+            int w = snprintf(line + pos, sizeof(line) - pos, "%s%s",
+                             sym, d ? ";" : "");
+            if (w > 0) pos += (size_t)w;
+            if (pos >= sizeof(line) - 32) pos = sizeof(line) - 32;
+        }
+        pos += snprintf(line + pos, sizeof(line) - pos, " %ld\n", bytes);
+        ssize_t w = write(fd, line, pos);
+        (void)w;
+    }
+    close(fd);
+}
+
+typedef struct {
+    StackEntry *e;
+    long        bytes, calls;  /* delta since the previous report */
+} SiteDelta;
+
+/* Insert d into arr (sorted descending, n used of keep) */
+static int site_insert(SiteDelta *arr, int n, int keep, SiteDelta d,
+                       int by_calls) {
+#define SITE_KEY(x) (by_calls ? (x).calls : (x).bytes)
+    int j;
+    if (n < keep) {
+        j = n++;
+    } else {
+        if (keep == 0 || SITE_KEY(arr[keep - 1]) >= SITE_KEY(d)) return n;
+        j = keep - 1;
+    }
+    for (; j > 0 && SITE_KEY(arr[j - 1]) < SITE_KEY(d); j--)
+        arr[j] = arr[j - 1];
+    arr[j] = d;
+    return n;
+#undef SITE_KEY
+}
+
+/* Take this interval's deltas for every stack and append the top N by
+   bytes and by calls to the ring as HtSite records. */
+static void report_sites(void) {
+    static SiteDelta by_bytes[64], by_calls[64];
+    int nb = 0, nc = 0, keep = top_n < 64 ? top_n : 64;
+
+    for (unsigned i = 0; i < MAX_STACKS; i++) {
+        StackEntry *e = &stacks[i];
+        if (!e->hash) continue;
+        long b = atomic_load_explicit(&e->est_bytes, memory_order_relaxed);
+        long c = atomic_load_explicit(&e->est_calls, memory_order_relaxed);
+        SiteDelta d = { e, b - e->rep_bytes, c - e->rep_calls };
+        e->rep_bytes = b;
+        e->rep_calls = c;
+        if (d.calls <= 0) continue;
+        nb = site_insert(by_bytes, nb, keep, d, 0);
+        nc = site_insert(by_calls, nc, keep, d, 1);
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        SiteDelta *arr = pass ? by_calls : by_bytes;
+        int n = pass ? nc : nb;
+        for (int i = 0; i < n; i++) {
+            HtSite *s = ring_reserve(HT_REC_SITE, sizeof(HtSite));
+            if (!s) return;
+            s->kind  = pass ? HT_SITE_CALLS : HT_SITE_BYTES;
+            s->rank  = (uint32_t)i;
+            s->bytes = arr[i].bytes;
+            s->calls = arr[i].calls;
+            symbolize(arr[i].e->frames[0], s->sym, sizeof(s->sym));
+        }
+    }
+}
+
+/* ---- Bootstrap allocations ---------------------------------------------- */
+/* Only blocks carved from bootstrap_buf carry a 16-byte size prefix, so
+   realloc and malloc_usable_size work on them too. They are never freed. */
+#define BOOT_HDR 16
 
 static inline int is_bootstrap(void *ptr) {
     return ptr >= (void *)bootstrap_buf &&
            ptr <  (void *)(bootstrap_buf + BOOTSTRAP_SIZE);
 }
 
+static void *bootstrap_alloc(size_t size) {
+    /* static storage is zero-filled, so this also serves calloc */
+    size_t aligned = (size + BOOT_HDR - 1) & ~(size_t)(BOOT_HDR - 1);
+    if (aligned < size ||
+        bootstrap_pos + BOOT_HDR + aligned > BOOTSTRAP_SIZE) return NULL;
+    char *p = bootstrap_buf + bootstrap_pos;
+    *(size_t *)p = size;
+    bootstrap_pos += BOOT_HDR + aligned;
+    return p + BOOT_HDR;
+}
+
+static inline size_t bootstrap_size(void *ptr) {
+    return *(size_t *)((char *)ptr - BOOT_HDR);
+}
+
+/* ---- Leak reports -------------------------------------------------------- */
+static atomic_int leak_signal = 0;     /* set by the SIGUSR2 handler   */
+static uint32_t   leak_req_seen = 0;   /* last ring dump_req handled   */
+static uint32_t   leak_seq = 0;
+static long       live_capacity = 0;
+
+static void on_sigusr2(int sig) {
+    (void)sig;
+    atomic_store(&leak_signal, 1);
+}
+
+static void site_name(const StackEntry *e, char *out, size_t len) {
+    symbolize(e->frames[0], out, len);
+    if (e->depth > 1) {
+        size_t n = strlen(out);
+        if (n + 4 < len) {
+            memcpy(out + n, " < ", 3);
+            symbolize(e->frames[1], out + n + 3, len - n - 3);
+        }
+    }
+}
+
+/* Append a leak report: the top N stacks by retained bytes and by growth
+   since the previous report. Caller holds report_lock. */
+static void report_leaks(uint32_t reason) {
+    static SiteDelta by_bytes[64], by_growth[64];
+    int nb = 0, ng = 0, keep = top_n < 64 ? top_n : 64;
+    long retained = 0, growth = 0;
+
+    for (unsigned i = 0; i < MAX_STACKS; i++) {
+        StackEntry *e = &stacks[i];
+        if (!e->hash) continue;
+        long b = atomic_load_explicit(&e->live_bytes, memory_order_relaxed);
+        long g = b - e->dump_bytes;
+        e->dump_bytes = b;
+        retained += b;
+        growth   += g;
+        /* SiteDelta reused: bytes = retained, calls = growth */
+        SiteDelta d = { e, b, g };
+        if (b > 0) nb = site_insert(by_bytes,  nb, keep, d, 0);
+        if (g > 0) ng = site_insert(by_growth, ng, keep, d, 1);
+    }
+
+    HtLeakHdr *lh = ring_reserve(HT_REC_LEAK_HDR, sizeof(HtLeakHdr));
+    if (!lh) return;
+    lh->reason   = reason;
+    lh->seq      = ++leak_seq;
+    lh->tracked  = atomic_load(&live_count);
+    lh->capacity = live_capacity;
+    lh->dropped  = atomic_load(&live_dropped);
+    lh->retained = retained;
+    lh->growth   = growth;
+
+    for (int pass = 0; pass < 2; pass++) {
+        SiteDelta *arr = pass ? by_growth : by_bytes;
+        int n = pass ? ng : nb;
+        for (int i = 0; i < n; i++) {
+            HtLeakSite *s = ring_reserve(HT_REC_LEAK_SITE, sizeof(HtLeakSite));
+            if (!s) return;
+            s->kind   = pass ? HT_LEAK_GROWTH : HT_LEAK_RETAINED;
+            s->rank   = (uint32_t)i;
+            s->bytes  = arr[i].bytes;
+            s->count  = atomic_load_explicit(&arr[i].e->live_calls,
+                                             memory_order_relaxed);
+            s->growth = arr[i].calls;
+            site_name(arr[i].e, s->sym, sizeof(s->sym));
+        }
+    }
+}
+
+/* ---- Per-thread report (-T) -------------------------------------------- */
+#define THREAD_BATCH 256
+
+static void thread_name(uint32_t tid, char *out, size_t len) {
+    char path[64];
+    out[0] = '\0';
+    snprintf(path, sizeof(path), "/proc/self/task/%u/comm", tid);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    ssize_t n = read(fd, out, len - 1);
+    close(fd);
+    if (n <= 0) { out[0] = '\0'; return; }
+    if (out[n - 1] == '\n') n--;
+    out[n] = '\0';
+}
+
+static void thread_row(HtThread *r, uint32_t tid, int alive, const char *name,
+                       const ThreadSnap *now, const ThreadSnap *then) {
+    memset(r, 0, sizeof(*r));
+    r->tid         = tid;
+    r->alive       = (uint32_t)alive;
+    r->allocs      = now->allocs      - then->allocs;
+    r->frees       = now->frees       - then->frees;
+    r->alloc_bytes = now->alloc_bytes - then->alloc_bytes;
+    r->free_bytes  = now->free_bytes  - then->free_bytes;
+    r->sfrees      = now->sfrees      - then->sfrees;
+    r->xfrees      = now->xfrees      - then->xfrees;
+    /* comm may have changed since the claim (pthread_setname_np) */
+    if (alive) thread_name(tid, r->name, sizeof(r->name));
+    if (!r->name[0]) memcpy(r->name, name, sizeof(r->name) - 1);
+}
+
+/* Busiest first, so the wrapper can print the head of each batch */
+static void flush_threads(HtThread *rows, int n) {
+    for (int i = 1; i < n; i++) {
+        HtThread r = rows[i];
+        int j = i;
+        for (; j > 0 && rows[j - 1].allocs + rows[j - 1].frees < r.allocs + r.frees; j--)
+            rows[j] = rows[j - 1];
+        rows[j] = r;
+    }
+    for (int i = 0; i < n; i++) {
+        HtThread *r = ring_reserve(HT_REC_THREAD, sizeof(HtThread));
+        if (r) *r = rows[i];
+    }
+}
+
+static void report_thread_stats(void) {
+    static HtThread rows[THREAD_BATCH];
+    int n = 0;
+
+    for (ThreadStats *ts = atomic_load_explicit(&stats_head, memory_order_acquire);
+         ts; ts = ts->next) {
+        uint32_t tid = atomic_load_explicit(&ts->tid, memory_order_acquire);
+        if (tid != ts->rep_tid) {
+            /* Block changed hands: close out the previous owner's share.
+               Owners in between (several handovers in one interval) are
+               folded into the last one. */
+            if (ts->prev_tid) {
+                thread_row(&rows[n++], ts->prev_tid, 0, ts->prev_name,
+                           &ts->claim, &ts->rep);
+                if (n == THREAD_BATCH) { flush_threads(rows, n); n = 0; }
+            }
+            ts->rep       = ts->claim;
+            ts->rep_tid   = tid;
+            ts->rep_alive = 1;
+        }
+        ThreadSnap now;
+        snap_read(ts, &now);
+        int alive = atomic_load_explicit(&ts->in_use, memory_order_relaxed);
+        if (now.allocs == ts->rep.allocs && now.frees == ts->rep.frees &&
+            alive == ts->rep_alive)
+            continue;
+        thread_row(&rows[n++], tid, alive, ts->name, &now, &ts->rep);
+        if (n == THREAD_BATCH) { flush_threads(rows, n); n = 0; }
+        ts->rep       = now;
+        ts->rep_alive = alive;
+    }
+    flush_threads(rows, n);
+
+    static XPair pairs[XPAIRS];
+    int np = 0;
+    while (atomic_flag_test_and_set_explicit(&xpairs_lock, memory_order_acquire))
+        ;
+    for (int i = 0; i < XPAIRS; i++)
+        if (xpairs[i].count) pairs[np++] = xpairs[i];
+    memset(xpairs, 0, sizeof(xpairs));
+    xpairs_used = 0;
+    atomic_flag_clear_explicit(&xpairs_lock, memory_order_release);
+
+    for (int i = 1; i < np; i++) {
+        XPair p = pairs[i];
+        int j = i;
+        for (; j > 0 && pairs[j - 1].count < p.count; j--) pairs[j] = pairs[j - 1];
+        pairs[j] = p;
+    }
+    for (int i = 0; i < np; i++) {
+        HtXPair *x = ring_reserve(HT_REC_XPAIR, sizeof(HtXPair));
+        if (!x) break;
+        x->alloc_tid = pairs[i].alloc_tid;
+        x->free_tid  = pairs[i].free_tid;
+        x->every     = (uint32_t)life_every;
+        x->pad       = 0;
+        x->count     = pairs[i].count;
+    }
+}
+
+/* ---- Mapping counters ------------------------------------------------- */
+/* Mapping calls are rare next to malloc, so plain shared atomics do. */
+static atomic_long map_bytes  = 0;     /* net, page-rounded */
+static atomic_long map_calls[4];       /* mmap, munmap, mremap, brk/sbrk */
+static atomic_long madv_calls = 0;
+static atomic_long madv_bytes = 0;
+static long        map_last[6];        /* reporter: counts last reported */
+static int         report_mem = 0;     /* send HtMem records */
+
+enum { MAP_MMAP, MAP_MUNMAP, MAP_MREMAP, MAP_BRK };
+
+static inline long page_round(size_t len) {
+    long pg = 4096;
+    return (long)((len + (size_t)pg - 1) & ~(size_t)(pg - 1));
+}
+
+static inline void count_map(int call, long delta) {
+    atomic_fetch_add_explicit(&map_calls[call], 1, memory_order_relaxed);
+    if (delta) atomic_fetch_add_explicit(&map_bytes, delta, memory_order_relaxed);
+}
+
+static void report_mappings(void) {
+    HtMem *m = ring_reserve(HT_REC_MEM, sizeof(HtMem));
+    if (!m) return;
+#if defined(__GLIBC__) && __GLIBC_PREREQ(2, 33)
+    struct mallinfo2 mi = mallinfo2();
+#else
+    struct mallinfo mi = mallinfo();
+#endif
+    m->heap_arena = (int64_t)mi.arena;
+    m->heap_mmap  = (int64_t)mi.hblkhd;
+    m->heap_free  = (int64_t)mi.fordblks;
+    m->heap_top   = (int64_t)mi.keepcost;
+    m->app_mapped = atomic_load_explicit(&map_bytes, memory_order_relaxed);
+
+    long now[6];
+    for (int i = 0; i < 4; i++)
+        now[i] = atomic_load_explicit(&map_calls[i], memory_order_relaxed);
+    now[4] = atomic_load_explicit(&madv_calls, memory_order_relaxed);
+    now[5] = atomic_load_explicit(&madv_bytes, memory_order_relaxed);
+    m->mmaps      = now[MAP_MMAP]   - map_last[MAP_MMAP];
+    m->munmaps    = now[MAP_MUNMAP] - map_last[MAP_MUNMAP];
+    m->mremaps    = now[MAP_MREMAP] - map_last[MAP_MREMAP];
+    m->brks       = now[MAP_BRK]    - map_last[MAP_BRK];
+    m->madvises   = now[4] - map_last[4];
+    m->madv_bytes = now[5] - map_last[5];
+    memcpy(map_last, now, sizeof(map_last));
+}
+
 /* ---- Reporter thread ---------------------------------------------------- */
-static void *reporter(void *arg) {
-    (void)arg;
+static long     interval_ms = 1000;
+static uint64_t last_report_ns;
+static Totals   last_totals;
+static int      report_hist = 0;       /* send HtHist records */
 
-    const char *fifo = getenv("HEAPTRACK_FIFO");
-    if (!fifo) return NULL;
+/* Append one interval's records and wake the wrapper */
+static void report(void) {
+    pthread_mutex_lock(&report_lock);
+    Totals now;
+    sum_stats(&now);
+    uint64_t t = mono_ns();
 
-    int fd = -1;
-    /* Retry open for a few seconds while the reader (heaptrack) starts */
-    for (int tries = 0; tries < 10 && fd < 0; tries++) {
-        fd = open(fifo, O_WRONLY);
-        if (fd < 0) sleep(1);
+    HtInterval *iv = ring_reserve(HT_REC_INTERVAL, sizeof(HtInterval));
+    if (iv) {
+        iv->ts_ns       = t;
+        iv->interval_ns = t - last_report_ns;
+        iv->allocs      = now.allocs      - last_totals.allocs;
+        iv->frees       = now.frees       - last_totals.frees;
+        iv->alloc_bytes = now.alloc_bytes - last_totals.alloc_bytes;
+        iv->free_bytes  = now.free_bytes  - last_totals.free_bytes;
+        iv->live_bytes  = now.alloc_bytes - now.free_bytes;
+        iv->threads     = now.threads;
     }
-    if (fd < 0) return NULL;
 
-    char msg[128];
-    while (1) {
-        sleep(1);
-        long allocs = atomic_exchange(&ps_allocs, 0);
-        long frees  = atomic_exchange(&ps_frees,  0);
-        long abytes = atomic_exchange(&ps_bytes,  0);
-        long live   = atomic_load(&live_bytes);
+    HtHist *hh = report_hist ? ring_reserve(HT_REC_HIST, sizeof(HtHist)) : NULL;
+    if (hh) {
+        for (int c = 0; c < HT_NCLASSES; c++)
+            hh->sizes[c] = now.size_hist[c] - last_totals.size_hist[c];
+        for (int g = 0; g < HT_NGROUPS; g++)
+            for (int b = 0; b < HT_NLIFE; b++)
+                hh->life[g][b] = now.life_hist[g][b] - last_totals.life_hist[g][b];
+    }
 
-        int len = snprintf(msg, sizeof(msg),
-                           "%ld %ld %ld %ld\n",
-                           allocs, frees, abytes, live);
-        if (len > 0) {
-            ssize_t w = write(fd, msg, len);
-            (void)w;
+    HtLat *hl = lat_every ? ring_reserve(HT_REC_LAT, sizeof(HtLat)) : NULL;
+    if (hl) {
+        hl->every   = (uint32_t)lat_every;
+        hl->slow_ns = (uint32_t)lat_slow_ns;
+        lat_take_max(hl->max_ns);
+        for (int o = 0; o < HT_NLATOPS; o++) {
+            for (int b = 0; b < HT_NLAT; b++)
+                hl->hist[o][b] = now.lat_hist[o][b] - last_totals.lat_hist[o][b];
+            for (int c = 0; c < HT_NCLASSES; c++)
+                hl->slow[o][c] = now.lat_slow[o][c] - last_totals.lat_slow[o][c];
         }
     }
+    last_totals    = now;
+    last_report_ns = t;
+
+    if (stacks) report_sites();
+    if (report_threads) report_thread_stats();
+    if (report_mem)     report_mappings();
+
+    if (leak_mode) {
+        uint32_t req = atomic_load_explicit(&ring->hdr.dump_req, memory_order_acquire);
+        if (atomic_exchange(&leak_signal, 0)) report_leaks(HT_DUMP_SIGNAL);
+        if (req != leak_req_seen) {
+            leak_req_seen = req;
+            report_leaks(HT_DUMP_REQUEST);
+        }
+    }
+    ring_commit();
+    pthread_mutex_unlock(&report_lock);
+}
+
+static void *reporter(void *arg) {
+    (void)arg;
+
+    /* Absolute deadlines so the interval does not drift by the time spent
+       reporting. */
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (1) {
+        next.tv_nsec += (interval_ms % 1000) * 1000000L;
+        next.tv_sec  += interval_ms / 1000 + next.tv_nsec / 1000000000L;
+        next.tv_nsec %= 1000000000L;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL))
+            ;
+        report();
+    }
     return NULL;
 }
 
@@ -88,8 +1374,99 @@ static void lib_init(void) {
     real_calloc  = dlsym(RTLD_NEXT, "calloc");
     real_realloc = dlsym(RTLD_NEXT, "realloc");
     real_free    = dlsym(RTLD_NEXT, "free");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    real_aligned_alloc  = dlsym(RTLD_NEXT, "aligned_alloc");
+    real_memalign       = dlsym(RTLD_NEXT, "memalign");
+    real_valloc         = dlsym(RTLD_NEXT, "valloc");
+    real_pvalloc        = dlsym(RTLD_NEXT, "pvalloc");
+    real_usable_size    = dlsym(RTLD_NEXT, "malloc_usable_size");
+    real_mmap           = dlsym(RTLD_NEXT, "mmap");
+    real_munmap         = dlsym(RTLD_NEXT, "munmap");
+    real_mremap         = dlsym(RTLD_NEXT, "mremap");
+    real_madvise        = dlsym(RTLD_NEXT, "madvise");
+    real_brk            = dlsym(RTLD_NEXT, "brk");
+    real_sbrk           = dlsym(RTLD_NEXT, "sbrk");
     bootstrapping = 0;
 
+    stats_key_ok = pthread_key_create(&stats_key, stats_release) == 0;
+
+    const char *s = getenv("HEAPTRACK_SAMPLE");
+    if (s && atol(s) > 0) {
+        const char *n = getenv("HEAPTRACK_TOPN");
+        if (n && atoi(n) > 0) top_n = atoi(n);
+        dl_iterate_phdr(find_self, (void *)(uintptr_t)&lib_init);
+        stacks = shim_map(MAX_STACKS * sizeof(StackEntry));
+        if (stacks == MAP_FAILED) {
+            stacks = NULL;
+        } else {
+            /* backtrace() dlopens libgcc_s on first use; do that now, with
+               the allocator hooks bypassed, rather than inside malloc. */
+            void *prime[4];
+            tls_in_hook = 1;
+            backtrace(prime, 4);
+            tls_in_hook = 0;
+            sample_mean = atol(s);
+        }
+    }
+
+    const char *rec = getenv("HEAPTRACK_RECORD");
+    if (rec && *rec) trace_open(rec);
+
+    if (ring_attach() < 0) return;
+
+    const char *iv = getenv("HEAPTRACK_INTERVAL_MS");
+    if (iv && atol(iv) > 0) interval_ms = atol(iv);
+    ring->hdr.interval_ms = (uint32_t)interval_ms;
+
+    const char *h = getenv("HEAPTRACK_HIST");
+    const char *l = getenv("HEAPTRACK_LEAK");
+    long leak_max = l ? atol(l) : 0;
+    if (leak_max > 0 && stacks) {
+        live_capacity = leak_max;
+    } else {
+        leak_max = 0;
+    }
+    if (h && atoi(h) > 0) report_hist = 1;
+    const char *th = getenv("HEAPTRACK_THREADS");
+    if (th && atoi(th) > 0) report_threads = 1;
+    if ((report_hist || report_threads) && live_capacity < LIVE_DEFAULT)
+        live_capacity = LIVE_DEFAULT;
+    if (live_capacity && live_init(live_capacity) == 0) {
+        if (report_hist || report_threads) {
+            long every = 256;
+            const char *e = getenv("HEAPTRACK_LIFETIME_EVERY");
+            if (e && atol(e) > 0) every = atol(e);
+            clock_init();
+            life_every = every;
+        }
+        if (leak_max) {
+            leak_mode = 1;
+            /* SIGUSR2 asks for a leak report, unless the program owns it */
+            struct sigaction old;
+            if (sigaction(SIGUSR2, NULL, &old) == 0 && old.sa_handler == SIG_DFL) {
+                struct sigaction sa;
+                memset(&sa, 0, sizeof(sa));
+                sa.sa_handler = on_sigusr2;
+                sa.sa_flags   = SA_RESTART;
+                sigemptyset(&sa.sa_mask);
+                sigaction(SIGUSR2, &sa, NULL);
+            }
+        }
+    }
+    const char *mm = getenv("HEAPTRACK_MAPS");
+    if (mm && atoi(mm) > 0) report_mem = 1;
+
+    const char *lt = getenv("HEAPTRACK_LATENCY");
+    if (lt && atol(lt) > 0) {
+        const char *sl = getenv("HEAPTRACK_LAT_SLOW_NS");
+        if (sl && atol(sl) > 0) lat_slow_ns = (uint64_t)atol(sl);
+        clock_init();
+        lat_every = atol(lt);
+    }
+
+    last_report_ns = mono_ns();
+    sum_stats(&last_totals);
+
     pthread_t tid;
     pthread_attr_t attr;
     pthread_attr_init(&attr);
@@ -98,85 +1475,179 @@ static void lib_init(void) {
     pthread_attr_destroy(&attr);
 }
 
-/* ---- Intercepted allocators -------------------------------------------- */
+/* Flush every thread's events, then the sampled stacks and their names */
+static void trace_finish(void) {
+    for (ThreadStats *ts = atomic_load(&stats_head); ts; ts = ts->next)
+        if (ts->trace) trace_flush(ts->trace);
+    if (!stacks) return;
 
-void *malloc(size_t size) {
-    if (bootstrapping || !real_malloc) {
-        /* Serve from bootstrap buffer (alignment to HDR) */
-        size_t aligned = (size + HDR - 1) & ~(size_t)(HDR - 1);
-        if (bootstrap_pos + aligned > BOOTSTRAP_SIZE) return NULL;
-        void *p = bootstrap_buf + bootstrap_pos;
-        bootstrap_pos += aligned;
-        return p;
+    static unsigned char buf[TRACE_BUF];
+    HtTraceBlock hdr = { .type = HT_TBLK_STACKS };
+    size_t len = 0;
+    for (unsigned i = 0; i < MAX_STACKS; i++) {
+        StackEntry *e = &stacks[i];
+        if (!e->hash) continue;
+        size_t need = 8 + (size_t)e->depth * 8;
+        if (len + need > sizeof(buf)) {
+            hdr.len = (uint32_t)len;
+            trace_write(&hdr, sizeof(hdr), buf, len);
+            len = 0;
+        }
+        uint32_t id = i + 1, depth = (uint32_t)e->depth;
+        memcpy(buf + len, &id, 4);
+        memcpy(buf + len + 4, &depth, 4);
+        for (int d = 0; d < e->depth; d++) {
+            uint64_t pc = (uint64_t)(uintptr_t)e->frames[d];
+            memcpy(buf + len + 8 + (size_t)d * 8, &pc, 8);
+        }
+        len += need;
+    }
+    if (len) {
+        hdr.len = (uint32_t)len;
+        trace_write(&hdr, sizeof(hdr), buf, len);
     }
 
-    void *raw = real_malloc(size + HDR);
-    if (!raw) return NULL;
-    *(size_t *)raw = size;
-
-    atomic_fetch_add(&ps_allocs, 1);
-    atomic_fetch_add(&ps_bytes,  (long)size);
-    atomic_fetch_add(&live_bytes, (long)size);
+    /* Names for each distinct frame, deduplicated through a set with room
+       for every frame the table can hold, so probing always ends. Mapped
+       only here rather than kept in every traced process's bss. */
+    enum { SEEN_SLOTS = 2 * MAX_STACKS * MAX_DEPTH };
+    uintptr_t *seen = shim_map(SEEN_SLOTS * sizeof(uintptr_t));
+    if (seen == MAP_FAILED) seen = NULL;   /* names repeat, still readable */
+    char sym[SYM_LEN];
+    hdr.type = HT_TBLK_SYMS;
+    len = 0;
+    for (unsigned i = 0; i < MAX_STACKS; i++) {
+        StackEntry *e = &stacks[i];
+        if (!e->hash) continue;
+        for (int d = 0; d < e->depth; d++) {
+            uintptr_t pc = (uintptr_t)e->frames[d];
+            if (seen) {
+                unsigned k = (unsigned)(ptr_hash(pc) >> 40) & (SEEN_SLOTS - 1);
+                while (seen[k] && seen[k] != pc) k = (k + 1) & (SEEN_SLOTS - 1);
+                if (seen[k] == pc) continue;
+                seen[k] = pc;
+            }
 
-    return (char *)raw + HDR;
+            symbolize(e->frames[d], sym, sizeof(sym));
+            uint16_t n = (uint16_t)strlen(sym);
+            if (len + 10 + n > sizeof(buf)) {
+                hdr.len = (uint32_t)len;
+                trace_write(&hdr, sizeof(hdr), buf, len);
+                len = 0;
+            }
+            uint64_t pc64 = pc;
+            memcpy(buf + len, &pc64, 8);
+            memcpy(buf + len + 8, &n, 2);
+            memcpy(buf + len + 10, sym, n);
+            len += 10 + (size_t)n;
+        }
+    }
+    if (len) {
+        hdr.len = (uint32_t)len;
+        trace_write(&hdr, sizeof(hdr), buf, len);
+    }
+    if (seen) shim_unmap(seen, SEEN_SLOTS * sizeof(uintptr_t));
 }
 
-void *calloc(size_t nmemb, size_t size) {
-    size_t total = nmemb * size;
+/* ---- Library destructor ------------------------------------------------- */
+__attribute__((destructor))
+static void lib_fini(void) {
+    /* Flush the partial last interval so short runs still report */
+    tls_in_hook = 1;
+    if (trace_fd >= 0) {
+        trace_finish();
+        close(trace_fd);
+        trace_fd = -1;
+    }
+    if (ring) {
+        report();
+        if (leak_mode) {
+            pthread_mutex_lock(&report_lock);
+            report_leaks(HT_DUMP_EXIT);
+            ring_commit();
+            pthread_mutex_unlock(&report_lock);
+        }
+    }
+
+    const char *path = getenv("HEAPTRACK_FOLDED");
+    if (!stacks || !path || !*path) return;
 
-    if (bootstrapping || !real_calloc) {
-        /* Serve from bootstrap buffer; it is zero-initialized (static storage) */
-        size_t aligned = (total + HDR - 1) & ~(size_t)(HDR - 1);
-        if (bootstrap_pos + aligned > BOOTSTRAP_SIZE) return NULL;
-        void *p = bootstrap_buf + bootstrap_pos;
-        bootstrap_pos += aligned;
-        return p;  /* already zeroed */
+    /* Forked children inherit the environment; keep their profiles apart */
+    char buf[4096];
+    const char *owner = getenv("HEAPTRACK_PID");
+    if (owner && atoi(owner) != (int)getpid()) {
+        snprintf(buf, sizeof(buf), "%s.%d", path, (int)getpid());
+        path = buf;
     }
+    dump_folded(path);
+}
+
+/* ---- Intercepted allocators -------------------------------------------- */
+/* Every glibc allocation entry point is forwarded to its native version,
+   so calloc keeps the kernel's zero pages and realloc can grow in place. */
+
+static inline int hooks_ready(void) {
+    return !bootstrapping && real_malloc && real_usable_size;
+}
 
-    /* calloc for our (size+HDR) request, zero the header only */
-    void *raw = real_malloc(total + HDR);
-    if (!raw) return NULL;
-    memset(raw, 0, total + HDR);
-    *(size_t *)raw = total;
+void *malloc(size_t size) {
+    if (!hooks_ready()) return bootstrap_alloc(size);
+
+    uint64_t t0 = lat_start();
+    void *p = real_malloc(size);
+    if (t0) lat_end(HT_LAT_ALLOC, t0, size);
+    if (p) count_alloc(p, size);
+    return p;
+}
 
-    atomic_fetch_add(&ps_allocs, 1);
-    atomic_fetch_add(&ps_bytes,  (long)total);
-    atomic_fetch_add(&live_bytes, (long)total);
+void *calloc(size_t nmemb, size_t size) {
+    if (!hooks_ready() || !real_calloc) {
+        size_t total;
+        if (__builtin_mul_overflow(nmemb, size, &total)) return NULL;
+        return bootstrap_alloc(total);
+    }
 
-    return (char *)raw + HDR;
+    uint64_t t0 = lat_start();
+    void *p = real_calloc(nmemb, size);
+    if (t0) lat_end(HT_LAT_ALLOC, t0, nmemb * size);
+    if (p) count_alloc(p, nmemb * size);
+    return p;
 }
 
 void *realloc(void *ptr, size_t size) {
-    if (!ptr)   return malloc(size);
-    if (!size)  { free(ptr); return NULL; }
+    if (!ptr)  return malloc(size);
+    if (!size) { free(ptr); return NULL; }
 
     if (is_bootstrap(ptr)) {
         /* We can't realloc bootstrap memory; allocate fresh and copy */
         void *np = malloc(size);
         if (!np) return NULL;
-        memcpy(np, ptr, size);  /* conservative: copy at most 'size' bytes */
+        size_t old = bootstrap_size(ptr);
+        memcpy(np, ptr, old < size ? old : size);
         return np;
     }
 
     if (!real_realloc) return NULL;
 
-    void  *raw      = (char *)ptr - HDR;
-    size_t old_size = *(size_t *)raw;
-
-    void *new_raw = real_realloc(raw, size + HDR);
-    if (!new_raw) return NULL;
-    *(size_t *)new_raw = size;
+    /* Accounted as a free of the old block plus an allocation of the new.
+       The free is counted up front (see count_free); a failed realloc,
+       which leaves the old block live, is rare enough to ignore. */
+    count_free(ptr, real_usable_size(ptr));
+    uint64_t t0 = lat_start();
+    void *np = real_realloc(ptr, size);
+    if (t0) lat_end(HT_LAT_ALLOC, t0, size);
+    if (!np) return NULL;
+    count_alloc(np, size);
+    return np;
+}
 
-    long delta = (long)size - (long)old_size;
-    atomic_fetch_add(&live_bytes, delta);
-    if (delta > 0) {
-        atomic_fetch_add(&ps_allocs, 1);
-        atomic_fetch_add(&ps_bytes,  delta);
-    } else {
-        atomic_fetch_add(&ps_frees, 1);
+void *reallocarray(void *ptr, size_t nmemb, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        errno = ENOMEM;
+        return NULL;
     }
-
-    return (char *)new_raw + HDR;
+    return realloc(ptr, total);
 }
 
 void free(void *ptr) {
@@ -184,11 +1655,134 @@ void free(void *ptr) {
     if (is_bootstrap(ptr)) return;  /* bootstrap memory is never freed */
     if (!real_free) return;
 
-    void  *raw  = (char *)ptr - HDR;
-    size_t size = *(size_t *)raw;
+    size_t usable = real_usable_size(ptr);
+    count_free(ptr, usable);
+    uint64_t t0 = lat_start();
+    real_free(ptr);
+    if (t0) lat_end(HT_LAT_FREE, t0, usable);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (!hooks_ready() || !real_posix_memalign) return ENOMEM;
 
-    atomic_fetch_add(&ps_frees,   1);
-    atomic_fetch_sub(&live_bytes, (long)size);
+    uint64_t t0 = lat_start();
+    int rc = real_posix_memalign(memptr, alignment, size);
+    if (t0) lat_end(HT_LAT_ALLOC, t0, size);
+    if (rc == 0 && *memptr) count_alloc(*memptr, size);
+    return rc;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    if (!hooks_ready() || !real_aligned_alloc) return NULL;
+
+    uint64_t t0 = lat_start();
+    void *p = real_aligned_alloc(alignment, size);
+    if (t0) lat_end(HT_LAT_ALLOC, t0, size);
+    if (p) count_alloc(p, size);
+    return p;
+}
+
+void *memalign(size_t alignment, size_t size) {
+    if (!hooks_ready() || !real_memalign) return NULL;
+
+    uint64_t t0 = lat_start();
+    void *p = real_memalign(alignment, size);
+    if (t0) lat_end(HT_LAT_ALLOC, t0, size);
+    if (p) count_alloc(p, size);
+    return p;
+}
+
+void *valloc(size_t size) {
+    if (!hooks_ready() || !real_valloc) return NULL;
+
+    uint64_t t0 = lat_start();
+    void *p = real_valloc(size);
+    if (t0) lat_end(HT_LAT_ALLOC, t0, size);
+    if (p) count_alloc(p, size);
+    return p;
+}
+
+void *pvalloc(size_t size) {
+    if (!hooks_ready() || !real_pvalloc) return NULL;
+
+    uint64_t t0 = lat_start();
+    void *p = real_pvalloc(size);
+    if (t0) lat_end(HT_LAT_ALLOC, t0, size);
+    if (p) count_alloc(p, size);
+    return p;
+}
+
+size_t malloc_usable_size(void *ptr) {
+    if (!ptr) return 0;
+    if (is_bootstrap(ptr)) return bootstrap_size(ptr);
+    return real_usable_size ? real_usable_size(ptr) : 0;
+}
+
+/* ---- Intercepted mapping calls ------------------------------------------ */
+/* These see the target's own mapping calls and those of allocators linked
+   into it (jemalloc, custom arenas). glibc's malloc goes through internal
+   aliases and is covered by mallinfo2() instead. Until lib_init resolves
+   the real functions, calls go straight to the kernel. */
+
+void *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off) {
+    void *p = real_mmap ? real_mmap(addr, len, prot, flags, fd, off)
+                        : (void *)syscall(SYS_mmap, addr, len, prot, flags, fd, off);
+    if (p != MAP_FAILED) count_map(MAP_MMAP, page_round(len));
+    return p;
+}
+
+void *mmap64(void *addr, size_t len, int prot, int flags, int fd, off64_t off) {
+    return mmap(addr, len, prot, flags, fd, (off_t)off);
+}
+
+int munmap(void *addr, size_t len) {
+    int rc = real_munmap ? real_munmap(addr, len)
+                         : (int)syscall(SYS_munmap, addr, len);
+    if (rc == 0) count_map(MAP_MUNMAP, -page_round(len));
+    return rc;
+}
+
+void *mremap(void *old, size_t old_len, size_t new_len, int flags, ...) {
+    void *new_addr = NULL;
+    if (flags & MREMAP_FIXED) {
+        va_list ap;
+        va_start(ap, flags);
+        new_addr = va_arg(ap, void *);
+        va_end(ap);
+    }
+    void *p = real_mremap ? real_mremap(old, old_len, new_len, flags, new_addr)
+                          : (void *)syscall(SYS_mremap, old, old_len, new_len,
+                                            flags, new_addr);
+    if (p != MAP_FAILED)
+        count_map(MAP_MREMAP, page_round(new_len) - page_round(old_len));
+    return p;
+}
+
+int madvise(void *addr, size_t len, int advice) {
+    int rc = real_madvise ? real_madvise(addr, len, advice)
+                          : (int)syscall(SYS_madvise, addr, len, advice);
+    if (rc == 0 && (advice == MADV_DONTNEED || advice == MADV_FREE)) {
+        atomic_fetch_add_explicit(&madv_calls, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&madv_bytes, page_round(len), memory_order_relaxed);
+    }
+    return rc;
+}
+
+/* brk and sbrk keep glibc's cached break, so they always go through libc */
+int brk(void *addr) {
+    if (!real_brk) real_brk = dlsym(RTLD_NEXT, "brk");
+    if (!real_sbrk) real_sbrk = dlsym(RTLD_NEXT, "sbrk");
+    if (!real_brk || !real_sbrk) { errno = ENOMEM; return -1; }
+    char *old = real_sbrk(0);
+    int rc = real_brk(addr);
+    if (rc == 0) count_map(MAP_BRK, (long)((char *)addr - old));
+    return rc;
+}
 
-    real_free(raw);
+void *sbrk(intptr_t inc) {
+    if (!real_sbrk) real_sbrk = dlsym(RTLD_NEXT, "sbrk");
+    if (!real_sbrk) { errno = ENOMEM; return (void *)-1; }
+    void *p = real_sbrk(inc);
+    if (p != (void *)-1 && inc) count_map(MAP_BRK, (long)inc);
+    return p;
 }
@@ -0,0 +1,511 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <time.h>
+#include <stdint.h>
+
+#define LABEL_LEN  16
+#define NAME_LEN   32
+#define MAX_GLOBS  16
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* ---- Wide tables -------------------------------------------------------- */
+/* /proc/interrupts and /proc/softirqs share a layout: a header naming one
+   column per online CPU ("CPU0 CPU2 ..." when CPU1 is offline), then one
+   row per source, "label:" followed by a count per column and, in
+   interrupts, the chip and handler names. At 256 CPUs and a few hundred
+   queue IRQs that is megabytes of text per tick, so the file is read into
+   a buffer kept across ticks (one pread per 64 KB or more, no stdio) and
+   the numbers are parsed with a plain digit loop, without strtoull or
+   sscanf per field. Rows shorter than the header (ERR, MIS) read as zero
+   past their last count. The text must be followed by a NUL, which ends
+   the digit loop without bounds checks. The buffer is not otherwise
+   modified: descriptions point into it and stay valid until the next
+   read. */
+typedef struct {
+    const char  *path;
+    int          fd;
+    char        *buf;
+    size_t       cap, len;
+    int          ncol, col_cap;
+    int         *cpu;                  /* column -> CPU number */
+    size_t       nrows, row_cap;
+    char       (*label)[LABEL_LEN];
+    const char **desc;                 /* rest of the row, not terminated */
+    int         *desc_len;
+    uint64_t    *count;                /* nrows x ncol, row-major */
+} WideTable;
+
+static void *grow(void *p, size_t n, size_t size) {
+    p = realloc(p, n * size);
+    if (!p) { perror("realloc"); exit(EXIT_FAILURE); }
+    return p;
+}
+
+static int wt_parse(WideTable *t) {
+    const char *p = t->buf, *end = t->buf + t->len;
+
+    t->ncol = 0;
+    while (p < end && *p != '\n') {
+        if (p + 3 < end && p[0] == 'C' && p[1] == 'P' && p[2] == 'U') {
+            int c = 0;
+            for (p += 3; p < end && *p >= '0' && *p <= '9'; p++) c = c * 10 + (*p - '0');
+            if (t->ncol == t->col_cap) {
+                t->col_cap = t->col_cap ? t->col_cap * 2 : 64;
+                t->cpu = grow(t->cpu, (size_t)t->col_cap, sizeof(*t->cpu));
+            }
+            t->cpu[t->ncol++] = c;
+        } else {
+            p++;
+        }
+    }
+    if (t->ncol == 0) { errno = EINVAL; return -1; }
+
+    size_t ncol = (size_t)t->ncol;
+    t->nrows = 0;
+    while (p < end) {
+        p++;                           /* the previous row's newline */
+        while (p < end && *p == ' ') p++;
+        const char *lab = p;
+        while (p < end && *p != ':' && *p != '\n') p++;
+        if (p == end) break;
+        if (*p != ':') continue;
+
+        if (t->nrows == t->row_cap) {
+            t->row_cap  = t->row_cap ? t->row_cap * 2 : 256;
+            t->label    = grow(t->label, t->row_cap, sizeof(*t->label));
+            t->desc     = grow(t->desc, t->row_cap, sizeof(*t->desc));
+            t->desc_len = grow(t->desc_len, t->row_cap, sizeof(*t->desc_len));
+            t->count    = grow(t->count, t->row_cap * ncol, sizeof(*t->count));
+        }
+        size_t r = t->nrows++;
+        size_t llen = (size_t)(p - lab) < LABEL_LEN - 1 ? (size_t)(p - lab) : LABEL_LEN - 1;
+        memcpy(t->label[r], lab, llen);
+        t->label[r][llen] = '\0';
+
+        /* the hot loop: the NUL after the text stops it, so no bounds checks */
+        uint64_t *c = &t->count[r * ncol];
+        size_t col = 0;
+        for (p++; col < ncol; col++) {
+            while (*p == ' ') p++;
+            unsigned d = (unsigned)(*p - '0');
+            if (d > 9) break;
+            uint64_t v = 0;
+            do { v = v * 10 + d; d = (unsigned)(*++p - '0'); } while (d <= 9);
+            c[col] = v;
+        }
+        for (; col < ncol; col++) c[col] = 0;
+
+        while (p < end && *p == ' ') p++;
+        t->desc[r] = p;
+        while (p < end && *p != '\n') p++;
+        t->desc_len[r] = (int)(p - t->desc[r]);
+    }
+    return 0;
+}
+
+static int wt_read(WideTable *t) {
+    if (t->fd < 0 && (t->fd = open(t->path, O_RDONLY | O_CLOEXEC)) < 0) return -1;
+    t->len = 0;
+    for (;;) {
+        if (t->cap - t->len < 4096) {
+            t->cap = t->cap ? t->cap * 2 : 65536;
+            t->buf = grow(t->buf, t->cap, 1);
+        }
+        ssize_t n = pread(t->fd, t->buf + t->len, t->cap - t->len - 1, (off_t)t->len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) break;
+        t->len += (size_t)n;
+    }
+    t->buf[t->len] = '\0';                /* wt_parse() relies on it */
+    return wt_parse(t);
+}
+
+static const uint64_t *wt_row(const WideTable *t, size_t r) {
+    return &t->count[r * (size_t)t->ncol];
+}
+
+static int wt_find(const WideTable *t, const char *label) {
+    for (size_t r = 0; r < t->nrows; r++)
+        if (strcmp(t->label[r], label) == 0) return (int)r;
+    return -1;
+}
+
+/* Row r of curr in prev: the same index unless an IRQ came or went */
+static int wt_match(const WideTable *prev, const WideTable *curr, size_t r) {
+    if (r < prev->nrows && strcmp(prev->label[r], curr->label[r]) == 0) return (int)r;
+    return wt_find(prev, curr->label[r]);
+}
+
+/* Deltas are only taken between reads with the same CPU columns; a CPU
+   going on- or offline costs one tick of rates */
+static int wt_same_cols(const WideTable *a, const WideTable *b) {
+    return a->ncol == b->ncol &&
+           memcmp(a->cpu, b->cpu, (size_t)a->ncol * sizeof(*a->cpu)) == 0;
+}
+
+/* Per-CPU counts are 32-bit in the kernel and wrap */
+static double delta(uint64_t now, uint64_t before) {
+    return (double)(uint32_t)(now - before);
+}
+
+/* ---- Network IRQ selection ---------------------------------------------- */
+/* A numbered row's description ends with its handler names, e.g.
+   "IR-PCI-MSIX-0000:3b:00.0  5-edge  eth0-TxRx-4". By default the
+   handler is matched against the queue naming of common drivers; -g
+   replaces that list. */
+static const char *const default_globs[] = {
+    "*-TxRx-*", "*-rx*", "*-tx*", "*-input.*", "*-output.*",
+    "mlx5_comp*", "*ena-io-*", "*-fp-*", "*-queue-*",
+};
+
+static const char *globs[MAX_GLOBS];
+static int nglobs;
+
+static void irq_name(const WideTable *t, size_t r, char *out, size_t size) {
+    const char *d = t->desc[r];
+    int len = t->desc_len[r];
+    while (len > 0 && d[len - 1] == ' ') len--;
+    int start = len;
+    while (start > 0 && d[start - 1] != ' ') start--;
+    int n = len - start < (int)size - 1 ? len - start : (int)size - 1;
+    memcpy(out, d + start, (size_t)n);
+    out[n] = '\0';
+}
+
+static int irq_selected(const WideTable *t, size_t r, int all) {
+    const char *l = t->label[r];
+    if (l[0] < '0' || l[0] > '9') return 0;        /* NMI, LOC, ... */
+    if (all) return 1;
+    char name[NAME_LEN];
+    irq_name(t, r, name, sizeof(name));
+    if (nglobs) {
+        for (int i = 0; i < nglobs; i++)
+            if (fnmatch(globs[i], name, 0) == 0) return 1;
+        return 0;
+    }
+    for (size_t i = 0; i < sizeof(default_globs) / sizeof(default_globs[0]); i++)
+        if (fnmatch(default_globs[i], name, 0) == 0) return 1;
+    return 0;
+}
+
+/* ---- Imbalance ---------------------------------------------------------- */
+/* How many CPUs the work is really spread over: (sum x)^2 / sum x^2, the
+   inverse Simpson index. n CPUs doing equal shares give n, one CPU doing
+   everything gives 1, and two busy CPUs with the other 62 idle give 2.
+   The imbalance score is 1 - effective / online CPUs: 0 when spread
+   evenly over every CPU, approaching 1 when pinned on one. */
+typedef struct {
+    double total, effective, top_share, score;
+} Spread;
+
+static Spread spread(const double *v, int n) {
+    Spread s = {0};
+    double sq = 0, max = 0;
+    for (int i = 0; i < n; i++) {
+        s.total += v[i];
+        sq += v[i] * v[i];
+        if (v[i] > max) max = v[i];
+    }
+    if (s.total <= 0) return s;
+    s.effective = s.total * s.total / sq;
+    s.top_share = max / s.total;
+    s.score     = 1.0 - s.effective / n;
+    return s;
+}
+
+/* ---- Display ------------------------------------------------------------ */
+typedef struct {
+    int    cpu;
+    double rx, tx, irq;
+} CpuRow;
+
+typedef struct {
+    size_t row;
+    double rate;
+    int    cpus, top_cpu;
+    double top_share;
+} IrqRow;
+
+static int cmp_cpu(const void *a, const void *b) {
+    const CpuRow *x = a, *y = b;
+    double kx = x->rx + x->tx + x->irq, ky = y->rx + y->tx + y->irq;
+    if (kx != ky) return (kx < ky) - (kx > ky);
+    return x->cpu - y->cpu;
+}
+
+static int cmp_irq(const void *a, const void *b) {
+    double x = ((const IrqRow *)a)->rate, y = ((const IrqRow *)b)->rate;
+    return (x < y) - (x > y);
+}
+
+static void print_spread(const char *what, Spread s, int ncpu, int secs) {
+    if (s.total <= 0) {
+        printf("%-10s %14.1f %16s %12s %10s\n", what, 0.0, "-", "-", "-");
+        return;
+    }
+    char eff[32];
+    snprintf(eff, sizeof(eff), "%.1f of %d", s.effective, ncpu);
+    printf("%-10s %14.1f %16s %11.0f%% %10.2f\n", what, s.total / secs, eff,
+           s.top_share * 100, s.score);
+}
+
+/* ---- Benchmark (-B) ----------------------------------------------------- */
+/* Parses a synthetic /proc/interrupts of n CPUs and rows rows (16 per
+   CPU, the queue IRQs of a few multi-queue NICs) with the digit-loop
+   parser and with strtoull per field for comparison. */
+static uint64_t parse_strtoull(const char *buf, int ncol) {
+    uint64_t sum = 0;
+    for (const char *p = strchr(buf, '\n'); p && *++p; p = strchr(p, '\n')) {
+        const char *colon = strchr(p, ':');
+        if (!colon) break;
+        char *e = (char *)colon + 1;
+        for (int c = 0; c < ncol; c++) {
+            const char *s = e;
+            uint64_t v = strtoull(s, &e, 10);
+            if (e == s) break;
+            sum += v;
+        }
+        p = e;
+    }
+    return sum;
+}
+
+static volatile uint64_t bench_sink;
+
+static void bench(void) {
+    printf("%-6s %-6s %10s %14s %14s\n", "CPUs", "rows", "text KB", "digit loop", "strtoull");
+    printf("%-6s %-6s %10s %14s %14s\n", "------", "------", "----------",
+           "--------------", "--------------");
+    for (int n = 64; n <= 1024; n *= 2) {
+        int rows = n * 16;
+        size_t cap = (size_t)(rows + 1) * ((size_t)n * 11 + 64) + 1;
+        char *text = malloc(cap), *p = text;
+        if (!text) { perror("malloc"); exit(EXIT_FAILURE); }
+        p += sprintf(p, "     ");
+        for (int c = 0; c < n; c++) p += sprintf(p, " CPU%-7d", c);
+        *p++ = '\n';
+        unsigned seed = 1;
+        for (int r = 0; r < rows; r++) {
+            p += sprintf(p, "%4d:", r + 32);
+            for (int c = 0; c < n; c++) {
+                seed = seed * 1103515245u + 12345u;
+                p += sprintf(p, " %10u", seed >> 4);
+            }
+            p += sprintf(p, "  IR-PCI-MSIX-0000:3b:00.0 %d-edge eth%d-TxRx-%d\n",
+                         r, r / 64, r % 64);
+        }
+        WideTable t = { .fd = -1, .buf = text, .len = (size_t)(p - text) };
+
+        double t0, t_fast = 0, t_slow = 0;
+        int iters = 0;
+        while (t_fast < 0.5 || iters < 3) {
+            t0 = now_sec();
+            if (wt_parse(&t) < 0) { fprintf(stderr, "parse failed\n"); exit(EXIT_FAILURE); }
+            t_fast += now_sec() - t0;
+            iters++;
+        }
+        t_fast /= iters;
+        for (iters = 0; t_slow < 0.5 || iters < 3; iters++) {
+            t0 = now_sec();
+            bench_sink += parse_strtoull(text, n);
+            t_slow += now_sec() - t0;
+        }
+        t_slow /= iters;
+        if (t.nrows != (size_t)rows || t.ncol != n) {
+            fprintf(stderr, "parsed %zu x %d, want %d x %d\n", t.nrows, t.ncol, rows, n);
+            exit(EXIT_FAILURE);
+        }
+        printf("%-6d %-6d %10zu %11.2f ms %11.2f ms\n", n, rows, t.len / 1024,
+               t_fast * 1e3, t_slow * 1e3);
+        free(text); free(t.cpu); free(t.label); free(t.desc); free(t.desc_len); free(t.count);
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-n N] [-i interval] [-g glob]... [-a] [-B]\n", prog);
+    fprintf(stderr, "  -n N         busiest N CPUs and N IRQs (default: 16)\n");
+    fprintf(stderr, "  -i interval  refresh every interval seconds (default: 1)\n");
+    fprintf(stderr, "  -g glob      IRQ handler names to count as network queues, e.g. 'eth0-*'\n");
+    fprintf(stderr, "               (default: common NIC queue names)\n");
+    fprintf(stderr, "  -a           count every numbered IRQ\n");
+    fprintf(stderr, "  -B           benchmark the /proc/interrupts parser at 64-1024 CPUs\n");
+}
+
+int main(int argc, char *argv[]) {
+    int top_n    = 16;
+    int interval = 1;
+    int all      = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            top_n = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            interval = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc && nglobs < MAX_GLOBS) {
+            globs[nglobs++] = argv[++i];
+        } else if (strcmp(argv[i], "-a") == 0) {
+            all = 1;
+        } else if (strcmp(argv[i], "-B") == 0) {
+            bench();
+            return EXIT_SUCCESS;
+        } else {
+            usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+    if (top_n < 1)    top_n = 1;
+    if (interval < 1) interval = 1;
+
+    WideTable sq[2] = { { .path = "/proc/softirqs",   .fd = -1 },
+                        { .path = "/proc/softirqs",   .fd = -1 } };
+    WideTable iq[2] = { { .path = "/proc/interrupts", .fd = -1 },
+                        { .path = "/proc/interrupts", .fd = -1 } };
+    WideTable *scurr = &sq[0], *sprev = &sq[1], *icurr = &iq[0], *iprev = &iq[1];
+
+    if (wt_read(sprev) < 0) { perror("/proc/softirqs"); return EXIT_FAILURE; }
+    if (wt_read(iprev) < 0) { perror("/proc/interrupts"); return EXIT_FAILURE; }
+
+    CpuRow *cpus = NULL;
+    IrqRow *irqs = NULL;
+    double *v = NULL;
+    int    *col_of = NULL;
+    size_t  cpu_cap = 0, irq_cap = 0;
+
+    while (1) {
+        sleep(interval);
+        double t0 = now_sec();
+        if (wt_read(scurr) < 0) { perror("/proc/softirqs"); return EXIT_FAILURE; }
+        double t1 = now_sec();
+        if (wt_read(icurr) < 0) { perror("/proc/interrupts"); return EXIT_FAILURE; }
+        double t2 = now_sec();
+
+        int ncpu = scurr->ncol;
+        if ((size_t)ncpu > cpu_cap || icurr->ncol > (int)cpu_cap) {
+            cpu_cap = (size_t)(ncpu > icurr->ncol ? ncpu : icurr->ncol);
+            cpus   = grow(cpus, cpu_cap, sizeof(*cpus));
+            v      = grow(v, cpu_cap, sizeof(*v));
+            col_of = grow(col_of, cpu_cap, sizeof(*col_of));
+        }
+        if (icurr->nrows > irq_cap) {
+            irq_cap = icurr->nrows;
+            irqs = grow(irqs, irq_cap, sizeof(*irqs));
+        }
+        for (int c = 0; c < ncpu; c++)
+            cpus[c] = (CpuRow){ scurr->cpu[c], 0, 0, 0 };
+
+        int srx = wt_find(scurr, "NET_RX"), stx = wt_find(scurr, "NET_TX");
+        if (wt_same_cols(scurr, sprev)) {
+            int prx = wt_find(sprev, "NET_RX"), ptx = wt_find(sprev, "NET_TX");
+            for (int c = 0; c < ncpu; c++) {
+                if (srx >= 0 && prx >= 0)
+                    cpus[c].rx = delta(wt_row(scurr, srx)[c], wt_row(sprev, prx)[c]);
+                if (stx >= 0 && ptx >= 0)
+                    cpus[c].tx = delta(wt_row(scurr, stx)[c], wt_row(sprev, ptx)[c]);
+            }
+        }
+
+        /* interrupts has the same columns as softirqs unless a CPU changed
+           state between the two reads; map by CPU number to be safe */
+        for (int c = 0; c < icurr->ncol; c++) {
+            col_of[c] = -1;
+            if (c < ncpu && scurr->cpu[c] == icurr->cpu[c]) { col_of[c] = c; continue; }
+            for (int k = 0; k < ncpu; k++)
+                if (scurr->cpu[k] == icurr->cpu[c]) col_of[c] = k;
+        }
+        size_t nirq = 0, nsel = 0;
+        int same = wt_same_cols(icurr, iprev);
+        for (size_t r = 0; r < icurr->nrows; r++) {
+            if (!irq_selected(icurr, r, all)) continue;
+            nsel++;
+            int pr = same ? wt_match(iprev, icurr, r) : -1;
+            if (pr < 0) continue;
+            const uint64_t *now = wt_row(icurr, r), *before = wt_row(iprev, (size_t)pr);
+            IrqRow q = { r, 0, 0, -1, 0 };
+            double top = 0;
+            for (int c = 0; c < icurr->ncol; c++) {
+                double d = delta(now[c], before[c]);
+                if (d == 0) continue;
+                q.rate += d;
+                q.cpus++;
+                if (d > top) { top = d; q.top_cpu = icurr->cpu[c]; }
+                if (col_of[c] >= 0) cpus[col_of[c]].irq += d;
+            }
+            q.top_share = q.rate > 0 ? top / q.rate : 0;
+            irqs[nirq++] = q;
+        }
+        double t3 = now_sec();
+
+        printf("\033[2J\033[H");
+        printf("%-10s %14s %16s %12s %10s\n", "", "TOTAL/s", "EFFECTIVE CPUs",
+               "BUSIEST CPU", "IMBALANCE");
+        printf("%-10s %14s %16s %12s %10s\n", "----------", "--------------",
+               "----------------", "------------", "----------");
+        for (int c = 0; c < ncpu; c++) v[c] = cpus[c].rx;
+        print_spread("NET_RX", spread(v, ncpu), ncpu, interval);
+        for (int c = 0; c < ncpu; c++) v[c] = cpus[c].tx;
+        print_spread("NET_TX", spread(v, ncpu), ncpu, interval);
+        for (int c = 0; c < ncpu; c++) v[c] = cpus[c].irq;
+        print_spread("NIC IRQs", spread(v, ncpu), ncpu, interval);
+
+        qsort(cpus, (size_t)ncpu, sizeof(*cpus), cmp_cpu);
+        printf("\n%-8s %12s %12s %12s\n", "CPU", "NET_RX/s", "NET_TX/s", "NIC IRQ/s");
+        printf("%-8s %12s %12s %12s\n", "--------", "------------", "------------",
+               "------------");
+        for (int c = 0; c < ncpu && c < top_n; c++) {
+            char label[16];
+            snprintf(label, sizeof(label), "cpu%d", cpus[c].cpu);
+            printf("%-8s %12.1f %12.1f %12.1f\n", label, cpus[c].rx / interval,
+                   cpus[c].tx / interval, cpus[c].irq / interval);
+        }
+        if (ncpu > top_n) {
+            double rx = 0, tx = 0, irq = 0;
+            for (int c = top_n; c < ncpu; c++) {
+                rx += cpus[c].rx; tx += cpus[c].tx; irq += cpus[c].irq;
+            }
+            char label[16];
+            snprintf(label, sizeof(label), "%d more", ncpu - top_n);
+            printf("%-8s %12.1f %12.1f %12.1f\n", label, rx / interval, tx / interval,
+                   irq / interval);
+        }
+
+        qsort(irqs, nirq, sizeof(*irqs), cmp_irq);
+        printf("\n%-6s %-28s %12s %6s %8s %8s\n", "IRQ", "HANDLER", "/s", "CPUs",
+               "TOP CPU", "SHARE");
+        printf("%-6s %-28s %12s %6s %8s %8s\n", "------", "----------------------------",
+               "------------", "------", "--------", "--------");
+        for (size_t i = 0; i < nirq && i < (size_t)top_n && irqs[i].rate > 0; i++) {
+            const IrqRow *q = &irqs[i];
+            char name[NAME_LEN], top[16];
+            irq_name(icurr, q->row, name, sizeof(name));
+            snprintf(top, sizeof(top), "cpu%d", q->top_cpu);
+            printf("%-6s %-28s %12.1f %6d %8s %7.0f%%\n", icurr->label[q->row], name,
+                   q->rate / interval, q->cpus, top, q->top_share * 100);
+        }
+        if (nsel == 0)
+            printf("(no IRQ handler matches; try -g or -a)\n");
+        else if (nirq == 0 || irqs[0].rate == 0)
+            printf("(no network IRQ this interval)\n");
+
+        printf("\n%d CPUs, %zu network IRQs  /proc/softirqs %zu KB in %.2f ms, "
+               "/proc/interrupts %zu KB in %.2f ms, processing %.2f ms\n",
+               ncpu, nsel, scurr->len / 1024, (t1 - t0) * 1e3,
+               icurr->len / 1024, (t2 - t1) * 1e3, (t3 - t2) * 1e3);
+        fflush(stdout);
+
+        WideTable *t = scurr; scurr = sprev; sprev = t;
+        t = icurr; icurr = iprev; iprev = t;
+    }
+}
@@ -1,95 +1,434 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <fnmatch.h>
+#include <sched.h>
+#include <time.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <net/if_arp.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/if_link.h>
+#include <linux/veth.h>
+#include <linux/inet_diag.h>
+#include <linux/tcp.h>
 
-#define MAX_IFACES  32
 #define BUF_SIZE    4096
 #define IFACE_LEN   16
+#define KIND_LEN    16
 #define HDR_EVERY   20   /* reprint header every N samples */
+#define MAX_FILTERS 16
 
 typedef struct {
-    char             name[IFACE_LEN];
+    int                ifindex;
+    char               name[IFACE_LEN];
+    char               kind[KIND_LEN];  /* veth, bridge, ...; see link_kind() */
     unsigned long long rx_bytes, tx_bytes;
     unsigned long long rx_pkts,  tx_pkts;
     unsigned long long rx_errs,  tx_errs;
+    double             traffic;         /* RX+TX bytes since the last tick */
 } Iface;
 
-static Iface prev[MAX_IFACES];
-static int   prev_n = 0;
+/* One tick's interfaces; grows as needed, so there is no interface cap */
+typedef struct {
+    Iface  *v;
+    size_t  n, cap;
+} IfTable;
 
-static int read_net_dev(Iface *ifaces, int max) {
-    char buf[BUF_SIZE];
-    int fd = open("/proc/net/dev", O_RDONLY);
-    if (fd < 0) { perror("/proc/net/dev"); return -1; }
-    ssize_t n = read(fd, buf, sizeof(buf) - 1);
-    close(fd);
-    if (n <= 0) return -1;
-    buf[n] = '\0';
+static Iface *if_push(IfTable *t) {
+    if (t->n == t->cap) {
+        size_t cap = t->cap ? t->cap * 2 : 256;
+        Iface *v = realloc(t->v, cap * sizeof(*v));
+        if (!v) { perror("realloc"); exit(EXIT_FAILURE); }
+        t->v   = v;
+        t->cap = cap;
+    }
+    return &t->v[t->n++];
+}
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
 
-    int count = 0;
-    char *line = strtok(buf, "\n");
-    if (line) line = strtok(NULL, "\n"); /* skip header 1 */
-    if (line) line = strtok(NULL, "\n"); /* skip header 2 */
+/* ---- Interface index ---------------------------------------------------- */
+/* Open-addressing hash on ifindex over the previous tick, rebuilt each
+   tick: interfaces come and go between ticks (pods starting and stopping)
+   and an ifindex is not reused while the host is up, so a new interface
+   simply finds no match and starts from zero. */
+typedef struct {
+    int    *slot;                      /* table index + 1, 0 = empty */
+    size_t  mask;
+} Index;
 
-    while (line && count < max) {
-        char *colon = strchr(line, ':');
-        if (!colon) { line = strtok(NULL, "\n"); continue; }
+static void index_build(Index *ix, const IfTable *t) {
+    size_t want = 64;
+    while (want < t->n * 2) want *= 2;
+    if (want > ix->mask + 1 || !ix->slot) {
+        free(ix->slot);
+        ix->slot = malloc(want * sizeof(*ix->slot));
+        if (!ix->slot) { perror("malloc"); exit(EXIT_FAILURE); }
+        ix->mask = want - 1;
+    }
+    memset(ix->slot, 0, (ix->mask + 1) * sizeof(*ix->slot));
+    for (size_t i = 0; i < t->n; i++) {
+        size_t h = (unsigned)t->v[i].ifindex * 2654435761u & ix->mask;
+        while (ix->slot[h]) h = (h + 1) & ix->mask;
+        ix->slot[h] = (int)i + 1;
+    }
+}
 
-        char *p = line;
-        while (*p == ' ') p++;
-        int nl = (int)(colon - p);
-        if (nl >= IFACE_LEN) nl = IFACE_LEN - 1;
-        strncpy(ifaces[count].name, p, nl);
-        ifaces[count].name[nl] = '\0';
+static const Iface *index_find(const Index *ix, const IfTable *t, int ifindex) {
+    size_t h = (unsigned)ifindex * 2654435761u & ix->mask;
+    for (int s; (s = ix->slot[h]); h = (h + 1) & ix->mask)
+        if (t->v[s - 1].ifindex == ifindex) return &t->v[s - 1];
+    return NULL;
+}
+
+/* ---- Netlink (rtnetlink) ----------------------------------------------- */
+/* Counters come from an RTM_GETSTATS dump each tick, asking only for
+   IFLA_STATS_LINK_64: one binary rtnl_link_stats64 per interface, about
+   200 bytes, with no text to parse and no buffer size to outgrow (the
+   kernel sends the dump in as many datagrams as it needs). An RTM_GETLINK
+   dump also carries names and driver kinds but is over ten times bigger
+   per interface, so it is only used to label interfaces: all of them on
+   the first tick and every LINK_REFRESH ticks (renames), and just the new
+   ones, one request each, in between. */
+#define LINK_REFRESH 30
+#define LINK_GET_MAX 64                 /* more new than this: dump them all */
+
+static int  nl_sock = -1;
+static unsigned nl_seq;
+static char nl_buf[65536];
+
+static int nl_open(void) {
+    nl_sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (nl_sock < 0) return -1;
+    int one = 1;
+    setsockopt(nl_sock, SOL_NETLINK, NETLINK_GET_STRICT_CHK, &one, sizeof(one));
+    return 0;
+}
+
+/* Sends req and hands each reply message to fn until the dump (or the
+   single reply) is complete */
+static int nl_talk(struct nlmsghdr *req, void (*fn)(struct nlmsghdr *, void *), void *arg) {
+    req->nlmsg_seq = ++nl_seq;
+    if (send(nl_sock, req, req->nlmsg_len, 0) < 0) return -1;
+    for (;;) {
+        ssize_t n = recv(nl_sock, nl_buf, sizeof(nl_buf), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        int len = (int)n;
+        for (struct nlmsghdr *h = (struct nlmsghdr *)nl_buf; NLMSG_OK(h, len);
+             h = NLMSG_NEXT(h, len)) {
+            if (h->nlmsg_seq != nl_seq) continue;
+            if (h->nlmsg_type == NLMSG_DONE) return 0;
+            if (h->nlmsg_type == NLMSG_ERROR) {
+                errno = -((struct nlmsgerr *)NLMSG_DATA(h))->error;
+                return errno ? -1 : 0;
+            }
+            fn(h, arg);
+            if (!(h->nlmsg_flags & NLM_F_MULTI)) return 0;
+        }
+    }
+}
+
+static void parse_stats(struct nlmsghdr *h, void *arg) {
+    if (h->nlmsg_type != RTM_NEWSTATS) return;
+    struct if_stats_msg *m = NLMSG_DATA(h);
+    int len = (int)h->nlmsg_len - NLMSG_LENGTH(sizeof(*m));
+    struct rtattr *a = (struct rtattr *)((char *)m + NLMSG_ALIGN(sizeof(*m)));
+    for (; RTA_OK(a, len); a = RTA_NEXT(a, len)) {
+        if (a->rta_type != IFLA_STATS_LINK_64 ||
+            RTA_PAYLOAD(a) < sizeof(struct rtnl_link_stats64))
+            continue;
+        /* rtattr payloads are only 4-byte aligned; copy before reading u64s */
+        struct rtnl_link_stats64 s;
+        memcpy(&s, RTA_DATA(a), sizeof(s));
+        Iface *f = if_push(arg);
+        memset(f, 0, sizeof(*f));
+        f->ifindex  = (int)m->ifindex;
+        f->rx_bytes = s.rx_bytes;   f->tx_bytes = s.tx_bytes;
+        f->rx_pkts  = s.rx_packets; f->tx_pkts  = s.tx_packets;
+        f->rx_errs  = s.rx_errors + s.rx_dropped;
+        f->tx_errs  = s.tx_errors + s.tx_dropped;
+    }
+}
+
+static int stats_dump(IfTable *t) {
+    struct {
+        struct nlmsghdr     h;
+        struct if_stats_msg m;
+    } req = {
+        .h = { .nlmsg_len = sizeof(req), .nlmsg_type = RTM_GETSTATS,
+               .nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP },
+        .m = { .family = AF_UNSPEC,
+               .filter_mask = IFLA_STATS_FILTER_BIT(IFLA_STATS_LINK_64) },
+    };
+    t->n = 0;
+    return nl_talk(&req.h, parse_stats, t);
+}
+
+/* Type shown and filtered on: the driver kind of virtual links (veth,
+   bridge, vxlan, ...), else loopback, or phys for a real NIC */
+static void parse_link(struct nlmsghdr *h, void *arg) {
+    if (h->nlmsg_type != RTM_NEWLINK) return;
+    struct ifinfomsg *ifi = NLMSG_DATA(h);
+    int len = IFLA_PAYLOAD(h);
+    Iface *f = if_push(arg);
+    memset(f, 0, sizeof(*f));
+    f->ifindex = ifi->ifi_index;
+    snprintf(f->kind, sizeof(f->kind), "%s",
+             ifi->ifi_type == ARPHRD_LOOPBACK ? "loopback" : "phys");
+
+    for (struct rtattr *a = IFLA_RTA(ifi); RTA_OK(a, len); a = RTA_NEXT(a, len)) {
+        if (a->rta_type == IFLA_IFNAME) {
+            snprintf(f->name, sizeof(f->name), "%s", (const char *)RTA_DATA(a));
+        } else if (a->rta_type == IFLA_LINKINFO) {
+            int ilen = RTA_PAYLOAD(a);
+            for (struct rtattr *b = RTA_DATA(a); RTA_OK(b, ilen); b = RTA_NEXT(b, ilen))
+                if (b->rta_type == IFLA_INFO_KIND)
+                    snprintf(f->kind, sizeof(f->kind), "%.*s", (int)RTA_PAYLOAD(b),
+                             (const char *)RTA_DATA(b));
+        }
+    }
+}
+
+/* All interfaces (ifindex 0), or the one asked for */
+static int link_query(IfTable *t, int ifindex) {
+    struct {
+        struct nlmsghdr  h;
+        struct ifinfomsg ifi;
+        struct rtattr    ext;
+        unsigned int     mask;
+    } req = {
+        .h   = { .nlmsg_len = sizeof(req), .nlmsg_type = RTM_GETLINK,
+                 .nlmsg_flags = NLM_F_REQUEST | (ifindex ? 0 : NLM_F_DUMP) },
+        .ifi = { .ifi_family = AF_UNSPEC, .ifi_index = ifindex },
+        .ext = { .rta_len = RTA_LENGTH(sizeof(unsigned int)), .rta_type = IFLA_EXT_MASK },
+        .mask = RTEXT_FILTER_SKIP_STATS,
+    };
+    return nl_talk(&req.h, parse_link, t);
+}
+
+/* One tick: counters for every interface, labelled from the previous
+   tick where the ifindex is known; leaves ix indexing prev */
+static IfTable links;
+static Index   links_ix;
+static unsigned tick;
+
+static int collect(IfTable *curr, const IfTable *prev, Index *ix) {
+    if (stats_dump(curr) < 0) return -1;
+    index_build(ix, prev);
+    size_t unknown = 0;
+    for (size_t i = 0; i < curr->n; i++) {
+        Iface *c = &curr->v[i];
+        const Iface *p = index_find(ix, prev, c->ifindex);
+        if (p) {
+            memcpy(c->name, p->name, sizeof(c->name));
+            memcpy(c->kind, p->kind, sizeof(c->kind));
+        } else {
+            unknown++;
+        }
+    }
 
-        unsigned long long rb, rp, re, rd, rfi, rfr, rc, rm;
-        unsigned long long tb, tp, te, td, tfi, tc, tca, tco;
-        if (sscanf(colon + 1,
-            "%llu %llu %llu %llu %llu %llu %llu %llu"
-            " %llu %llu %llu %llu %llu %llu %llu %llu",
-            &rb, &rp, &re, &rd, &rfi, &rfr, &rc, &rm,
-            &tb, &tp, &te, &td, &tfi, &tc, &tca, &tco) == 16) {
-            ifaces[count].rx_bytes = rb; ifaces[count].tx_bytes = tb;
-            ifaces[count].rx_pkts  = rp; ifaces[count].tx_pkts  = tp;
-            ifaces[count].rx_errs  = re + rd;
-            ifaces[count].tx_errs  = te + td;
-            count++;
+    if (tick++ % LINK_REFRESH == 0 || unknown > LINK_GET_MAX) {
+        links.n = 0;
+        if (link_query(&links, 0) < 0) return -1;
+        unknown = curr->n;             /* relabel everything */
+    } else if (unknown) {
+        links.n = 0;
+        for (size_t i = 0; i < curr->n; i++)
+            if (!curr->v[i].name[0]) link_query(&links, curr->v[i].ifindex);
+    }
+    if (unknown) {
+        index_build(&links_ix, &links);
+        for (size_t i = 0; i < curr->n; i++) {
+            Iface *c = &curr->v[i];
+            const Iface *l = index_find(&links_ix, &links, c->ifindex);
+            if (l) {
+                memcpy(c->name, l->name, sizeof(c->name));
+                memcpy(c->kind, l->kind, sizeof(c->kind));
+            } else if (!c->name[0]) {
+                strcpy(c->name, "?");      /* gone since the stats dump */
+            }
         }
-        line = strtok(NULL, "\n");
     }
-    return count;
+    return 0;
+}
+
+/* ---- Filters ------------------------------------------------------------ */
+static const char *globs[MAX_FILTERS], *kinds[MAX_FILTERS];
+static int nglobs, nkinds;
+
+/* With no -g or -t, everything but loopback */
+static int selected(const Iface *f) {
+    if (nglobs == 0 && nkinds == 0) return strcmp(f->kind, "loopback") != 0;
+    int ok = nglobs == 0;
+    for (int i = 0; i < nglobs && !ok; i++)
+        ok = fnmatch(globs[i], f->name, 0) == 0;
+    if (!ok) return 0;
+    ok = nkinds == 0;
+    for (int i = 0; i < nkinds && !ok; i++)
+        ok = strcmp(kinds[i], f->kind) == 0;
+    return ok;
+}
+
+static int cmp_traffic(const void *a, const void *b) {
+    double x = (*(Iface *const *)a)->traffic, y = (*(Iface *const *)b)->traffic;
+    return (x < y) - (x > y);
+}
+
+static int cmp_ifindex(const void *a, const void *b) {
+    return (*(Iface *const *)a)->ifindex - (*(Iface *const *)b)->ifindex;
 }
 
+/* Interfaces to show this tick, matched against the previous one; new
+   interfaces show from their second tick, and ones that went away just
+   drop out */
+static Iface **rows;
+static size_t rows_cap;
+
+static size_t pick_rows(IfTable *curr, const IfTable *prev, const Index *ix,
+                        int top_n, size_t *added) {
+    if (curr->n > rows_cap) {
+        rows_cap = curr->n;
+        rows = realloc(rows, rows_cap * sizeof(*rows));
+        if (!rows) { perror("realloc"); exit(EXIT_FAILURE); }
+    }
+    size_t nrows = 0;
+    *added = 0;
+    for (size_t i = 0; i < curr->n; i++) {
+        Iface *c = &curr->v[i];
+        const Iface *p = index_find(ix, prev, c->ifindex);
+        if (!p) { (*added)++; continue; }
+        if (!selected(c)) continue;
+        c->traffic = (double)(c->rx_bytes - p->rx_bytes) +
+                     (double)(c->tx_bytes - p->tx_bytes);
+        rows[nrows++] = c;
+    }
+    if (top_n > 0) {
+        qsort(rows, nrows, sizeof(*rows), cmp_traffic);
+        if (nrows > (size_t)top_n) nrows = (size_t)top_n;
+    } else {
+        qsort(rows, nrows, sizeof(*rows), cmp_ifindex);
+    }
+    return nrows;
+}
+
+/* ---- TCP/IP counters ---------------------------------------------------- */
+/* /proc/net/snmp and /proc/net/netstat are pairs of lines, "Group: names"
+   then "Group: values". They are parsed by header, so a field added by a
+   newer kernel shifts nothing; netstat alone is past 4 KB on recent ones. */
+#define SNMP_MAX  512
+#define SNMP_BUF  32768
+
+typedef struct {
+    char      group[16];
+    char      name[40];
+    long long v;                       /* Tcp MaxConn is -1 */
+} Counter;
+
+typedef struct {
+    Counter c[SNMP_MAX];
+    int     n;
+} Counters;
+
 static long long prev_retrans = -1;
 
-static long long read_retransmits(void) {
-    char buf[BUF_SIZE];
-    int fd = open("/proc/net/snmp", O_RDONLY);
+static ssize_t read_all(const char *path, char *buf, size_t size) {
+    int fd = open(path, O_RDONLY);
     if (fd < 0) return -1;
-    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    size_t len = 0;
+    ssize_t n;
+    while (len < size - 1 && (n = read(fd, buf + len, size - 1 - len)) > 0)
+        len += (size_t)n;
     close(fd);
-    if (n <= 0) return -1;
-    buf[n] = '\0';
+    buf[len] = '\0';
+    return (ssize_t)len;
+}
+
+static void parse_counters(char *buf, Counters *out) {
+    char *line = buf;
+    while (*line) {
+        char *names = line, *vals = strchr(names, '\n');
+        if (!vals) break;
+        *vals++ = '\0';
+        char *end = strchr(vals, '\n');
+        if (end) *end = '\0';
+        line = end ? end + 1 : vals + strlen(vals);
 
-    /* The file has two "Tcp:" lines: header then values */
-    char *t1 = strstr(buf, "Tcp:");
-    if (!t1) return -1;
-    char *t2 = strstr(t1 + 1, "Tcp:");
-    if (!t2) return -1;
-
-    unsigned long long v[14];
-    int got = sscanf(t2 + 4,
-        "%llu %llu %llu %llu %llu %llu %llu %llu"
-        " %llu %llu %llu %llu %llu %llu",
-        &v[0],&v[1],&v[2],&v[3],&v[4],&v[5],&v[6],
-        &v[7],&v[8],&v[9],&v[10],&v[11],&v[12],&v[13]);
-    if (got >= 12) return (long long)v[11]; /* RetransSegs */
+        char *colon = strchr(names, ':');
+        if (!colon || strncmp(names, vals, (size_t)(colon - names + 1)) != 0)
+            continue;                  /* not a header/values pair */
+        size_t glen = (size_t)(colon - names);
+        if (glen >= sizeof(out->c[0].group)) glen = sizeof(out->c[0].group) - 1;
+
+        char *np = colon + 1, *vp = vals + (colon - names) + 1;
+        for (;;) {
+            while (*np == ' ') np++;
+            if (!*np || out->n == SNMP_MAX) break;
+            char *ne = np;
+            while (*ne && *ne != ' ') ne++;
+            char *ve;
+            long long v = strtoll(vp, &ve, 10);
+            if (ve == vp) break;
+            Counter *c = &out->c[out->n++];
+            memcpy(c->group, names, glen);
+            c->group[glen] = '\0';
+            size_t nlen = (size_t)(ne - np);
+            if (nlen >= sizeof(c->name)) nlen = sizeof(c->name) - 1;
+            memcpy(c->name, np, nlen);
+            c->name[nlen] = '\0';
+            c->v = v;
+            np = ne;
+            vp = ve;
+        }
+    }
+}
+
+static int read_counters(Counters *out) {
+    static char buf[SNMP_BUF];
+    out->n = 0;
+    if (read_all("/proc/net/snmp", buf, sizeof(buf)) < 0) return -1;
+    parse_counters(buf, out);
+    if (read_all("/proc/net/netstat", buf, sizeof(buf)) >= 0)
+        parse_counters(buf, out);
+    return 0;
+}
+
+/* Index of group/name in t, or -1. hint is where it was last time: the
+   layout only changes with the kernel, so that almost always hits. */
+static int counter_find(const Counters *t, const char *group, const char *name, int hint) {
+    if (hint >= 0 && hint < t->n && strcmp(t->c[hint].name, name) == 0 &&
+        strcmp(t->c[hint].group, group) == 0)
+        return hint;
+    for (int i = 0; i < t->n; i++)
+        if (strcmp(t->c[i].name, name) == 0 && strcmp(t->c[i].group, group) == 0)
+            return i;
     return -1;
 }
 
+static long long read_retransmits(void) {
+    static Counters t;
+    static int hint = -1;
+    if (read_counters(&t) < 0) return -1;
+    hint = counter_find(&t, "Tcp", "RetransSegs", hint);
+    return hint < 0 ? -1 : t.c[hint].v;
+}
+
 static int read_tcp_conns(void) {
     char buf[512];
     int fd = open("/proc/net/sockstat", O_RDONLY);
@@ -105,28 +444,1037 @@ static int read_tcp_conns(void) {
     return inuse;
 }
 
+/* ---- Microburst mode (-u) ---------------------------------------------- */
+/* A 1 s average hides a 10 ms burst that fills a NIC ring. With -u the
+   selected interfaces (at most BURST_MAX, the busiest) are sampled every
+   -u ms off a timerfd armed with absolute deadlines, so sampling does not
+   drift and a late wakeup shows up as a missed expiry rather than a
+   stretched window. Each sample is one sendmsg carrying an RTM_GETSTATS
+   request per interface and the recv()s for their replies; each
+   interface's rates over the sample window go into a ring that holds one
+   display interval. Every second the ring is reduced to the average, p99
+   and peak, and the interface set is picked again from a full dump.
+   Rates are only as fine as the driver's counters: veth and most virtual
+   devices count per packet, but some NIC drivers refresh hardware
+   counters on a timer, which flattens what can be seen. */
+#define BURST_MAX 64
+#define BURST_SEQ 0x80000000u          /* apart from nl_talk()'s sequence */
+
+typedef struct {
+    int                ifindex;
+    char               name[IFACE_LEN];
+    char               kind[KIND_LEN];
+    unsigned long long rx, tx, errs;   /* last sample */
+    unsigned long long rx0, tx0, errs0;/* at the start of the interval */
+    double             at, at0;        /* 0 = no sample yet */
+    float             *rx_rate, *tx_rate;
+    int                head, n;        /* ring: next slot, samples held */
+} Burst;
+
+static Burst   bursts[BURST_MAX];
+static int     nbursts, ring_cap;
+static char    burst_req[BURST_MAX * NLMSG_SPACE(sizeof(struct if_stats_msg))];
+
+static void burst_pick(Iface **sel, size_t nsel) {
+    Burst next[BURST_MAX];
+    int n = 0;
+    for (size_t i = 0; i < nsel && n < BURST_MAX; i++) {
+        Burst *b = &next[n++];
+        int j = 0;
+        while (j < nbursts && bursts[j].ifindex != sel[i]->ifindex) j++;
+        if (j < nbursts) {
+            *b = bursts[j];
+            bursts[j].rx_rate = bursts[j].tx_rate = NULL;   /* moved */
+        } else {
+            memset(b, 0, sizeof(*b));
+            b->ifindex = sel[i]->ifindex;
+            b->rx_rate = malloc(ring_cap * sizeof(float));
+            b->tx_rate = malloc(ring_cap * sizeof(float));
+            if (!b->rx_rate || !b->tx_rate) { perror("malloc"); exit(EXIT_FAILURE); }
+        }
+        memcpy(b->name, sel[i]->name, sizeof(b->name));
+        memcpy(b->kind, sel[i]->kind, sizeof(b->kind));
+    }
+    for (int j = 0; j < nbursts; j++) {
+        free(bursts[j].rx_rate);
+        free(bursts[j].tx_rate);
+    }
+    memcpy(bursts, next, n * sizeof(*next));
+    nbursts = n;
+
+    /* the batched request only changes with the set */
+    for (int i = 0; i < nbursts; i++) {
+        struct nlmsghdr *h = (struct nlmsghdr *)
+            (burst_req + i * NLMSG_SPACE(sizeof(struct if_stats_msg)));
+        memset(h, 0, NLMSG_SPACE(sizeof(struct if_stats_msg)));
+        h->nlmsg_len   = NLMSG_LENGTH(sizeof(struct if_stats_msg));
+        h->nlmsg_type  = RTM_GETSTATS;
+        h->nlmsg_flags = NLM_F_REQUEST;
+        h->nlmsg_seq   = BURST_SEQ + i;  /* index into bursts[] */
+        struct if_stats_msg *m = NLMSG_DATA(h);
+        m->family      = AF_UNSPEC;
+        m->ifindex     = (unsigned)bursts[i].ifindex;
+        m->filter_mask = IFLA_STATS_FILTER_BIT(IFLA_STATS_LINK_64);
+    }
+}
+
+static void burst_record(Burst *b, const struct rtnl_link_stats64 *s, double now) {
+    unsigned long long errs = s->rx_errors + s->rx_dropped + s->tx_errors + s->tx_dropped;
+    if (b->at > 0 && now > b->at) {
+        double dt = now - b->at;
+        b->rx_rate[b->head] = (float)((s->rx_bytes - b->rx) / dt);
+        b->tx_rate[b->head] = (float)((s->tx_bytes - b->tx) / dt);
+        b->head = (b->head + 1) % ring_cap;
+        if (b->n < ring_cap) b->n++;
+    }
+    if (b->at0 == 0) {
+        b->rx0 = s->rx_bytes; b->tx0 = s->tx_bytes; b->errs0 = errs;
+        b->at0 = now;
+    }
+    b->rx = s->rx_bytes; b->tx = s->tx_bytes; b->errs = errs;
+    b->at = now;
+}
+
+static int burst_sample(void) {
+    if (nbursts == 0) return 0;
+    if (send(nl_sock, burst_req, nbursts * NLMSG_SPACE(sizeof(struct if_stats_msg)), 0) < 0)
+        return -1;
+    int got = 0;
+    while (got < nbursts) {
+        ssize_t n = recv(nl_sock, nl_buf, sizeof(nl_buf), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        double now = now_sec();
+        int len = (int)n;
+        for (struct nlmsghdr *h = (struct nlmsghdr *)nl_buf; NLMSG_OK(h, len);
+             h = NLMSG_NEXT(h, len)) {
+            unsigned i = h->nlmsg_seq - BURST_SEQ;
+            if (i >= (unsigned)nbursts) continue;
+            got++;                     /* a reply or an error (link gone) */
+            if (h->nlmsg_type != RTM_NEWSTATS) continue;
+            struct if_stats_msg *m = NLMSG_DATA(h);
+            int alen = (int)h->nlmsg_len - NLMSG_LENGTH(sizeof(*m));
+            struct rtattr *a = (struct rtattr *)((char *)m + NLMSG_ALIGN(sizeof(*m)));
+            for (; RTA_OK(a, alen); a = RTA_NEXT(a, alen)) {
+                if (a->rta_type != IFLA_STATS_LINK_64 ||
+                    RTA_PAYLOAD(a) < sizeof(struct rtnl_link_stats64))
+                    continue;
+                struct rtnl_link_stats64 s;
+                memcpy(&s, RTA_DATA(a), sizeof(s));
+                burst_record(&bursts[i], &s, now);
+            }
+        }
+    }
+    return 0;
+}
+
+static int cmp_float(const void *a, const void *b) {
+    float x = *(const float *)a, y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+/* p99 and peak of the n rates in ring, in MB/s */
+static void ring_stats(const float *ring, int n, float *scratch, double *p99, double *peak) {
+    memcpy(scratch, ring, n * sizeof(float));
+    qsort(scratch, n, sizeof(float), cmp_float);
+    int k = (int)(0.99 * n + 0.999999) - 1;
+    *p99  = scratch[k < 0 ? 0 : k] / 1048576.0;
+    *peak = scratch[n - 1] / 1048576.0;
+}
+
+static void burst_header(int period_ms) {
+    printf("\n%-15s %-8s %9s %9s %9s %9s %9s %9s %9s   (%d ms samples)\n",
+           "Interface", "Type", "RX avg", "RX p99", "RX peak",
+           "TX avg", "TX p99", "TX peak", "err/s", period_ms);
+    printf("%-15s %-8s %9s %9s %9s %9s %9s %9s %9s\n",
+           "---------------", "--------", "---------", "---------", "---------",
+           "---------", "---------", "---------", "---------");
+}
+
+static void burst_report(void) {
+    static float scratch[1000 * 2];
+    for (int i = 0; i < nbursts; i++) {
+        Burst *b = &bursts[i];
+        if (b->n == 0 || b->at <= b->at0) {
+            printf("%-15s %-8.8s %9s\n", b->name, b->kind, "-");
+        } else {
+            double dt = b->at - b->at0, rx_p99, rx_peak, tx_p99, tx_peak;
+            ring_stats(b->rx_rate, b->n, scratch, &rx_p99, &rx_peak);
+            ring_stats(b->tx_rate, b->n, scratch, &tx_p99, &tx_peak);
+            printf("%-15s %-8.8s %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %9.0f\n",
+                   b->name, b->kind,
+                   (b->rx - b->rx0) / dt / 1048576.0, rx_p99, rx_peak,
+                   (b->tx - b->tx0) / dt / 1048576.0, tx_p99, tx_peak,
+                   (b->errs - b->errs0) / dt);
+        }
+        /* next interval starts from the last sample */
+        b->rx0 = b->rx; b->tx0 = b->tx; b->errs0 = b->errs;
+        b->at0 = b->at;
+        b->n = 0;
+    }
+}
+
+static double cpu_sec(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec +
+           (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static int burst_loop(int period_ms, int top_n) {
+    IfTable bufA = {0}, bufB = {0};
+    IfTable *curr = &bufA, *prev = &bufB;
+    Index ix = {0};
+    size_t added;
+    int lines = 0;
+
+    ring_cap = 1000 / period_ms * 2;   /* one second, plus slack for late reports */
+    if (collect(prev, curr, &ix) < 0) return -1;
+    sleep(1);
+
+    int tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    if (tfd < 0) { perror("timerfd_create"); return -1; }
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    struct itimerspec its = {
+        .it_interval = { period_ms / 1000, (period_ms % 1000) * 1000000L },
+        .it_value    = start,
+    };
+    if (timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        perror("timerfd_settime"); return -1;
+    }
+
+    double next_report = now_sec();
+    double cpu0 = cpu_sec(), wall0 = now_sec(), sample_time = 0;
+    unsigned long samples = 0, missed = 0;
+    for (;;) {
+        double now = now_sec();
+        if (now >= next_report) {
+            if (collect(curr, prev, &ix) < 0) return -1;
+            size_t n = pick_rows(curr, prev, &ix, top_n > 0 ? top_n : BURST_MAX, &added);
+            IfTable *t = curr; curr = prev; prev = t;
+
+            if (samples) {
+                if (lines++ % HDR_EVERY == 0) burst_header(period_ms);
+                burst_report();
+                double wall = now - wall0;
+                printf("  sampler: %lu samples, %lu missed, %.1f us/sample, %.1f%% of a core\n",
+                       samples, missed, sample_time * 1e6 / samples,
+                       (cpu_sec() - cpu0) * 100.0 / wall);
+                fflush(stdout);
+            }
+            burst_pick(rows, n);
+            cpu0 = cpu_sec(); wall0 = now_sec(); sample_time = 0;
+            samples = missed = 0;
+            next_report += 1.0;
+        }
+
+        uint64_t exp;
+        if (read(tfd, &exp, sizeof(exp)) != sizeof(exp)) {
+            if (errno == EINTR) continue;
+            perror("timerfd read"); return -1;
+        }
+        if (exp > 1) missed += exp - 1;
+        double t0 = now_sec();
+        if (burst_sample() < 0) { perror("RTM_GETSTATS"); return -1; }
+        sample_time += now_sec() - t0;
+        samples++;
+    }
+}
+
+/* ---- Saturation (-S) ---------------------------------------------------- */
+/* The USE view of the network stack: every counter that means a packet or
+   connection was dropped, pruned or retried, as a rate. The ones below are
+   always shown (a "-" when this kernel lacks them); any other counter whose
+   name says drop, error, fail, overflow, prune, discard, collapse,
+   pressure or abort is shown when it moves. Per-CPU backlog drops and
+   time_squeeze (net_rx_action ran out of budget with work left) come from
+   /proc/net/softnet_stat. */
+static const struct { const char *group, *name; } sat_keys[] = {
+    { "TcpExt", "ListenOverflows"    }, { "TcpExt", "ListenDrops"       },
+    { "TcpExt", "TCPReqQFullDrop"    }, { "TcpExt", "TCPBacklogDrop"    },
+    { "TcpExt", "PruneCalled"        }, { "TcpExt", "RcvPruned"         },
+    { "TcpExt", "TCPRcvQDrop"        }, { "TcpExt", "TCPZeroWindowDrop" },
+    { "TcpExt", "TCPOFODrop"         }, { "TcpExt", "TCPMemoryPressures"},
+    { "TcpExt", "TCPAbortOnMemory"   }, { "TcpExt", "TCPTimeouts"       },
+    { "TcpExt", "TCPSynRetrans"      }, { "TcpExt", "TCPLossProbes"     },
+    { "Tcp",    "RetransSegs"        }, { "Tcp",    "InErrs"            },
+    { "Tcp",    "AttemptFails"       }, { "Tcp",    "EstabResets"       },
+    { "Tcp",    "OutRsts"            },
+    { "Ip",     "InDiscards"         }, { "Ip",     "OutDiscards"       },
+    { "Ip",     "InHdrErrors"        }, { "Ip",     "ReasmFails"        },
+    { "Udp",    "InErrors"           }, { "Udp",    "RcvbufErrors"      },
+    { "Udp",    "SndbufErrors"       }, { "Udp",    "NoPorts"           },
+};
+#define SAT_KEYS (int)(sizeof(sat_keys) / sizeof(sat_keys[0]))
+
+static const char *const sat_words[] = {
+    "Drop", "Err", "Fail", "Overflow", "Prune", "Discard", "Collapse",
+    "Pressure", "Abort",
+};
+
+typedef struct {
+    int           cpu;
+    unsigned long processed, dropped, squeezed;
+} Softnet;
+
+typedef struct {
+    Softnet *v;
+    size_t   n, cap;
+} SoftnetTable;
+
+static int sat_word(const char *name) {
+    for (size_t i = 0; i < sizeof(sat_words) / sizeof(sat_words[0]); i++)
+        if (strstr(name, sat_words[i])) return 1;
+    return 0;
+}
+
+/* One line per online CPU, in hex. Since 4.19 the 13th column is the CPU
+   number; before that the line number is, which is wrong once a CPU is
+   offline but is all there is. */
+static int read_softnet(SoftnetTable *t) {
+    static char buf[SNMP_BUF * 4];
+    if (read_all("/proc/net/softnet_stat", buf, sizeof(buf)) < 0) return -1;
+    t->n = 0;
+    int line = 0;
+    for (char *p = buf; *p; line++) {
+        unsigned long col[13];
+        int ncol = 0;
+        while (*p && *p != '\n') {
+            char *e;
+            unsigned long v = strtoul(p, &e, 16);
+            if (e == p) break;
+            if (ncol < 13) col[ncol++] = v;
+            p = e;
+            while (*p == ' ') p++;
+        }
+        while (*p && *p != '\n') p++;
+        if (*p) p++;
+        if (ncol < 3) continue;
+        if (t->n == t->cap) {
+            size_t cap = t->cap ? t->cap * 2 : 64;
+            Softnet *v = realloc(t->v, cap * sizeof(*v));
+            if (!v) { perror("realloc"); exit(EXIT_FAILURE); }
+            t->v   = v;
+            t->cap = cap;
+        }
+        t->v[t->n++] = (Softnet){ ncol >= 13 ? (int)col[12] : line,
+                                  col[0], col[1], col[2] };
+    }
+    return 0;
+}
+
+static void print_counter(const Counters *curr, const Counters *prev, int i,
+                          int *hint, int secs) {
+    const Counter *c = &curr->c[i];
+    char label[64];
+    snprintf(label, sizeof(label), "%s %s", c->group, c->name);
+    *hint = counter_find(prev, c->group, c->name, *hint);
+    if (*hint < 0) printf("%-34s %12s %14lld\n", label, "-", c->v);
+    else printf("%-34s %12.1f %14lld\n", label,
+                (double)(c->v - prev->c[*hint].v) / secs, c->v);
+}
+
+static int sat_loop(int secs) {
+    static Counters a, b;
+    Counters *curr = &a, *prev = &b;
+    SoftnetTable sa = {0}, sb = {0}, *scurr = &sa, *sprev = &sb;
+    int hint[SAT_KEYS], phint[SAT_KEYS];
+    static int other_hint[SNMP_MAX];
+    for (int k = 0; k < SAT_KEYS; k++) hint[k] = phint[k] = -1;
+    for (int i = 0; i < SNMP_MAX; i++) other_hint[i] = -1;
+
+    if (read_counters(prev) < 0) { perror("/proc/net/snmp"); return -1; }
+    read_softnet(sprev);
+
+    for (;;) {
+        sleep(secs);
+        if (read_counters(curr) < 0) { perror("/proc/net/snmp"); return -1; }
+        read_softnet(scurr);
+
+        printf("\033[2J\033[H");
+        printf("%-34s %12s %14s\n", "COUNTER", "/s", "TOTAL");
+        printf("%-34s %12s %14s\n", "----------------------------------",
+               "------------", "--------------");
+        char shown[SNMP_MAX] = {0};
+        for (int k = 0; k < SAT_KEYS; k++) {
+            hint[k] = counter_find(curr, sat_keys[k].group, sat_keys[k].name, hint[k]);
+            if (hint[k] < 0) {
+                char label[64];
+                snprintf(label, sizeof(label), "%s %s", sat_keys[k].group, sat_keys[k].name);
+                printf("%-34s %12s %14s\n", label, "-", "-");
+                continue;
+            }
+            shown[hint[k]] = 1;
+            print_counter(curr, prev, hint[k], &phint[k], secs);
+        }
+        int header = 0;
+        for (int i = 0; i < curr->n; i++) {
+            if (shown[i] || !sat_word(curr->c[i].name)) continue;
+            int j = counter_find(prev, curr->c[i].group, curr->c[i].name, other_hint[i]);
+            other_hint[i] = j;
+            if (j < 0 || curr->c[i].v == prev->c[j].v) continue;
+            if (!header++) printf("\n");
+            print_counter(curr, prev, i, &other_hint[i], secs);
+        }
+
+        /* CPUs are matched by number; one that went offline just drops out */
+        printf("\n%-8s %14s %12s %12s\n", "SOFTNET", "PACKETS/s", "DROPS/s", "SQUEEZE/s");
+        printf("%-8s %14s %12s %12s\n", "--------", "--------------",
+               "------------", "------------");
+        double tp = 0, td = 0, ts = 0;
+        int busy = 0;
+        for (size_t i = 0; i < scurr->n; i++) {
+            const Softnet *c = &scurr->v[i], *p = NULL;
+            if (i < sprev->n && sprev->v[i].cpu == c->cpu) p = &sprev->v[i];
+            for (size_t j = 0; !p && j < sprev->n; j++)
+                if (sprev->v[j].cpu == c->cpu) p = &sprev->v[j];
+            if (!p) continue;
+            /* the counters are 32-bit and wrap */
+            double dp = (unsigned)(c->processed - p->processed);
+            double dd = (unsigned)(c->dropped - p->dropped);
+            double ds = (unsigned)(c->squeezed - p->squeezed);
+            tp += dp; td += dd; ts += ds;
+            if (dd == 0 && ds == 0) continue;
+            char label[16];
+            snprintf(label, sizeof(label), "cpu%d", c->cpu);
+            printf("%-8s %14.1f %12.1f %12.1f\n", label, dp / secs, dd / secs, ds / secs);
+            busy++;
+        }
+        printf("%-8s %14.1f %12.1f %12.1f\n", "all", tp / secs, td / secs, ts / secs);
+        printf("\n%zu CPUs, %d dropping or squeezed\n", scurr->n, busy);
+        fflush(stdout);
+
+        Counters *t = prev; prev = curr; curr = t;
+        SoftnetTable *st = sprev; sprev = scurr; scurr = st;
+    }
+}
+
+/* ---- Connections (-C) --------------------------------------------------- */
+/* Each tick dumps every TCP socket's tcp_info over NETLINK_SOCK_DIAG
+   (IPv4 and IPv6, LISTEN and TIME_WAIT left out) and handles it as it
+   is parsed, so the dump is never held whole. What is kept is bounded:
+   24 bytes per socket (its cookie, total retransmits and bytes acked,
+   for the next tick's deltas, up to CONN_MAX sockets), the top N rows in
+   a min-heap, and two aggregate tables of at most AGG_MAX remote
+   networks (/24, or /64 for IPv6) and local ports, past which the rest
+   is summed into one "other" row. */
+#define CONN_MAX (1u << 22)
+#define AGG_MAX  (1u << 16)
+
+/* socket states from include/net/tcp_states.h, which is not exported */
+enum { ST_TIME_WAIT = 6, ST_CLOSE = 7, ST_LISTEN = 10 };
+
+typedef struct {
+    uint64_t cookie;
+    uint64_t acked;
+    uint32_t retrans;
+} ConnState;
+
+typedef struct {
+    ConnState *v;
+    size_t     n, cap;
+} ConnTable;
+
+typedef struct {
+    int      family;
+    uint8_t  src[16], dst[16];
+    uint16_t sport, dport;
+    double   rtt_ms, rttvar_ms;
+    uint32_t cwnd, retrans, total_retrans;
+    double   acked;                    /* bytes acked this tick */
+    uint64_t delivery_rate;            /* bytes/s */
+    uint32_t rqueue, wqueue, notsent;
+    double   key;
+} ConnRow;
+
+typedef struct {
+    int      family;                   /* 0 = free slot */
+    uint8_t  addr[16];                 /* remote network, or zero */
+    uint16_t port;                     /* local port, or zero */
+    unsigned conns;
+    unsigned long retrans;
+    double   rtt_sum, rtt_max, acked;
+    double   key;
+} Agg;
+
+typedef struct {
+    Agg    *v;                         /* 2 * AGG_MAX slots */
+    size_t  n;
+    Agg     other;
+    size_t *used;                      /* occupied slots, for clearing */
+} AggTable;
+
+static int       conn_sort_rtt;
+static ConnTable conns_a, conns_b;
+static ConnTable *conns_curr = &conns_a, *conns_prev = &conns_b;
+static Index     conn_ix;
+static int       conn_primed;          /* a previous dump exists */
+static size_t    conn_seen, conn_untracked;
+static int       conn_saturated;       /* the previous dump hit CONN_MAX */
+static ConnRow  *conn_heap;
+static int       conn_heap_n, conn_top;
+static AggTable  by_net, by_port;
+
+static size_t cookie_hash(uint64_t c, size_t mask) {
+    return (size_t)((c ^ (c >> 29)) * 0x9e3779b97f4a7c15ull >> 20) & mask;
+}
+
+static void conn_index_build(Index *ix, const ConnTable *t) {
+    size_t want = 64;
+    while (want < t->n * 2) want *= 2;
+    if (want > ix->mask + 1 || !ix->slot) {
+        free(ix->slot);
+        ix->slot = malloc(want * sizeof(*ix->slot));
+        if (!ix->slot) { perror("malloc"); exit(EXIT_FAILURE); }
+        ix->mask = want - 1;
+    }
+    memset(ix->slot, 0, (ix->mask + 1) * sizeof(*ix->slot));
+    for (size_t i = 0; i < t->n; i++) {
+        size_t h = cookie_hash(t->v[i].cookie, ix->mask);
+        while (ix->slot[h]) h = (h + 1) & ix->mask;
+        ix->slot[h] = (int)i + 1;
+    }
+}
+
+static const ConnState *conn_find(const Index *ix, const ConnTable *t, uint64_t cookie) {
+    if (!ix->slot) return NULL;
+    size_t h = cookie_hash(cookie, ix->mask);
+    for (int s; (s = ix->slot[h]); h = (h + 1) & ix->mask)
+        if (t->v[s - 1].cookie == cookie) return &t->v[s - 1];
+    return NULL;
+}
+
+static void heap_down(ConnRow *h, int n, int i) {
+    for (;;) {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if (l < n && h[l].key < h[m].key) m = l;
+        if (r < n && h[r].key < h[m].key) m = r;
+        if (m == i) return;
+        ConnRow t = h[i]; h[i] = h[m]; h[m] = t;
+        i = m;
+    }
+}
+
+static void heap_offer(const ConnRow *r) {
+    if (conn_heap_n < conn_top) {
+        int i = conn_heap_n++;
+        conn_heap[i] = *r;
+        while (i > 0 && conn_heap[(i - 1) / 2].key > conn_heap[i].key) {
+            ConnRow t = conn_heap[i]; conn_heap[i] = conn_heap[(i - 1) / 2];
+            conn_heap[(i - 1) / 2] = t;
+            i = (i - 1) / 2;
+        }
+    } else if (r->key > conn_heap[0].key) {
+        conn_heap[0] = *r;
+        heap_down(conn_heap, conn_heap_n, 0);
+    }
+}
+
+static void agg_init(AggTable *t) {
+    t->v    = calloc(2 * AGG_MAX, sizeof(*t->v));
+    t->used = malloc(AGG_MAX * sizeof(*t->used));
+    if (!t->v || !t->used) { perror("calloc"); exit(EXIT_FAILURE); }
+}
+
+static void agg_clear(AggTable *t) {
+    for (size_t i = 0; i < t->n; i++) t->v[t->used[i]].family = 0;
+    t->n = 0;
+    memset(&t->other, 0, sizeof(t->other));
+}
+
+static void agg_add(AggTable *t, int family, const uint8_t *addr, uint16_t port,
+                    const ConnRow *r) {
+    uint64_t h = 1469598103934665603ull ^ port ^ ((uint64_t)family << 16);
+    for (int i = 0; i < 16; i++) h = (h ^ addr[i]) * 1099511628211ull;
+    size_t mask = 2 * AGG_MAX - 1, s = h & mask;
+    Agg *a;
+    for (;; s = (s + 1) & mask) {
+        a = &t->v[s];
+        if (a->family == family && a->port == port && memcmp(a->addr, addr, 16) == 0)
+            break;
+        if (a->family == 0) {
+            if (t->n == AGG_MAX) { a = &t->other; break; }
+            memset(a, 0, sizeof(*a));
+            a->family = family;
+            a->port   = port;
+            memcpy(a->addr, addr, 16);
+            t->used[t->n++] = s;
+            break;
+        }
+    }
+    a->conns++;
+    a->retrans += r->retrans;
+    a->rtt_sum += r->rtt_ms;
+    if (r->rtt_ms > a->rtt_max) a->rtt_max = r->rtt_ms;
+    a->acked += r->acked;
+}
+
+static void conn_seen_one(const struct inet_diag_msg *m, const struct tcp_info *ti) {
+    uint64_t cookie = m->id.idiag_cookie[0] | (uint64_t)m->id.idiag_cookie[1] << 32;
+    const ConnState *o = conn_find(&conn_ix, conns_prev, cookie);
+    ConnRow r = {
+        .family = m->idiag_family,
+        .sport  = ntohs(m->id.idiag_sport), .dport = ntohs(m->id.idiag_dport),
+        .rtt_ms = ti->tcpi_rtt / 1000.0, .rttvar_ms = ti->tcpi_rttvar / 1000.0,
+        .cwnd   = ti->tcpi_snd_cwnd, .total_retrans = ti->tcpi_total_retrans,
+        .delivery_rate = ti->tcpi_delivery_rate,
+        .rqueue = m->idiag_rqueue, .wqueue = m->idiag_wqueue,
+        .notsent = ti->tcpi_notsent_bytes,
+    };
+    memcpy(r.src, m->id.idiag_src, 16);
+    memcpy(r.dst, m->id.idiag_dst, 16);
+    /* An IPv6 socket talking to an IPv4 peer (a server bound to ::) has
+       both ends as ::ffff:a.b.c.d. Treat it as the IPv4 connection it is,
+       or every such client would share the ::/64 row. */
+    if (r.family == AF_INET6 && IN6_IS_ADDR_V4MAPPED((const struct in6_addr *)r.dst)) {
+        r.family = AF_INET;
+        memmove(r.src, r.src + 12, 4);
+        memmove(r.dst, r.dst + 12, 4);
+        memset(r.src + 4, 0, 12);
+        memset(r.dst + 4, 0, 12);
+    }
+    /* A socket not in the last dump was opened since, so all of it is new.
+       Unless the last dump hit CONN_MAX: then it may just not have been
+       kept, and its lifetime totals would show up as this second's. */
+    if (o && ti->tcpi_total_retrans >= o->retrans && ti->tcpi_bytes_acked >= o->acked) {
+        r.retrans = ti->tcpi_total_retrans - o->retrans;
+        r.acked   = (double)(ti->tcpi_bytes_acked - o->acked);
+    } else if (!o && conn_primed && !conn_saturated) {
+        r.retrans = ti->tcpi_total_retrans;
+        r.acked   = (double)ti->tcpi_bytes_acked;
+    }
+    conn_seen++;
+
+    if (conns_curr->n < CONN_MAX) {
+        if (conns_curr->n == conns_curr->cap) {
+            size_t cap = conns_curr->cap ? conns_curr->cap * 2 : 4096;
+            ConnState *v = realloc(conns_curr->v, cap * sizeof(*v));
+            if (!v) { perror("realloc"); exit(EXIT_FAILURE); }
+            conns_curr->v = v;
+            conns_curr->cap = cap;
+        }
+        conns_curr->v[conns_curr->n++] = (ConnState){
+            cookie, ti->tcpi_bytes_acked, ti->tcpi_total_retrans };
+    } else {
+        conn_untracked++;
+    }
+
+    r.key = conn_sort_rtt ? r.rtt_ms : r.retrans;
+    if (r.key > 0) heap_offer(&r);
+
+    uint8_t net[16] = {0};
+    if (r.family == AF_INET) memcpy(net, r.dst, 3);       /* /24 */
+    else                     memcpy(net, r.dst, 8);       /* /64 */
+    static const uint8_t none[16];
+    agg_add(&by_net, r.family, net, 0, &r);
+    agg_add(&by_port, r.family == AF_INET6 ? AF_INET6 : AF_INET, none, r.sport, &r);
+}
+
+static void parse_diag(struct nlmsghdr *h, void *arg) {
+    (void)arg;
+    if (h->nlmsg_type != TCPDIAG_GETSOCK) return;
+    const struct inet_diag_msg *m = NLMSG_DATA(h);
+    int len = (int)h->nlmsg_len - NLMSG_LENGTH(sizeof(*m));
+    struct rtattr *a = (struct rtattr *)((char *)m + NLMSG_ALIGN(sizeof(*m)));
+    for (; RTA_OK(a, len); a = RTA_NEXT(a, len)) {
+        if (a->rta_type != INET_DIAG_INFO) continue;
+        /* older kernels send a shorter tcp_info; newer fields stay zero */
+        struct tcp_info ti = {0};
+        size_t n = RTA_PAYLOAD(a) < sizeof(ti) ? RTA_PAYLOAD(a) : sizeof(ti);
+        memcpy(&ti, RTA_DATA(a), n);
+        conn_seen_one(m, &ti);
+        return;
+    }
+}
+
+/* The per-family SOCK_DIAG_BY_FAMILY request walks the whole TCP hash
+   once for IPv4 and again for IPv6. The original TCPDIAG_GETSOCK request
+   is served with no family filter, so one walk returns both: about 12%
+   less kernel time per dump at 100k sockets. */
+static int diag_dump(void) {
+    struct {
+        struct nlmsghdr      h;
+        struct inet_diag_req r;
+    } req = {
+        .h = { .nlmsg_len = sizeof(req), .nlmsg_type = TCPDIAG_GETSOCK,
+               .nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP },
+        .r = { .idiag_family = AF_INET,
+               .idiag_ext = 1 << (INET_DIAG_INFO - 1),
+               .idiag_states = ~((1u << ST_LISTEN) | (1u << ST_TIME_WAIT) |
+                                 (1u << ST_CLOSE)) },
+    };
+    return nl_talk(&req.h, parse_diag, NULL);
+}
+
+static int conn_collect(void) {
+    ConnTable *t = conns_prev; conns_prev = conns_curr; conns_curr = t;
+    conn_index_build(&conn_ix, conns_prev);
+    conns_curr->n = 0;
+    conn_saturated = conn_untracked > 0;
+    conn_seen = conn_untracked = 0;
+    conn_heap_n = 0;
+    agg_clear(&by_net);
+    agg_clear(&by_port);
+    return diag_dump();
+}
+
+static void fmt_endpoint(int family, const uint8_t *addr, uint16_t port,
+                         char *out, size_t size) {
+    char ip[INET6_ADDRSTRLEN];
+    inet_ntop(family, addr, ip, sizeof(ip));
+    snprintf(out, size, family == AF_INET6 ? "[%s]:%u" : "%s:%u", ip, port);
+}
+
+static int cmp_row(const void *a, const void *b) {
+    double x = ((const ConnRow *)a)->key, y = ((const ConnRow *)b)->key;
+    return (x < y) - (x > y);
+}
+
+/* by key, then busiest first so a quiet interval still shows something */
+static int cmp_agg(const void *a, const void *b) {
+    const Agg *x = *(Agg *const *)a, *y = *(Agg *const *)b;
+    if (x->key != y->key) return (x->key < y->key) - (x->key > y->key);
+    return (x->conns < y->conns) - (x->conns > y->conns);
+}
+
+static void print_aggs(AggTable *t, int by_port_table, int top_n, int secs) {
+    static Agg **order;
+    if (!order && !(order = malloc((AGG_MAX + 1) * sizeof(*order)))) {
+        perror("malloc"); exit(EXIT_FAILURE);
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < t->n; i++) order[n++] = &t->v[t->used[i]];
+    if (t->other.conns) order[n++] = &t->other;
+    for (size_t i = 0; i < n; i++)
+        order[i]->key = conn_sort_rtt ? order[i]->rtt_sum / order[i]->conns
+                                      : (double)order[i]->retrans;
+    qsort(order, n, sizeof(*order), cmp_agg);
+
+    printf("\n%-28s %8s %9s %11s %11s %11s\n",
+           by_port_table ? "LOCAL PORT" : "REMOTE NETWORK",
+           "CONNS", "RETR/s", "AVG RTT ms", "MAX RTT ms", "ACKED KB/s");
+    printf("%-28s %8s %9s %11s %11s %11s\n", "----------------------------",
+           "--------", "---------", "-----------", "-----------", "-----------");
+    for (size_t i = 0; i < n && i < (size_t)top_n; i++) {
+        const Agg *a = order[i];
+        char label[64];
+        if (a == &t->other)
+            snprintf(label, sizeof(label), "(other)");
+        else if (by_port_table)
+            snprintf(label, sizeof(label), "%u%s", a->port,
+                     a->family == AF_INET6 ? " (IPv6)" : "");
+        else {
+            char ip[INET6_ADDRSTRLEN];
+            inet_ntop(a->family, a->addr, ip, sizeof(ip));
+            snprintf(label, sizeof(label), "%s/%d", ip, a->family == AF_INET ? 24 : 64);
+        }
+        printf("%-28s %8u %9.1f %11.2f %11.2f %11.1f\n", label, a->conns,
+               (double)a->retrans / secs, a->rtt_sum / a->conns, a->rtt_max,
+               a->acked / 1024.0 / secs);
+    }
+}
+
+static int conn_loop(int top_n, int secs) {
+    /* this mode has no use for rtnetlink: nl_talk() speaks sock_diag */
+    nl_sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_SOCK_DIAG);
+    if (nl_sock < 0) { perror("NETLINK_SOCK_DIAG"); return -1; }
+    conn_top  = top_n;
+    conn_heap = malloc((size_t)top_n * sizeof(*conn_heap));
+    if (!conn_heap) { perror("malloc"); return -1; }
+    agg_init(&by_net);
+    agg_init(&by_port);
+
+    if (conn_collect() < 0) { perror("sock_diag"); return -1; }
+    conn_primed = 1;
+    prev_retrans = read_retransmits();
+
+    for (;;) {
+        sleep(secs);
+        double t0 = now_sec();
+        if (conn_collect() < 0) { perror("sock_diag"); return -1; }
+        double dump_ms = (now_sec() - t0) * 1e3;
+        long long retrans_now = read_retransmits();
+
+        qsort(conn_heap, conn_heap_n, sizeof(*conn_heap), cmp_row);
+        printf("\033[2J\033[H");
+        printf("%-24s %-28s %8s %7s %6s %7s %8s %10s %10s %8s %8s %8s  sort:%s\n",
+               "LOCAL", "REMOTE", "RTT ms", "RTTVAR", "CWND", "RETR/s", "RETR tot",
+               "ACKED KB/s", "DELIV Mb/s", "SEND-Q", "RECV-Q", "NOTSENT",
+               conn_sort_rtt ? "RTT" : "RETRANS");
+        printf("%-24s %-28s %8s %7s %6s %7s %8s %10s %10s %8s %8s %8s\n",
+               "------------------------", "----------------------------",
+               "--------", "-------", "------", "-------", "--------",
+               "----------", "----------", "--------", "--------", "--------");
+        for (int i = 0; i < conn_heap_n; i++) {
+            const ConnRow *r = &conn_heap[i];
+            char l[64], p[64];
+            fmt_endpoint(r->family, r->src, r->sport, l, sizeof(l));
+            fmt_endpoint(r->family, r->dst, r->dport, p, sizeof(p));
+            printf("%-24s %-28s %8.2f %7.2f %6u %7.1f %8u %10.1f %10.1f %8u %8u %8u\n",
+                   l, p, r->rtt_ms, r->rttvar_ms, r->cwnd, (double)r->retrans / secs,
+                   r->total_retrans, r->acked / 1024.0 / secs,
+                   r->delivery_rate * 8 / 1e6, r->wqueue, r->rqueue, r->notsent);
+        }
+        if (conn_heap_n == 0)
+            printf("(no connection retransmitted this interval)\n");
+
+        print_aggs(&by_net, 0, top_n, secs);
+        print_aggs(&by_port, 1, top_n, secs);
+
+        printf("\n%zu TCP sockets dumped in %.1f ms, %.1f MB kept",
+               conn_seen, dump_ms,
+               (conns_a.cap + conns_b.cap) * sizeof(ConnState) / 1048576.0 +
+               (conn_ix.mask + 1) * sizeof(int) / 1048576.0);
+        if (conn_untracked) printf(" (%zu untracked)", conn_untracked);
+        if (conn_saturated) printf(" (sockets missing from the last dump not counted)");
+        if (retrans_now >= 0 && prev_retrans >= 0)
+            printf("  TCP retransmits/s: %.1f", (double)(retrans_now - prev_retrans) / secs);
+        prev_retrans = retrans_now;
+        printf("\n");
+        fflush(stdout);
+    }
+}
+
+/* ---- Benchmark (-B) ----------------------------------------------------- */
+/* Creates n interfaces (n / 2 veth pairs) in a private network namespace
+   and times one tick's collection (stats dump, ifindex matching and
+   labelling), a full RTM_GETLINK dump (first tick, new interfaces and
+   every LINK_REFRESH ticks), and reading the whole of /proc/net/dev and
+   matching names with a nested strcmp loop as netwatch used to (without
+   its 32-interface cap). */
+static void nla_put(struct nlmsghdr *h, int type, const void *data, int len) {
+    struct rtattr *a = (struct rtattr *)((char *)h + NLMSG_ALIGN(h->nlmsg_len));
+    a->rta_type = type;
+    a->rta_len  = RTA_LENGTH(len);
+    if (len) memcpy(RTA_DATA(a), data, len);
+    h->nlmsg_len = NLMSG_ALIGN(h->nlmsg_len) + RTA_ALIGN(a->rta_len);
+}
+
+static struct rtattr *nla_nest(struct nlmsghdr *h, int type) {
+    struct rtattr *a = (struct rtattr *)((char *)h + NLMSG_ALIGN(h->nlmsg_len));
+    nla_put(h, type, NULL, 0);
+    return a;
+}
+
+static void nla_end(struct nlmsghdr *h, struct rtattr *a) {
+    a->rta_len = (unsigned short)((char *)h + h->nlmsg_len - (char *)a);
+}
+
+static void ignore_reply(struct nlmsghdr *h, void *arg) {
+    (void)h; (void)arg;
+}
+
+static int add_veth(int i) {
+    char buf[512] = {0};
+    struct nlmsghdr *h = (struct nlmsghdr *)buf;
+    h->nlmsg_len   = NLMSG_LENGTH(sizeof(struct ifinfomsg));
+    h->nlmsg_type  = RTM_NEWLINK;
+    h->nlmsg_flags = NLM_F_REQUEST | NLM_F_CREATE | NLM_F_EXCL | NLM_F_ACK;
+
+    char name[32];                     /* IFNAMSIZ caps it at 15, checked by the kernel */
+    snprintf(name, sizeof(name), "bench%da", i);
+    nla_put(h, IFLA_IFNAME, name, (int)strlen(name) + 1);
+    struct rtattr *info = nla_nest(h, IFLA_LINKINFO);
+    nla_put(h, IFLA_INFO_KIND, "veth", 5);
+    struct rtattr *data = nla_nest(h, IFLA_INFO_DATA);
+    struct rtattr *peer = nla_nest(h, VETH_INFO_PEER);
+    struct ifinfomsg ifi = { .ifi_family = AF_UNSPEC };
+    memcpy((char *)h + h->nlmsg_len, &ifi, sizeof(ifi));
+    h->nlmsg_len += NLMSG_ALIGN(sizeof(ifi));
+    snprintf(name, sizeof(name), "bench%db", i);
+    nla_put(h, IFLA_IFNAME, name, (int)strlen(name) + 1);
+    nla_end(h, peer);
+    nla_end(h, data);
+    nla_end(h, info);
+
+    return nl_talk(h, ignore_reply, NULL);
+}
+
+/* The old collection: all of /proc/net/dev, then a nested name match */
+static size_t old_tick(char **buf, size_t *cap, IfTable *curr, const IfTable *prev) {
+    int fd = open("/proc/net/dev", O_RDONLY);
+    if (fd < 0) return 0;
+    size_t len = 0;
+    ssize_t n;
+    for (;;) {
+        if (len + BUF_SIZE > *cap) {
+            *cap = *cap ? *cap * 2 : 65536;
+            if (!(*buf = realloc(*buf, *cap))) { perror("realloc"); exit(EXIT_FAILURE); }
+        }
+        if ((n = read(fd, *buf + len, *cap - len - 1)) <= 0) break;
+        len += (size_t)n;
+    }
+    close(fd);
+    (*buf)[len] = '\0';
+
+    curr->n = 0;
+    char *save, *line = strtok_r(*buf, "\n", &save);
+    if (line) line = strtok_r(NULL, "\n", &save);
+    while ((line = strtok_r(NULL, "\n", &save))) {
+        char *colon = strchr(line, ':');
+        if (!colon) continue;
+        char *p = line;
+        while (*p == ' ') p++;
+        Iface *f = if_push(curr);
+        snprintf(f->name, sizeof(f->name), "%.*s", (int)(colon - p), p);
+        unsigned long long v[16];
+        sscanf(colon + 1, "%llu %llu %llu %llu %llu %llu %llu %llu"
+               " %llu %llu %llu %llu %llu %llu %llu %llu",
+               &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7],
+               &v[8], &v[9], &v[10], &v[11], &v[12], &v[13], &v[14], &v[15]);
+        f->rx_bytes = v[0]; f->tx_bytes = v[8];
+    }
+    size_t matched = 0;
+    for (size_t i = 0; i < curr->n; i++)
+        for (size_t j = 0; j < prev->n; j++)
+            if (strcmp(curr->v[i].name, prev->v[j].name) == 0) {
+                curr->v[i].traffic = (double)(curr->v[i].rx_bytes - prev->v[j].rx_bytes);
+                matched++;
+                break;
+            }
+    return matched;
+}
+
+static void bench(int n) {
+    if (unshare(CLONE_NEWNET) < 0) {
+        perror("unshare(CLONE_NEWNET), needs root");
+        exit(EXIT_FAILURE);
+    }
+    if (nl_open() < 0) { perror("netlink"); exit(EXIT_FAILURE); }
+    double t0 = now_sec();
+    for (int i = 0; i < n / 2; i++)
+        if (add_veth(i) < 0) { perror("RTM_NEWLINK veth"); exit(EXIT_FAILURE); }
+    printf("created %d interfaces in %.1f s\n\n", n / 2 * 2, now_sec() - t0);
+
+    IfTable a = {0}, b = {0};
+    IfTable *curr = &a, *prev = &b;
+    Index ix = {0};
+    int ticks = 0;
+    double t_new = 0;
+    size_t matched = 0;
+    collect(prev, curr, &ix);
+    while (t_new < 1.0 || ticks < 5) {
+        t0 = now_sec();
+        if (tick % LINK_REFRESH == 0) tick++;  /* refresh dumps timed below */
+        if (collect(curr, prev, &ix) < 0) { perror("netlink"); exit(EXIT_FAILURE); }
+        matched = 0;
+        for (size_t i = 0; i < curr->n; i++) {
+            const Iface *p = index_find(&ix, prev, curr->v[i].ifindex);
+            if (p) { curr->v[i].traffic = (double)(curr->v[i].rx_bytes - p->rx_bytes); matched++; }
+        }
+        t_new += now_sec() - t0;
+        ticks++;
+        IfTable *t = curr; curr = prev; prev = t;
+    }
+    printf("%-10zu %-14s %12.1f us/tick  (%d ticks, %zu matched)\n", curr->n,
+           "stats+hash", t_new * 1e6 / ticks, ticks, matched);
+
+    double t_link = 0;
+    for (ticks = 0; t_link < 1.0 || ticks < 5; ticks++) {
+        t0 = now_sec();
+        links.n = 0;
+        if (link_query(&links, 0) < 0) { perror("RTM_GETLINK"); exit(EXIT_FAILURE); }
+        t_link += now_sec() - t0;
+    }
+    printf("%-10zu %-14s %12.1f us/dump  (%d dumps)\n", links.n,
+           "link dump", t_link * 1e6 / ticks, ticks);
+
+    char *buf = NULL;
+    size_t cap = 0;
+    double t_old = 0;
+    old_tick(&buf, &cap, prev, curr);
+    for (ticks = 0; t_old < 1.0 || ticks < 5; ticks++) {
+        t0 = now_sec();
+        matched = old_tick(&buf, &cap, curr, prev);
+        t_old += now_sec() - t0;
+        IfTable *t = curr; curr = prev; prev = t;
+    }
+    printf("%-10zu %-14s %12.1f us/tick  (%d ticks, %zu matched)\n", curr->n,
+           "procfs+strcmp", t_old * 1e6 / ticks, ticks, matched);
+    free(buf); free(a.v); free(b.v); free(ix.slot);
+}
+
 static void print_header(void) {
-    printf("\n%-12s %10s %10s %10s %10s %10s %10s %10s\n",
-           "Interface", "RX MB/s", "TX MB/s",
+    printf("\n%-15s %-8s %10s %10s %10s %10s %10s %10s %10s\n",
+           "Interface", "Type", "RX MB/s", "TX MB/s",
            "RX kpps", "TX kpps",
            "RX err/s", "TX err/s", "TCP conns");
-    printf("%-12s %10s %10s %10s %10s %10s %10s %10s\n",
-           "------------","----------","----------",
+    printf("%-15s %-8s %10s %10s %10s %10s %10s %10s %10s\n",
+           "---------------", "--------", "----------","----------",
            "----------","----------","----------","----------","----------");
 }
 
-int main(void) {
-    Iface curr[MAX_IFACES];
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-g glob]... [-t type]... [-n N] [-u ms | -C | -R | -S] [-B interfaces]\n", prog);
+    fprintf(stderr, "  -g glob  only interfaces whose name matches (e.g. 'veth*')\n");
+    fprintf(stderr, "  -t type  only this type: veth, bridge, vxlan, ..., phys, loopback\n");
+    fprintf(stderr, "  -n N     busiest N interfaces by RX+TX bytes (default: all)\n");
+    fprintf(stderr, "  -u ms    microbursts: sample every ms (1-1000), report avg/p99/peak each second\n");
+    fprintf(stderr, "           for the busiest %d selected interfaces (fewer with -n)\n", BURST_MAX);
+    fprintf(stderr, "  -C       TCP connections: top N by retransmits, by remote /24 and local port\n");
+    fprintf(stderr, "  -R       same, by RTT\n");
+    fprintf(stderr, "  -S       TCP/IP saturation: drop, prune, overflow and retry counters per\n");
+    fprintf(stderr, "           second, and per-CPU softnet drops and time_squeeze\n");
+    fprintf(stderr, "  -B N     benchmark collection with N interfaces (root, private netns)\n");
+}
+
+int main(int argc, char *argv[]) {
+    int top_n   = 0;
+    int bench_n = 0;
+    int burst_ms = 0;
+    int conn_mode = 0;
+    int sat_mode  = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-g") == 0 && i + 1 < argc && nglobs < MAX_FILTERS) {
+            globs[nglobs++] = argv[++i];
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc && nkinds < MAX_FILTERS) {
+            kinds[nkinds++] = argv[++i];
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            top_n = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-u") == 0 && i + 1 < argc) {
+            burst_ms = atoi(argv[++i]);
+            if (burst_ms < 1 || burst_ms > 1000) { usage(argv[0]); return EXIT_FAILURE; }
+        } else if (strcmp(argv[i], "-C") == 0) {
+            conn_mode = 1;
+        } else if (strcmp(argv[i], "-R") == 0) {
+            conn_mode = conn_sort_rtt = 1;
+        } else if (strcmp(argv[i], "-S") == 0) {
+            sat_mode = 1;
+        } else if (strcmp(argv[i], "-B") == 0 && i + 1 < argc) {
+            bench_n = atoi(argv[++i]);
+        } else {
+            usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+
+    if (bench_n > 0) {
+        bench(bench_n);
+        return EXIT_SUCCESS;
+    }
+    if ((conn_mode != 0) + (burst_ms != 0) + sat_mode > 1) { usage(argv[0]); return EXIT_FAILURE; }
+    if (sat_mode) return sat_loop(1) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    if (conn_mode) return conn_loop(top_n > 0 ? top_n : 10, 1) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+    if (nl_open() < 0) { perror("netlink"); return EXIT_FAILURE; }
+    if (burst_ms > 0) return burst_loop(burst_ms, top_n) < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+
+    IfTable bufA = {0}, bufB = {0};
+    IfTable *curr = &bufA, *prev = &bufB;
+    Index ix = {0};
     int sample = 0;
 
-    prev_n = read_net_dev(prev, MAX_IFACES);
+    if (collect(prev, curr, &ix) < 0) { perror("netlink"); return EXIT_FAILURE; }
     read_retransmits(); /* discard first reading to prime delta */
     sleep(1);
 
     print_header();
 
     while (1) {
-        int curr_n = read_net_dev(curr, MAX_IFACES);
+        if (collect(curr, prev, &ix) < 0) { perror("netlink"); return EXIT_FAILURE; }
         long long retrans_now = read_retransmits();
         int conns             = read_tcp_conns();
 
@@ -135,40 +1483,36 @@ int main(void) {
             retrans_delta = retrans_now - prev_retrans;
         prev_retrans = retrans_now;
 
-        int printed = 0;
-        for (int i = 0; i < curr_n; i++) {
-            if (strcmp(curr[i].name, "lo") == 0) continue;
-
-            Iface *p = NULL;
-            for (int j = 0; j < prev_n; j++) {
-                if (strcmp(curr[i].name, prev[j].name) == 0) {
-                    p = &prev[j]; break;
-                }
-            }
-            if (!p) continue;
+        size_t added;
+        size_t nrows   = pick_rows(curr, prev, &ix, top_n, &added);
+        size_t removed = prev->n - (curr->n - added);
 
-            double rx_mb = (double)(curr[i].rx_bytes - p->rx_bytes) / 1048576.0;
-            double tx_mb = (double)(curr[i].tx_bytes - p->tx_bytes) / 1048576.0;
-            double rx_kp = (double)(curr[i].rx_pkts  - p->rx_pkts)  / 1000.0;
-            double tx_kp = (double)(curr[i].tx_pkts  - p->tx_pkts)  / 1000.0;
-            long long rxe = (long long)(curr[i].rx_errs - p->rx_errs);
-            long long txe = (long long)(curr[i].tx_errs - p->tx_errs);
+        for (size_t i = 0; i < nrows; i++) {
+            const Iface *c = rows[i];
+            const Iface *p = index_find(&ix, prev, c->ifindex);
+            double rx_mb = (double)(c->rx_bytes - p->rx_bytes) / 1048576.0;
+            double tx_mb = (double)(c->tx_bytes - p->tx_bytes) / 1048576.0;
+            double rx_kp = (double)(c->rx_pkts  - p->rx_pkts)  / 1000.0;
+            double tx_kp = (double)(c->tx_pkts  - p->tx_pkts)  / 1000.0;
+            long long rxe = (long long)(c->rx_errs - p->rx_errs);
+            long long txe = (long long)(c->tx_errs - p->tx_errs);
 
             char conns_str[16] = "  -";
-            if (printed == 0 && conns >= 0)
+            if (i == 0 && conns >= 0)
                 snprintf(conns_str, sizeof(conns_str), "%d", conns);
 
-            printf("%-12s %10.3f %10.3f %10.3f %10.3f %10lld %10lld %10s\n",
-                   curr[i].name, rx_mb, tx_mb, rx_kp, tx_kp,
+            printf("%-15s %-8.8s %10.3f %10.3f %10.3f %10.3f %10lld %10lld %10s\n",
+                   c->name, c->kind, rx_mb, tx_mb, rx_kp, tx_kp,
                    rxe < 0 ? 0 : rxe, txe < 0 ? 0 : txe, conns_str);
-            printed++;
         }
 
         if (retrans_now >= 0)
-            printf("  TCP retransmits/s: %lld\n", retrans_delta);
+            printf("  TCP retransmits/s: %lld", retrans_delta);
+        printf("  interfaces: %zu", curr->n);
+        if (added || removed) printf(" (+%zu -%zu)", added, removed);
+        printf("\n");
 
-        memcpy(prev, curr, sizeof(Iface) * curr_n);
-        prev_n = curr_n;
+        IfTable *t = curr; curr = prev; prev = t;
         fflush(stdout);
 
         if (++sample % HDR_EVERY == 0) print_header();
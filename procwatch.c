@@ -1,194 +1,1746 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <poll.h>
+#include <errno.h>
 #include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include <linux/genetlink.h>
+#include <linux/taskstats.h>
 
-#define MAX_PROCS 2048
 #define NAME_LEN  64
 #define BUF_SIZE  512
 
 typedef struct {
-    pid_t              pid;
+    pid_t              pid;            /* TID with -H */
+    pid_t              tgid;
     char               name[NAME_LEN];
+    unsigned long long start;          /* starttime, ticks since boot */
     unsigned long long utime, stime;
     long               rss_kb;
     double             cpu_pct;
+    /* -H: from schedstat, plus status for displayed rows (-1 = not read) */
+    unsigned long long run_ns, wait_ns;
+    double             wait_pct;
+    long long          vcsw, ivcsw;
+    int                cg;             /* -c: interned cgroup, -1 unknown */
+    /* -I: faults and block I/O delay from stat, rates from /proc/<pid>/io */
+    unsigned long      minflt, majflt;
+    unsigned long long blkio;
+    double             minflt_rate, majflt_rate, score;
+    double             rd_rate, wr_rate, scr_rate, scw_rate;
+    int                io_known;
+    /* -m: from smaps_rollup, possibly from an earlier tick */
+    long               pss_kb, uss_kb, swap_kb;
+    double             mem_age;        /* seconds, -1 = never read */
+    double             mem_prio;
 } ProcInfo;
 
 static long CLK_TCK;
+static int  thread_mode;               /* -H: one row per thread */
 
-static int read_stat(pid_t pid, ProcInfo *p) {
-    char path[64], buf[BUF_SIZE];
-    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* ---- Snapshots ---------------------------------------------------------- */
+/* One tick's processes; grows as needed, so there is no process cap. */
+typedef struct {
+    ProcInfo *v;
+    size_t    n, cap;
+} Snapshot;
+
+static ProcInfo *snap_push(Snapshot *s) {
+    if (s->n == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 1024;
+        ProcInfo *v = realloc(s->v, cap * sizeof(*v));
+        if (!v) { perror("realloc"); exit(EXIT_FAILURE); }
+        s->v   = v;
+        s->cap = cap;
+    }
+    return &s->v[s->n++];
+}
+
+static void snap_reserve(Snapshot *s, size_t n) {
+    if (n <= s->cap) return;
+    size_t cap = s->cap ? s->cap : 1024;
+    while (cap < n) cap *= 2;
+    ProcInfo *v = realloc(s->v, cap * sizeof(*v));
+    if (!v) { perror("realloc"); exit(EXIT_FAILURE); }
+    s->v   = v;
+    s->cap = cap;
+}
+
+/* ---- PID + start-time index --------------------------------------------- */
+/* Open-addressed index over the previous snapshot, rebuilt once per tick.
+   Matching on start time as well as PID keeps a recycled PID from
+   inheriting the old process's CPU time. */
+typedef struct {
+    uint32_t *slot;                    /* snapshot index + 1, 0 = empty */
+    size_t    mask;
+} Index;
+
+static inline size_t proc_hash(pid_t pid, unsigned long long start) {
+    uint64_t h = ((uint64_t)(uint32_t)pid << 32 ^ start) * 0x9E3779B97F4A7C15ull;
+    return (size_t)(h ^ (h >> 29));
+}
+
+static void index_build(Index *ix, const Snapshot *s) {
+    size_t size = 1024;
+    while (size < s->n * 2) size <<= 1;
+    if (size != ix->mask + 1 || !ix->slot) {
+        free(ix->slot);
+        ix->slot = malloc(size * sizeof(uint32_t));
+        if (!ix->slot) { perror("malloc"); exit(EXIT_FAILURE); }
+        ix->mask = size - 1;
+    }
+    memset(ix->slot, 0, size * sizeof(uint32_t));
+    for (size_t i = 0; i < s->n; i++) {
+        size_t k = proc_hash(s->v[i].pid, s->v[i].start) & ix->mask;
+        while (ix->slot[k]) k = (k + 1) & ix->mask;
+        ix->slot[k] = (uint32_t)i + 1;
+    }
+}
+
+static const ProcInfo *index_find(const Index *ix, const Snapshot *s,
+                                  pid_t pid, unsigned long long start) {
+    size_t k = proc_hash(pid, start) & ix->mask;
+    for (uint32_t i; (i = ix->slot[k]) != 0; k = (k + 1) & ix->mask) {
+        const ProcInfo *p = &s->v[i - 1];
+        if (p->pid == pid && p->start == start) return p;
+    }
+    return NULL;
+}
+
+/* CPU% for every process in curr, from the matching entry in prev */
+static void compute_cpu(Snapshot *curr, const Snapshot *prev, Index *ix,
+                        double secs) {
+    index_build(ix, prev);
+    for (size_t i = 0; i < curr->n; i++) {
+        ProcInfo *p = &curr->v[i];
+        const ProcInfo *o = index_find(ix, prev, p->pid, p->start);
+        p->cpu_pct  = 0.0;
+        p->wait_pct = 0.0;
+        p->minflt_rate = p->majflt_rate = p->score = 0.0;
+        if (o && thread_mode) {
+            /* a reused TID restarts its counters; leave it at zero */
+            if (p->run_ns >= o->run_ns && p->wait_ns >= o->wait_ns) {
+                p->cpu_pct  = (p->run_ns - o->run_ns) / (secs * 1e7);
+                p->wait_pct = (p->wait_ns - o->wait_ns) / (secs * 1e7);
+            }
+        } else if (o) {
+            unsigned long long delta = (p->utime + p->stime) - (o->utime + o->stime);
+            p->cpu_pct = delta * 100.0 / (CLK_TCK * secs);
+            p->minflt_rate = (p->minflt - o->minflt) / secs;
+            p->majflt_rate = (p->majflt - o->majflt) / secs;
+            /* -I candidate score: kernel time, major faults, block I/O wait */
+            p->score = (double)(p->stime - o->stime) + (p->majflt - o->majflt) +
+                       (double)(p->blkio - o->blkio);
+        }
+    }
+}
+
+/* ---- Per-process fd cache ----------------------------------------------- */
+/* /proc/<pid> and /proc/<pid>/stat stay open across ticks and stat is
+   re-read with pread(), so a process costs one syscall per tick instead
+   of open/read/close on two files. Only new PIDs are opened. The open fds
+   pin the original process: once it exits (or its PID is reused) pread()
+   fails with ESRCH and the entry is closed and reopened. With -H the
+   entries are threads, /proc/<tgid>/task/<tid>, polling schedstat. */
+typedef struct {
+    pid_t pid;                         /* TID with -H */
+    pid_t tgid;
+    int   dir;                         /* O_PATH /proc/<pid>, or -1 */
+    int   stat;                        /* its stat (schedstat with -H), or -1 */
+    int   cg;                          /* -c: interned cgroup, -1 unknown */
+    int   io;                          /* -I: /proc/<pid>/io once a candidate */
+    unsigned long long start;          /* of the process or thread, 0 = unknown */
+    unsigned long long rd, wr, scr, scw;   /* its last reading */
+    double io_at;                      /* when, 0 = never */
+    long  pss, uss, swap;              /* -m: last smaps_rollup */
+    long  mem_rss;                     /* RSS at the time */
+    unsigned long long mem_start;      /* start time of the process read */
+    double mem_at;                     /* when, 0 = never */
+} ProcFds;
+
+typedef struct {
+    ProcFds *v;
+    size_t   n, cap;
+} FdCache;
+
+static FdCache fdc, fdc_next;
+static long    PAGE_KB;
+
+/* Entries allowed to hold fds, leaving headroom for reads by path */
+static long         fd_budget;
+static _Atomic long fd_entries;
+
+static void fds_close(ProcFds *f) {
+    if (f->stat >= 0) close(f->stat);
+    if (f->io >= 0)   close(f->io);
+    if (f->dir >= 0) {
+        close(f->dir);
+        atomic_fetch_sub_explicit(&fd_entries, 1, memory_order_relaxed);
+    }
+    f->stat = f->io = f->dir = -1;
+    /* the PID may be reused: forget what belonged to the old process */
+    f->cg     = -1;
+    f->io_at  = 0;
+    f->start  = 0;
+}
+
+static void unit_path(const ProcFds *f, const char *file, char *path, size_t size) {
+    if (thread_mode)
+        snprintf(path, size, "/proc/%d/task/%d/%s", f->tgid, f->pid, file);
+    else
+        snprintf(path, size, "/proc/%d/%s", f->pid, file);
+}
+
+static void fds_open(ProcFds *f) {
+    f->dir = f->stat = -1;
+    if (atomic_fetch_add_explicit(&fd_entries, 1, memory_order_relaxed) >= fd_budget) {
+        atomic_fetch_sub_explicit(&fd_entries, 1, memory_order_relaxed);
+        return;
+    }
+    char path[64];
+    unit_path(f, "", path, sizeof(path));
+    f->dir = open(path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (f->dir < 0) {
+        atomic_fetch_sub_explicit(&fd_entries, 1, memory_order_relaxed);
+        return;
+    }
+    f->stat = openat(f->dir, thread_mode ? "schedstat" : "stat", O_RDONLY | O_CLOEXEC);
+    if (f->stat < 0) fds_close(f);
+}
+
+static void fdc_reserve(FdCache *c, size_t n) {
+    if (n <= c->cap) return;
+    size_t cap = c->cap ? c->cap : 1024;
+    while (cap < n) cap *= 2;
+    ProcFds *v = realloc(c->v, cap * sizeof(*v));
+    if (!v) { perror("realloc"); exit(EXIT_FAILURE); }
+    c->v   = v;
+    c->cap = cap;
+}
+
+/* First cached entry with pid >= the given one */
+static size_t fdc_lower(pid_t pid) {
+    size_t lo = 0, hi = fdc.n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (fdc.v[mid].pid < pid) lo = mid + 1; else hi = mid;
+    }
+    return lo;
+}
+
+/* Each entry holds two fds, three with -I once its io file is opened;
+   lift the soft limit so large hosts fit */
+static void fd_limit_init(int per_entry) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0) return;
+    if (rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) < 0) getrlimit(RLIMIT_NOFILE, &rl);
+    }
+    rlim_t lim = rl.rlim_cur == RLIM_INFINITY || rl.rlim_cur > (1u << 30)
+               ? (1u << 30) : rl.rlim_cur;
+    fd_budget = lim > 256 ? (long)(lim - 256) / per_entry : 0;
+}
+
+static ssize_t read_cached(ProcFds *f, char *buf, size_t size) {
+    if (f->stat >= 0) {
+        ssize_t n = pread(f->stat, buf, size, 0);
+        if (n > 0) return n;
+        fds_close(f);                  /* exited, or PID reused */
+        fds_open(f);
+        if (f->stat >= 0 && (n = pread(f->stat, buf, size, 0)) > 0) return n;
+        return -1;
+    }
+    /* Over the fd budget: read by path, and try to cache it next tick */
+    char path[64];
+    unit_path(f, thread_mode ? "schedstat" : "stat", path, sizeof(path));
     int fd = open(path, O_RDONLY);
     if (fd < 0) return -1;
-    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    ssize_t n = read(fd, buf, size);
     close(fd);
-    if (n <= 0) return -1;
-    buf[n] = '\0';
+    return n;
+}
 
+static int parse_stat(char *buf, ProcInfo *p) {
     char *s = strchr(buf, '(');
     char *e = strrchr(buf, ')');
     if (!s || !e) return -1;
 
-    p->pid = pid;
     int nl = (int)(e - s - 1);
     if (nl >= NAME_LEN) nl = NAME_LEN - 1;
     strncpy(p->name, s + 1, nl);
     p->name[nl] = '\0';
 
     /* fields after ')': state ppid pgroup session tty tpgid flags
-       minflt cminflt majflt cmajflt utime stime ... */
+       minflt cminflt majflt cmajflt utime stime cutime cstime priority
+       nice num_threads itrealvalue starttime vsize rss, then 17 fields up
+       to delayacct_blkio_ticks (0 unless delay accounting is on) */
     char state;
     int  ppid, pgrp, sess, tty, tpgid;
-    unsigned long flags, minflt, cminflt, majflt, cmajflt;
-    unsigned long long utime, stime;
+    unsigned long flags, minflt, cminflt, majflt, cmajflt, vsize;
+    unsigned long long utime, stime, start, blkio = 0;
+    long cutime, cstime, prio, nice, nthreads, itreal, rss;
     if (sscanf(e + 2,
-        "%c %d %d %d %d %d %lu %lu %lu %lu %lu %llu %llu",
+        "%c %d %d %d %d %d %lu %lu %lu %lu %lu %llu %llu %ld %ld %ld %ld %ld %ld %llu %lu %ld"
+        " %*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*d %*d %*u %*u %llu",
         &state, &ppid, &pgrp, &sess, &tty, &tpgid,
         &flags, &minflt, &cminflt, &majflt, &cmajflt,
-        &utime, &stime) < 13) return -1;
+        &utime, &stime, &cutime, &cstime, &prio, &nice, &nthreads, &itreal,
+        &start, &vsize, &rss, &blkio) < 22) return -1;
 
-    p->utime = utime;
-    p->stime = stime;
+    p->utime  = utime;
+    p->stime  = stime;
+    p->start  = start;
+    p->rss_kb = rss * PAGE_KB;         /* same count as VmRSS in status */
+    p->minflt = minflt;
+    p->majflt = majflt;
+    p->blkio  = blkio;
     return 0;
 }
 
-static void read_status_rss(pid_t pid, ProcInfo *p) {
-    char path[64], buf[2048];
-    snprintf(path, sizeof(path), "/proc/%d/status", pid);
-    int fd = open(path, O_RDONLY);
-    if (fd < 0) return;
+/* schedstat: time on CPU, time runnable but waiting (ns), timeslices */
+static int parse_schedstat(const char *buf, ProcInfo *p) {
+    if (sscanf(buf, "%llu %llu", &p->run_ns, &p->wait_ns) != 2) return -1;
+    p->name[0] = '\0';                 /* read for displayed rows only */
+    return 0;
+}
+
+/* Start time of a -H thread, field 22 of its stat. schedstat has none,
+   so this is read once per new TID (every tick for threads over the fd
+   budget, whose reuse nothing else would notice) and kept in the cache;
+   with the TID it keys the index, as the process start time does. */
+static unsigned long long thread_start(const ProcFds *f) {
+    char path[64], buf[BUF_SIZE];
+    unit_path(f, "stat", path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
     ssize_t n = read(fd, buf, sizeof(buf) - 1);
     close(fd);
+    if (n <= 0) return 0;
+    buf[n] = '\0';
+    char *e = strrchr(buf, ')');
+    unsigned long long start = 0;
+    if (!e || sscanf(e + 1, "%*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s"
+                            " %*s %*s %*s %*s %*s %*s %llu", &start) != 1)
+        return 0;
+    return start;
+}
+
+/* Name and context switch counts of a displayed -H row */
+static void read_thread_detail(ProcInfo *p) {
+    ProcFds f = { .pid = p->pid, .tgid = p->tgid, .dir = -1, .stat = -1, .cg = -1, .io = -1 };
+    char path[64], buf[2048];
+    unit_path(&f, "comm", path, sizeof(path));
+    int fd = open(path, O_RDONLY);
+    ssize_t n = fd < 0 ? -1 : read(fd, p->name, NAME_LEN - 1);
+    if (fd >= 0) close(fd);
+    if (n > 0 && p->name[n - 1] == '\n') n--;
+    p->name[n > 0 ? n : 0] = '\0';
+
+    unit_path(&f, "status", path, sizeof(path));
+    fd = open(path, O_RDONLY);
+    n = fd < 0 ? -1 : read(fd, buf, sizeof(buf) - 1);
+    if (fd >= 0) close(fd);
     if (n <= 0) return;
     buf[n] = '\0';
+    char *v = strstr(buf, "\nvoluntary_ctxt_switches:");
+    char *iv = strstr(buf, "\nnonvoluntary_ctxt_switches:");
+    if (v && iv) {
+        p->vcsw  = strtoll(v + 26, NULL, 10);
+        p->ivcsw = strtoll(iv + 29, NULL, 10);
+    }
+}
 
-    char *line = strstr(buf, "VmRSS:");
-    if (line) {
-        unsigned long rss;
-        if (sscanf(line, "VmRSS: %lu kB", &rss) == 1)
-            p->rss_kb = (long)rss;
+/* ---- Cgroups (-c) ------------------------------------------------------- */
+/* With -c processes are grouped by their cgroup v2 path (optionally cut to
+   -d levels, e.g. the pod level under kubepods). Paths are interned once
+   per process into a hash table, and re-read every 16th tick to notice
+   migrations. Each cgroup's cpu.stat, memory.current and memory.pressure
+   stay open; they are re-read only for cgroups whose processes used CPU
+   this tick, for displayed rows and every 10th tick, since an idle
+   cgroup's counters barely move. Where a file is missing (the root
+   cgroup, or a controller not enabled) the process sums fill in. The
+   held files count against the same fd budget as the process cache (two
+   entries' worth); past it they are opened for each read. A cgroup left
+   without processes for CG_EVICT ticks is dropped, so pod churn neither
+   accumulates fds nor keeps deleted cgroups pinned in the kernel. */
+#define CG_EVICT 30
+typedef struct {
+    char    *path;                     /* relative to the cgroup2 mount */
+    uint64_t hash;
+    int      dir, cpu_fd, mem_fd, psi_fd;  /* -2 = not opened yet */
+    int      held;                     /* the fds above count in fd_entries */
+    unsigned idle;                     /* ticks in a row without processes */
+    uint64_t usage_usec;               /* last cpu.stat usage_usec */
+    double   read_at;                  /* when it was read, 0 = never */
+    double   cpu_pct, psi10;
+    long     mem_kb;
+    int      has_cpu, has_mem, has_psi;
+    unsigned nprocs;                   /* this tick's process sums */
+    double   sum_cpu;
+    long     sum_rss;
+} Cgroup;
+
+static int      cg_mode, cg_depth;
+static int      cg_root = -1;          /* cgroup2 mount */
+static Cgroup  *cgs;
+static size_t   ncgs, cgs_cap;         /* entries with path NULL are free */
+static int     *cg_free;               /* their indices */
+static size_t   ncg_free;
+static int     *cg_slot;               /* cgs index + 1, 0 = empty */
+static size_t   cg_mask;
+static unsigned tick_no;
+static pthread_mutex_t cg_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int cg_open_root(void) {
+    FILE *f = fopen("/proc/self/mountinfo", "r");
+    if (!f) return -1;
+    char line[1024], mnt[512], fstype[64];
+    while (fgets(line, sizeof(line), f)) {
+        /* id parent major:minor root mountpoint options [optional...] - fstype */
+        char *sep = strstr(line, " - ");
+        if (!sep || sscanf(sep + 3, "%63s", fstype) != 1 || strcmp(fstype, "cgroup2") != 0)
+            continue;
+        if (sscanf(line, "%*s %*s %*s %*s %511s", mnt) == 1) {
+            cg_root = open(mnt, O_PATH | O_DIRECTORY | O_CLOEXEC);
+            break;
+        }
     }
+    fclose(f);
+    return cg_root;
+}
+
+static uint64_t fnv1a(const char *s, size_t n) {
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < n; i++) h = (h ^ (unsigned char)s[i]) * 0x100000001b3ull;
+    return h;
 }
 
-static int collect(ProcInfo *procs, int max) {
+/* Caller holds cg_lock */
+static int cg_intern(const char *path, size_t len) {
+    uint64_t h = fnv1a(path, len);
+    if (cg_slot) {
+        for (size_t k = h & cg_mask; cg_slot[k]; k = (k + 1) & cg_mask) {
+            Cgroup *c = &cgs[cg_slot[k] - 1];
+            if (c->hash == h && strlen(c->path) == len && memcmp(c->path, path, len) == 0)
+                return cg_slot[k] - 1;
+        }
+    }
+    if (ncgs == cgs_cap && !ncg_free) {
+        cgs_cap = cgs_cap ? cgs_cap * 2 : 256;
+        cgs = realloc(cgs, cgs_cap * sizeof(*cgs));
+        cg_free = realloc(cg_free, cgs_cap * sizeof(*cg_free));
+        if (!cgs || !cg_free) { perror("realloc"); exit(EXIT_FAILURE); }
+    }
+    if (!cg_slot || (ncgs + 1) * 2 > cg_mask + 1) {
+        size_t size = cg_slot ? (cg_mask + 1) * 2 : 512;
+        int *slot = calloc(size, sizeof(int));
+        if (!slot) { perror("calloc"); exit(EXIT_FAILURE); }
+        for (size_t i = 0; i < ncgs; i++) {
+            if (!cgs[i].path) continue;
+            size_t k = cgs[i].hash & (size - 1);
+            while (slot[k]) k = (k + 1) & (size - 1);
+            slot[k] = (int)i + 1;
+        }
+        free(cg_slot);
+        cg_slot = slot;
+        cg_mask = size - 1;
+    }
+    int id = ncg_free ? cg_free[--ncg_free] : (int)ncgs++;
+    Cgroup *c = &cgs[id];
+    memset(c, 0, sizeof(*c));
+    c->path = strndup(path, len);
+    if (!c->path) { perror("strndup"); exit(EXIT_FAILURE); }
+    c->hash = h;
+    c->dir  = c->cpu_fd = c->mem_fd = c->psi_fd = -2;
+    size_t k = h & cg_mask;
+    while (cg_slot[k]) k = (k + 1) & cg_mask;
+    cg_slot[k] = id + 1;
+    return id;
+}
+
+/* The process's cgroup v2 path ("0::" line), interned; -1 if unknown */
+static int proc_cgroup(const ProcFds *f) {
+    char buf[4096];
+    ssize_t n = -1;
+    int fd = f->dir >= 0 ? openat(f->dir, "cgroup", O_RDONLY | O_CLOEXEC) : -1;
+    if (fd < 0) {
+        char path[64];
+        unit_path(f, "cgroup", path, sizeof(path));
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    if (fd >= 0) { n = read(fd, buf, sizeof(buf) - 1); close(fd); }
+    if (n <= 0) return -1;
+    buf[n] = '\0';
+
+    char *p = strncmp(buf, "0::", 3) == 0 ? buf : strstr(buf, "\n0::");
+    if (!p) return -1;
+    p += p == buf ? 3 : 4;
+    size_t len = strcspn(p, "\n");
+    if (cg_depth > 0) {
+        int depth = 0;
+        for (size_t i = 1; i < len; i++)
+            if (p[i] == '/' && ++depth == cg_depth) { len = i; break; }
+    }
+    pthread_mutex_lock(&cg_lock);
+    int id = cg_intern(p, len);
+    pthread_mutex_unlock(&cg_lock);
+    return id;
+}
+
+static ssize_t cg_pread(int fd, char *buf, size_t size) {
+    if (fd < 0) return -1;
+    ssize_t n = pread(fd, buf, size - 1, 0);
+    if (n > 0) buf[n] = '\0';
+    return n;
+}
+
+static void cg_close(Cgroup *c) {
+    if (c->dir >= 0)    close(c->dir);
+    if (c->cpu_fd >= 0) close(c->cpu_fd);
+    if (c->mem_fd >= 0) close(c->mem_fd);
+    if (c->psi_fd >= 0) close(c->psi_fd);
+    c->dir = c->cpu_fd = c->mem_fd = c->psi_fd = -2;
+    if (c->held) atomic_fetch_sub_explicit(&fd_entries, 2, memory_order_relaxed);
+    c->held = 0;
+}
+
+/* Closes cgroup id and frees its slot. Only called once it has had no
+   processes for CG_EVICT ticks, so no cache entry still refers to it. */
+static void cg_evict(int id) {
+    Cgroup *c = &cgs[id];
+    cg_close(c);
+    /* linear probing: delete by shifting later entries of the run back */
+    size_t k = c->hash & cg_mask;
+    while (cg_slot[k] != id + 1) k = (k + 1) & cg_mask;
+    for (size_t j = k;;) {
+        cg_slot[k] = 0;
+        for (;;) {
+            j = (j + 1) & cg_mask;
+            if (!cg_slot[j]) goto removed;
+            size_t h = cgs[cg_slot[j] - 1].hash & cg_mask;
+            if (k <= j ? (h <= k || h > j) : (h <= k && h > j)) break;
+        }
+        cg_slot[k] = cg_slot[j];
+        k = j;
+    }
+removed:
+    free(c->path);
+    c->path = NULL;
+    cg_free[ncg_free++] = id;
+}
+
+static void cg_read(Cgroup *c, double now) {
+    if (c->dir == -2) {
+        const char *rel = c->path[0] == '/' ? c->path + 1 : c->path;
+        c->held = atomic_fetch_add_explicit(&fd_entries, 2, memory_order_relaxed) + 2 <= fd_budget;
+        if (!c->held) atomic_fetch_sub_explicit(&fd_entries, 2, memory_order_relaxed);
+        c->dir    = openat(cg_root, *rel ? rel : ".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+        c->cpu_fd = c->dir < 0 ? -1 : openat(c->dir, "cpu.stat", O_RDONLY | O_CLOEXEC);
+        c->mem_fd = c->dir < 0 ? -1 : openat(c->dir, "memory.current", O_RDONLY | O_CLOEXEC);
+        c->psi_fd = c->dir < 0 ? -1 : openat(c->dir, "memory.pressure", O_RDONLY | O_CLOEXEC);
+        if (c->dir < 0 && c->held) {   /* gone: nothing to hold */
+            atomic_fetch_sub_explicit(&fd_entries, 2, memory_order_relaxed);
+            c->held = 0;
+        }
+    }
+    char buf[1024];
+    unsigned long long usage;
+    char *u;
+    c->has_cpu = 0;
+    if (cg_pread(c->cpu_fd, buf, sizeof(buf)) > 0 && (u = strstr(buf, "usage_usec ")) &&
+        sscanf(u, "usage_usec %llu", &usage) == 1) {
+        if (c->read_at > 0 && usage >= c->usage_usec) {
+            c->cpu_pct = (usage - c->usage_usec) / ((now - c->read_at) * 1e4);
+            c->has_cpu = 1;
+        }
+        c->usage_usec = usage;
+        c->read_at    = now;
+    }
+    unsigned long long bytes;
+    c->has_mem = cg_pread(c->mem_fd, buf, sizeof(buf)) > 0 && sscanf(buf, "%llu", &bytes) == 1;
+    if (c->has_mem) c->mem_kb = (long)(bytes / 1024);
+    c->has_psi = cg_pread(c->psi_fd, buf, sizeof(buf)) > 0 &&
+                 sscanf(buf, "some avg10=%lf", &c->psi10) == 1;
+    if (!c->held) cg_close(c);         /* over the fd budget: reopen next time */
+}
+
+static int cmp_cg_cpu(const void *a, const void *b) {
+    const Cgroup *x = &cgs[*(const int *)a], *y = &cgs[*(const int *)b];
+    double dx = x->has_cpu ? x->cpu_pct : x->sum_cpu;
+    double dy = y->has_cpu ? y->cpu_pct : y->sum_cpu;
+    return (dx < dy) - (dx > dy);
+}
+
+static int cmp_cg_mem(const void *a, const void *b) {
+    const Cgroup *x = &cgs[*(const int *)a], *y = &cgs[*(const int *)b];
+    long mx = x->has_mem ? x->mem_kb : x->sum_rss;
+    long my = y->has_mem ? y->mem_kb : y->sum_rss;
+    return (mx < my) - (mx > my);
+}
+
+/* Sum this tick's processes per cgroup, refresh the cgroup files that can
+   have changed and print the top n. Values marked '*' are process sums. */
+static void print_cgroups(const Snapshot *s, int top_n, int sort_mem, double now) {
+    static int *order;
+    static size_t order_cap;
+    for (size_t i = 0; i < ncgs; i++) {
+        cgs[i].nprocs  = 0;
+        cgs[i].sum_cpu = 0;
+        cgs[i].sum_rss = 0;
+    }
+    for (size_t i = 0; i < s->n; i++) {
+        const ProcInfo *p = &s->v[i];
+        if (p->cg < 0) continue;
+        cgs[p->cg].nprocs++;
+        cgs[p->cg].sum_cpu += p->cpu_pct;
+        cgs[p->cg].sum_rss += p->rss_kb;
+    }
+    if (ncgs > order_cap) {
+        order_cap = cgs_cap;
+        order = realloc(order, order_cap * sizeof(*order));
+        if (!order) { perror("realloc"); exit(EXIT_FAILURE); }
+    }
+    size_t n = 0;
+    int refresh = tick_no % 10 == 0;
+    for (size_t i = 0; i < ncgs; i++) {
+        Cgroup *c = &cgs[i];
+        if (!c->path) continue;
+        if (!c->nprocs) {
+            if (++c->idle >= CG_EVICT) cg_evict((int)i);
+            continue;
+        }
+        c->idle = 0;
+        if (refresh || c->read_at == 0 || c->sum_cpu > 0) cg_read(c, now);
+        else c->has_cpu = 0;          /* idle: the process sum (0) stands */
+        order[n++] = (int)i;
+    }
+    qsort(order, n, sizeof(*order), sort_mem ? cmp_cg_mem : cmp_cg_cpu);
+
+    printf("%-44s %6s %8s %10s %8s  sort:%s\n", "CGROUP", "PROCS", "CPU%",
+           "MEM (MB)", "PSI10", sort_mem ? "MEM" : "CPU");
+    printf("%-44s %6s %8s %10s %8s\n", "--------------------------------------------",
+           "------", "--------", "----------", "--------");
+    for (size_t i = 0; i < n && i < (size_t)top_n; i++) {
+        const Cgroup *c = &cgs[order[i]];
+        size_t len = strlen(c->path);
+        const char *shown = len > 44 ? c->path + len - 44 : c->path;
+        char psi[16] = "-";
+        if (c->has_psi) snprintf(psi, sizeof(psi), "%.2f", c->psi10);
+        printf("%-44s %6u %7.1f%c %9.1f%c %8s\n", *shown ? shown : "/", c->nprocs,
+               c->has_cpu ? c->cpu_pct : c->sum_cpu, c->has_cpu ? '%' : '*',
+               (c->has_mem ? c->mem_kb : c->sum_rss) / 1024.0, c->has_mem ? ' ' : '*',
+               psi);
+    }
+    printf("\n%zu cgroups with processes; * = summed from processes\n", n);
+}
+
+/* ---- Collection --------------------------------------------------------- */
+/* The main thread lists /proc into pids[] (in ascending order, which the
+   cache is kept in too) and cuts the list into chunks that it and the
+   -j - 1 workers claim from an atomic counter. Chunk c owns the PIDs at
+   pids[c * CHUNK ...] plus the cached entries in the same PID range, and
+   writes its results to the same positions of the snapshot and the next
+   cache, so nothing is locked while reading. Once every chunk is done the
+   main thread closes the gaps. */
+#define CHUNK 128
+
+static pid_t    *pids;
+static pid_t    *tgids;                /* -H: process of each pids[] entry */
+static size_t    npids, pids_cap, tgids_cap;
+static size_t    nchunks;
+static size_t   *chunk_n;              /* results per chunk */
+static Snapshot *chunk_snap;
+static _Atomic size_t next_chunk;
+static int       nworkers = 1;
+static pthread_barrier_t start_bar, done_bar;
+
+static int list_pids(void) {
     DIR *dir = opendir("/proc");
     if (!dir) return -1;
     struct dirent *ent;
-    int count = 0;
-    while ((ent = readdir(dir)) != NULL && count < max) {
+    npids = 0;
+    while ((ent = readdir(dir)) != NULL) {
         if (ent->d_name[0] < '1' || ent->d_name[0] > '9') continue;
         pid_t pid = (pid_t)atoi(ent->d_name);
         if (pid <= 0) continue;
-        procs[count].rss_kb  = 0;
-        procs[count].cpu_pct = 0.0;
-        if (read_stat(pid, &procs[count]) == 0) {
-            read_status_rss(pid, &procs[count]);
-            count++;
+        if (npids == pids_cap) {
+            pids_cap = pids_cap ? pids_cap * 2 : 1024;
+            pids = realloc(pids, pids_cap * sizeof(*pids));
+            if (!pids) { perror("realloc"); exit(EXIT_FAILURE); }
         }
+        pids[npids++] = pid;
     }
     closedir(dir);
-    return count;
+    return 0;
 }
 
-static int cmp_cpu(const void *a, const void *b) {
-    double da = ((const ProcInfo *)a)->cpu_pct;
-    double db = ((const ProcInfo *)b)->cpu_pct;
-    return (db > da) - (db < da);
+/* -H: every thread of every process, in TID order */
+typedef struct { pid_t tid, tgid; } TidEnt;
+
+static int cmp_tid(const void *a, const void *b) {
+    pid_t x = ((const TidEnt *)a)->tid, y = ((const TidEnt *)b)->tid;
+    return (x > y) - (x < y);
 }
 
-static int cmp_mem(const void *a, const void *b) {
-    long la = ((const ProcInfo *)a)->rss_kb;
-    long lb = ((const ProcInfo *)b)->rss_kb;
-    return (lb > la) - (lb < la);
+static int list_tids(void) {
+    static TidEnt *ents;
+    static size_t  ents_cap;
+    size_t n = 0;
+    if (list_pids() < 0) return -1;
+    for (size_t i = 0; i < npids; i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/task", pids[i]);
+        DIR *dir = opendir(path);
+        if (!dir) continue;
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != NULL) {
+            if (ent->d_name[0] < '1' || ent->d_name[0] > '9') continue;
+            if (n == ents_cap) {
+                ents_cap = ents_cap ? ents_cap * 2 : 4096;
+                ents = realloc(ents, ents_cap * sizeof(*ents));
+                if (!ents) { perror("realloc"); exit(EXIT_FAILURE); }
+            }
+            ents[n].tid  = (pid_t)atoi(ent->d_name);
+            ents[n].tgid = pids[i];
+            n++;
+        }
+        closedir(dir);
+    }
+    qsort(ents, n, sizeof(*ents), cmp_tid);
+
+    if (n > pids_cap) {
+        pids_cap = n;
+        pids = realloc(pids, pids_cap * sizeof(*pids));
+        if (!pids) { perror("realloc"); exit(EXIT_FAILURE); }
+    }
+    if (n > tgids_cap) {
+        tgids_cap = n;
+        tgids = realloc(tgids, tgids_cap * sizeof(*tgids));
+        if (!tgids) { perror("realloc"); exit(EXIT_FAILURE); }
+    }
+    for (size_t i = 0; i < n; i++) {
+        pids[i]  = ents[i].tid;
+        tgids[i] = ents[i].tgid;
+    }
+    npids = n;
+    return 0;
+}
+
+static void collect_chunk(size_t c) {
+    size_t a = c * CHUNK;
+    size_t b = a + CHUNK < npids ? a + CHUNK : npids;
+    pid_t  hi = c + 1 < nchunks ? pids[b] : INT_MAX;
+    size_t j  = c ? fdc_lower(pids[a]) : 0;
+    size_t out = a;
+    char   buf[BUF_SIZE];
+
+    for (size_t i = a; i < b; i++) {
+        pid_t pid = pids[i];
+        while (j < fdc.n && fdc.v[j].pid < pid) fds_close(&fdc.v[j++]);
+        ProcFds f = { .pid = pid, .tgid = thread_mode ? tgids[i] : pid,
+                      .dir = -1, .stat = -1, .cg = -1, .io = -1 };
+        /* An entry over the fd budget last tick is kept too, for its cgroup
+           and -m results; only its fds are retried. */
+        int unpinned = 1;
+        if (j < fdc.n && fdc.v[j].pid == pid) {
+            unpinned = fdc.v[j].stat < 0;
+            f = fdc.v[j++];
+            f.tgid = thread_mode ? tgids[i] : pid;
+        }
+        if (f.stat < 0) fds_open(&f);
+
+        ssize_t n = read_cached(&f, buf, sizeof(buf) - 1);
+        if (n <= 0) { fds_close(&f); continue; }   /* exited since readdir */
+        buf[n] = '\0';
+
+        ProcInfo *p = &chunk_snap->v[out];
+        p->pid     = pid;
+        p->tgid    = f.tgid;
+        p->cpu_pct = 0.0;
+        p->vcsw    = p->ivcsw = -1;
+        p->mem_age = -1;
+        if ((thread_mode ? parse_schedstat(buf, p) : parse_stat(buf, p)) < 0) {
+            fds_close(&f);
+            continue;
+        }
+        unsigned long long was = f.start;
+        if (thread_mode) {
+            if (was == 0 || unpinned) f.start = thread_start(&f);
+            p->start = f.start;
+        } else {
+            f.start = p->start;
+        }
+        /* without held fds a reused PID goes unnoticed: compare start times */
+        if (unpinned && was && was != f.start) {
+            f.cg     = -1;
+            f.io_at  = 0;
+            f.mem_at = 0;
+        }
+        /* membership rarely changes: read it once, then every 16th tick */
+        if (cg_mode && (f.cg < 0 || (unsigned)(pid + tick_no) % 16 == 0))
+            f.cg = proc_cgroup(&f);
+        p->cg = f.cg;
+        fdc_next.v[out++] = f;
+    }
+    while (j < fdc.n && fdc.v[j].pid < hi) fds_close(&fdc.v[j++]);
+    chunk_n[c] = out - a;
+}
+
+static void run_chunks(void) {
+    size_t c;
+    while ((c = atomic_fetch_add_explicit(&next_chunk, 1, memory_order_relaxed)) < nchunks)
+        collect_chunk(c);
+}
+
+static void *collect_worker(void *arg) {
+    (void)arg;
+    for (;;) {
+        pthread_barrier_wait(&start_bar);
+        run_chunks();
+        pthread_barrier_wait(&done_bar);
+    }
+    return NULL;
+}
+
+static void start_workers(int n) {
+    nworkers = n;
+    if (n < 2) return;
+    pthread_barrier_init(&start_bar, NULL, (unsigned)n);
+    pthread_barrier_init(&done_bar, NULL, (unsigned)n);
+    for (int i = 1; i < n; i++) {
+        pthread_t t;
+        if (pthread_create(&t, NULL, collect_worker, NULL) != 0) {
+            perror("pthread_create"); exit(EXIT_FAILURE);
+        }
+        pthread_detach(t);
+    }
+}
+
+/* relist = 0 reuses pids[] as left by the caller (-e keeps it current) */
+static int collect(Snapshot *s, int relist) {
+    if (relist && (thread_mode ? list_tids() : list_pids()) < 0) return -1;
+    tick_no++;
+    nchunks = (npids + CHUNK - 1) / CHUNK;
+    snap_reserve(s, npids);
+    fdc_reserve(&fdc_next, npids);
+    size_t *cn = realloc(chunk_n, (nchunks ? nchunks : 1) * sizeof(*cn));
+    if (!cn) { perror("realloc"); exit(EXIT_FAILURE); }
+    chunk_n    = cn;
+    chunk_snap = s;
+    atomic_store_explicit(&next_chunk, 0, memory_order_relaxed);
+
+    if (nworkers > 1) {
+        pthread_barrier_wait(&start_bar);
+        run_chunks();
+        pthread_barrier_wait(&done_bar);
+    } else {
+        run_chunks();
+    }
+    if (nchunks == 0)
+        for (size_t j = 0; j < fdc.n; j++) fds_close(&fdc.v[j]);
+
+    size_t n = 0;
+    for (size_t c = 0; c < nchunks; c++) {
+        size_t a = c * CHUNK;
+        if (n != a) {
+            memmove(&s->v[n], &s->v[a], chunk_n[c] * sizeof(*s->v));
+            memmove(&fdc_next.v[n], &fdc_next.v[a], chunk_n[c] * sizeof(*fdc_next.v));
+        }
+        n += chunk_n[c];
+    }
+    s->n = fdc_next.n = n;
+
+    FdCache tmp = fdc;
+    fdc      = fdc_next;
+    fdc_next = tmp;
+    return (int)s->n;
+}
+
+/* ---- Top-N selection ---------------------------------------------------- */
+/* A size-N min-heap over the snapshot: O(n log N) instead of sorting all n
+   processes to show a handful. */
+static int cmp_cpu(const ProcInfo *a, const ProcInfo *b) {
+    return (a->cpu_pct > b->cpu_pct) - (a->cpu_pct < b->cpu_pct);
+}
+
+/* PSS where smaps_rollup has been read, RSS until then */
+static int cmp_mem(const ProcInfo *a, const ProcInfo *b) {
+    long x = a->mem_age >= 0 ? a->pss_kb : a->rss_kb;
+    long y = b->mem_age >= 0 ? b->pss_kb : b->rss_kb;
+    return (x > y) - (x < y);
+}
+
+static int cmp_wait(const ProcInfo *a, const ProcInfo *b) {
+    return (a->wait_pct > b->wait_pct) - (a->wait_pct < b->wait_pct);
+}
+
+typedef int (*ProcCmp)(const ProcInfo *, const ProcInfo *);
+
+static void heap_down(const ProcInfo **h, int n, int i, ProcCmp cmp) {
+    for (;;) {
+        int l = 2 * i + 1, r = l + 1, m = i;
+        if (l < n && cmp(h[l], h[m]) < 0) m = l;
+        if (r < n && cmp(h[r], h[m]) < 0) m = r;
+        if (m == i) return;
+        const ProcInfo *t = h[i]; h[i] = h[m]; h[m] = t;
+        i = m;
+    }
+}
+
+/* Fills out[] with the top n of s, best first; returns how many */
+static int select_top(const Snapshot *s, int n, ProcCmp cmp, const ProcInfo **out) {
+    int k = 0;
+    for (size_t i = 0; i < s->n; i++) {
+        const ProcInfo *p = &s->v[i];
+        if (k < n) {
+            out[k++] = p;
+            if (k == n)
+                for (int j = n / 2; j-- > 0; ) heap_down(out, n, j, cmp);
+        } else if (cmp(p, out[0]) > 0) {
+            out[0] = p;
+            heap_down(out, n, 0, cmp);
+        }
+    }
+    if (k < n)
+        for (int j = k / 2; j-- > 0; ) heap_down(out, k, j, cmp);
+    /* heap sort in place: repeatedly move the smallest to the end */
+    for (int m = k; m > 1; m--) {
+        const ProcInfo *t = out[0]; out[0] = out[m - 1]; out[m - 1] = t;
+        heap_down(out, m - 1, 0, cmp);
+    }
+    return k;
+}
+
+/* ---- I/O mode (-I) ------------------------------------------------------ */
+/* /proc/<pid>/io is only read for candidates: the 4 * N processes (at
+   least 32) with the most kernel time, major faults and block I/O delay
+   this tick, all of which come from stat at no extra cost. Each
+   candidate's io fd is kept in the cache and its last reading too, so a
+   rate is known from the second time a process is a candidate. */
+static int cmp_score(const ProcInfo *a, const ProcInfo *b) {
+    return (a->score > b->score) - (a->score < b->score);
+}
+
+static int cmp_io(const void *a, const void *b) {
+    const ProcInfo *x = *(const ProcInfo *const *)a, *y = *(const ProcInfo *const *)b;
+    if (x->io_known != y->io_known) return y->io_known - x->io_known;
+    double dx = x->rd_rate + x->wr_rate, dy = y->rd_rate + y->wr_rate;
+    if (dx != dy) return (dx < dy) - (dx > dy);
+    dx = x->scr_rate + x->scw_rate + x->majflt_rate;
+    dy = y->scr_rate + y->scw_rate + y->majflt_rate;
+    return (dx < dy) - (dx > dy);
+}
+
+/* Reads io for the candidates and leaves the top n in out[] */
+static int select_io(Snapshot *s, int n, double now, const ProcInfo **out) {
+    static const ProcInfo **cand;
+    static int cand_cap;
+    int k = n * 4 > 32 ? n * 4 : 32;
+    if (k > cand_cap) {
+        cand_cap = k;
+        cand = realloc(cand, (size_t)k * sizeof(*cand));
+        if (!cand) { perror("realloc"); exit(EXIT_FAILURE); }
+    }
+    k = select_top(s, k, cmp_score, cand);
+
+    for (int i = 0; i < k; i++) {
+        ProcInfo *p = (ProcInfo *)cand[i];
+        ProcFds  *f = &fdc.v[p - s->v];    /* snapshot and cache share order */
+        char buf[512];
+        ssize_t len = -1;
+        p->io_known = 0;
+        if (f->io < 0 && f->dir >= 0)
+            f->io = openat(f->dir, "io", O_RDONLY | O_CLOEXEC);
+        if (f->io >= 0) len = pread(f->io, buf, sizeof(buf) - 1, 0);
+        if (len <= 0) continue;
+        buf[len] = '\0';
+
+        unsigned long long rd = 0, wr = 0, scr = 0, scw = 0;
+        char *v;
+        if ((v = strstr(buf, "syscr: ")))       scr = strtoull(v + 7, NULL, 10);
+        if ((v = strstr(buf, "syscw: ")))       scw = strtoull(v + 7, NULL, 10);
+        if ((v = strstr(buf, "\nread_bytes: ")))  rd = strtoull(v + 13, NULL, 10);
+        if ((v = strstr(buf, "\nwrite_bytes: "))) wr = strtoull(v + 14, NULL, 10);
+        if (f->io_at > 0 && now > f->io_at && rd >= f->rd && wr >= f->wr) {
+            double dt = now - f->io_at;
+            p->rd_rate  = (rd - f->rd) / dt;
+            p->wr_rate  = (wr - f->wr) / dt;
+            p->scr_rate = (scr - f->scr) / dt;
+            p->scw_rate = (scw - f->scw) / dt;
+            p->io_known = 1;
+        }
+        f->rd = rd; f->wr = wr; f->scr = scr; f->scw = scw;
+        f->io_at = now;
+    }
+    qsort(cand, (size_t)k, sizeof(*cand), cmp_io);
+    if (k > n) k = n;
+    memcpy(out, cand, (size_t)k * sizeof(*out));
+    return k;
+}
+
+/* ---- Proportional memory (-m) ------------------------------------------- */
+/* RSS counts shared pages in full for every process mapping them and says
+   nothing about swap. smaps_rollup has PSS (shared pages split between
+   their users), private pages (USS) and SwapPss, but the kernel walks the
+   page tables to produce it: milliseconds for a process of a few GB. Each
+   tick refreshes as many processes as fit in the -b budget, the ones whose
+   cached value is most likely wrong first: never read, RSS moved most
+   since the last read, or large and long unread. Everyone else keeps
+   their cached figures, shown with their age. */
+#define MEM_CANDIDATES 1024
+
+static double mem_budget_ms = 25;
+static unsigned long mem_reads;
+static double mem_read_ms;
+
+static int cmp_mem_prio(const ProcInfo *a, const ProcInfo *b) {
+    return (a->mem_prio > b->mem_prio) - (a->mem_prio < b->mem_prio);
+}
+
+static int read_rollup(const ProcFds *f, long *pss, long *uss, long *swap) {
+    char buf[2048];
+    int fd;
+    if (f->dir >= 0) {
+        fd = openat(f->dir, "smaps_rollup", O_RDONLY | O_CLOEXEC);
+    } else {
+        char path[64];
+        unit_path(f, "smaps_rollup", path, sizeof(path));
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+    if (fd < 0) return -1;
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) return -1;             /* kernel thread, or exited */
+    buf[n] = '\0';
+
+    long clean = 0, dirty = 0;
+    char *v;
+    *pss = *swap = 0;
+    if ((v = strstr(buf, "\nPss:")))           *pss  = strtol(v + 5, NULL, 10);
+    if ((v = strstr(buf, "\nPrivate_Clean:"))) clean = strtol(v + 15, NULL, 10);
+    if ((v = strstr(buf, "\nPrivate_Dirty:"))) dirty = strtol(v + 15, NULL, 10);
+    if ((v = strstr(buf, "\nSwapPss:")))       *swap = strtol(v + 9, NULL, 10);
+    *uss = clean + dirty;
+    return 0;
+}
+
+static void mem_refresh(Snapshot *s, double now) {
+    static const ProcInfo **cand;
+    if (!cand && !(cand = malloc(MEM_CANDIDATES * sizeof(*cand)))) {
+        perror("malloc"); exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < s->n; i++) {
+        ProcInfo *p = &s->v[i];
+        const ProcFds *f = &fdc.v[i];      /* snapshot and cache share order */
+        if (p->rss_kb == 0) {
+            p->mem_prio = 0;               /* kernel threads */
+        } else if (f->mem_at == 0 || f->mem_start != p->start) {
+            p->mem_prio = 1e12 + p->rss_kb;
+        } else {
+            double drift = p->rss_kb > f->mem_rss ? p->rss_kb - f->mem_rss
+                                                  : f->mem_rss - p->rss_kb;
+            p->mem_prio = drift + p->rss_kb * (now - f->mem_at) / 60.0;
+        }
+    }
+
+    int k = select_top(s, MEM_CANDIDATES, cmp_mem_prio, cand);
+    double t0 = now_sec();
+    mem_reads = 0;
+    for (int i = 0; i < k && cand[i]->mem_prio > 0; i++) {
+        if ((now_sec() - t0) * 1e3 >= mem_budget_ms) break;
+        const ProcInfo *p = cand[i];
+        ProcFds *f = &fdc.v[p - s->v];
+        long pss, uss, swap;
+        if (read_rollup(f, &pss, &uss, &swap) < 0) continue;
+        f->pss = pss; f->uss = uss; f->swap = swap;
+        f->mem_rss   = p->rss_kb;
+        f->mem_start = p->start;
+        f->mem_at    = now_sec();
+        mem_reads++;
+    }
+    mem_read_ms = (now_sec() - t0) * 1e3;
+
+    for (size_t i = 0; i < s->n; i++) {
+        ProcInfo *p = &s->v[i];
+        const ProcFds *f = &fdc.v[i];
+        if (f->mem_at == 0 || f->mem_start != p->start) {
+            p->mem_age = -1;
+            continue;
+        }
+        p->pss_kb  = f->pss;
+        p->uss_kb  = f->uss;
+        p->swap_kb = f->swap;
+        p->mem_age = now - f->mem_at > 0 ? now - f->mem_at : 0;
+    }
+}
+
+/* ---- Benchmark (-B) ----------------------------------------------------- */
+/* Times one tick's bookkeeping (index build, delta matching and top-N) on
+   a synthetic table of n processes, where each tick 5% of processes exit
+   and are replaced, a fifth of them reusing an exited PID. /proc reading
+   is left out: it is the same for any table layout. For n up to 20000 the
+   old nested-loop match plus full qsort is timed too. */
+static int qsort_cpu(const void *a, const void *b) {
+    return cmp_cpu(b, a);
+}
+
+static void bench(long n, int top_n) {
+    Snapshot a = {0}, b = {0};
+    Index ix = {0};
+    unsigned int seed = 12345;
+    const ProcInfo **top = malloc((size_t)top_n * sizeof(*top));
+    if (!top) { perror("malloc"); exit(EXIT_FAILURE); }
+
+    for (long i = 0; i < n; i++) {
+        ProcInfo *p = snap_push(&a);
+        memset(p, 0, sizeof(*p));
+        p->pid   = (pid_t)(i * 7 + 1);
+        p->start = (unsigned long long)i;
+        snprintf(p->name, sizeof(p->name), "proc%ld", i);
+    }
+    for (size_t i = 0; i < a.n; i++) *snap_push(&b) = a.v[i];
+
+    Snapshot *prev = &a, *curr = &b;
+    int ticks = 0;
+    double t_new = 0;
+    unsigned long long clock = (unsigned long long)n;
+    while (t_new < 1.0 || ticks < 5) {
+        /* next tick: CPU advances, 5% turnover */
+        for (size_t i = 0; i < curr->n; i++) {
+            seed = seed * 1103515245u + 12345u;
+            curr->v[i].utime += (seed >> 16) % 10;
+            if ((seed >> 8) % 20 == 0) {
+                curr->v[i].start = ++clock;
+                if ((seed >> 4) % 5) curr->v[i].pid = (pid_t)(n * 7 + clock);
+            }
+        }
+        double t0 = now_sec();
+        compute_cpu(curr, prev, &ix, 1.0);
+        select_top(curr, top_n, cmp_cpu, top);
+        t_new += now_sec() - t0;
+        ticks++;
+
+        for (size_t i = 0; i < curr->n; i++) prev->v[i] = curr->v[i];
+    }
+    printf("%-10ld %-12s %12.1f us/tick  (%d ticks)\n", n, "hash+top-N",
+           t_new * 1e6 / ticks, ticks);
+
+    if (n <= 20000) {
+        double t0 = now_sec();
+        for (size_t i = 0; i < curr->n; i++)
+            for (size_t j = 0; j < prev->n; j++)
+                if (curr->v[i].pid == prev->v[j].pid) {
+                    curr->v[i].cpu_pct = (double)(curr->v[i].utime - prev->v[j].utime);
+                    break;
+                }
+        qsort(curr->v, curr->n, sizeof(ProcInfo), qsort_cpu);
+        printf("%-10ld %-12s %12.1f us/tick\n", n, "loop+qsort",
+               (now_sec() - t0) * 1e6);
+    }
+    free(a.v); free(b.v); free(ix.slot); free(top);
+}
+
+/* ---- Process events (-e) ------------------------------------------------ */
+/* The proc connector reports forks, execs and exits as they happen. With
+   -e the PID list is kept current from fork events instead of listing
+   /proc every tick (exited PIDs drop out when their stat read fails; the
+   list is rebuilt from /proc only if events were lost), and forks are
+   counted per parent for the SPAWN/s column. Taskstats sends the
+   accounting record of every exiting task, which catches CPU used by
+   processes that exit between two samples, however short-lived; that is
+   rolled up by command. Both need CAP_NET_ADMIN. */
+typedef struct {
+    pid_t  *v;
+    size_t  n, cap;
+} PidVec;
+
+typedef struct {
+    pid_t    tgid;
+    int      leader;                   /* the thread-group leader's record */
+    uint64_t cpu_us, life_us;
+    char     comm[TS_COMM_LEN];
+} ExitRec;
+
+typedef struct {
+    char     comm[TS_COMM_LEN];
+    unsigned exits;
+    uint64_t cpu_us, life_us;
+} ExitCmd;
+
+static int      ev_on, ev_rescan;
+static int      cn_sock = -1, ts_sock = -1;
+static uint16_t ts_family;
+static PidVec   ev_forks, ev_parents;  /* children / parents of each fork */
+static unsigned long ev_nforks, ev_nexecs, ev_nexits, ev_lost;
+
+static ExitRec *exit_recs;
+static size_t   nexit_recs, exit_recs_cap;
+static ExitCmd *exit_cmds;
+static size_t   nexit_cmds, exit_cmds_cap;
+
+static void pv_push(PidVec *p, pid_t pid) {
+    if (p->n == p->cap) {
+        p->cap = p->cap ? p->cap * 2 : 256;
+        p->v   = realloc(p->v, p->cap * sizeof(*p->v));
+        if (!p->v) { perror("realloc"); exit(EXIT_FAILURE); }
+    }
+    p->v[p->n++] = pid;
+}
+
+static int cmp_pid(const void *a, const void *b) {
+    pid_t x = *(const pid_t *)a, y = *(const pid_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void cn_open(void) {
+    cn_sock = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC, NETLINK_CONNECTOR);
+    if (cn_sock < 0) { perror("proc connector"); exit(EXIT_FAILURE); }
+    int rcvbuf = 4 << 20;
+    if (setsockopt(cn_sock, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0)
+        setsockopt(cn_sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    struct sockaddr_nl sa = { .nl_family = AF_NETLINK, .nl_groups = CN_IDX_PROC };
+    if (bind(cn_sock, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+        perror("proc connector bind"); exit(EXIT_FAILURE);
+    }
+
+    struct __attribute__((packed)) {
+        struct nlmsghdr         nl;
+        struct cn_msg           cn;
+        enum proc_cn_mcast_op   op;
+    } req;
+    memset(&req, 0, sizeof(req));
+    req.nl.nlmsg_len  = sizeof(req);
+    req.nl.nlmsg_type = NLMSG_DONE;
+    req.cn.id.idx     = CN_IDX_PROC;
+    req.cn.id.val     = CN_VAL_PROC;
+    req.cn.len        = sizeof(req.op);
+    req.op            = PROC_CN_MCAST_LISTEN;
+    if (send(cn_sock, &req, sizeof(req), 0) < 0) {
+        perror("proc connector listen"); exit(EXIT_FAILURE);
+    }
+}
+
+static void cn_drain(void) {
+    char buf[16384] __attribute__((aligned(NLMSG_ALIGNTO)));
+    for (;;) {
+        ssize_t n = recv(cn_sock, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == ENOBUFS) { ev_lost++; ev_rescan = 1; continue; }
+            return;
+        }
+        for (struct nlmsghdr *nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, (size_t)n);
+             nh = NLMSG_NEXT(nh, n)) {
+            struct cn_msg     *cn = NLMSG_DATA(nh);
+            struct proc_event *ev = (struct proc_event *)cn->data;
+            switch (ev->what) {
+            case PROC_EVENT_FORK:
+                if (ev->event_data.fork.child_pid != ev->event_data.fork.child_tgid)
+                    break;                                  /* new thread */
+                pv_push(&ev_forks, ev->event_data.fork.child_tgid);
+                pv_push(&ev_parents, ev->event_data.fork.parent_tgid);
+                ev_nforks++;
+                break;
+            case PROC_EVENT_EXEC:
+                ev_nexecs++;
+                break;
+            case PROC_EVENT_EXIT:
+                if (ev->event_data.exit.process_pid == ev->event_data.exit.process_tgid)
+                    ev_nexits++;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+
+/* One generic netlink request carrying a single attribute */
+static int genl_send(int sock, uint16_t type, uint8_t cmd,
+                     uint16_t attr, const void *data, size_t len) {
+    struct {
+        struct nlmsghdr  nl;
+        struct genlmsghdr g;
+        char             attrs[256];
+    } req;
+    if (len > sizeof(req.attrs) - NLA_HDRLEN) return -1;
+    memset(&req, 0, sizeof(req));
+    req.nl.nlmsg_len   = NLMSG_LENGTH(GENL_HDRLEN);
+    req.nl.nlmsg_type  = type;
+    req.nl.nlmsg_flags = NLM_F_REQUEST;
+    req.g.cmd          = cmd;
+    req.g.version      = 1;
+    struct nlattr *na = (struct nlattr *)((char *)&req + NLMSG_ALIGN(req.nl.nlmsg_len));
+    na->nla_type = attr;
+    na->nla_len  = NLA_HDRLEN + len;
+    memcpy((char *)na + NLA_HDRLEN, data, len);
+    req.nl.nlmsg_len = NLMSG_ALIGN(req.nl.nlmsg_len) + NLA_ALIGN(na->nla_len);
+
+    struct sockaddr_nl to = { .nl_family = AF_NETLINK };
+    return sendto(sock, &req, req.nl.nlmsg_len, 0,
+                  (struct sockaddr *)&to, sizeof(to)) < 0 ? -1 : 0;
+}
+
+#define NLA_NEXT_ATTR(na) ((struct nlattr *)((char *)(na) + NLA_ALIGN((na)->nla_len)))
+#define GENL_ATTRS(nh) ((struct nlattr *)((char *)NLMSG_DATA(nh) + GENL_HDRLEN))
+
+/* Returns 0 with taskstats exit records flowing, -1 (and a reason) if not */
+static int ts_open(const char **why) {
+    ts_sock = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_GENERIC);
+    if (ts_sock < 0) { *why = strerror(errno); return -1; }
+    int rcvbuf = 4 << 20;
+    if (setsockopt(ts_sock, SOL_SOCKET, SO_RCVBUFFORCE, &rcvbuf, sizeof(rcvbuf)) < 0)
+        setsockopt(ts_sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    struct sockaddr_nl sa = { .nl_family = AF_NETLINK };
+    bind(ts_sock, (struct sockaddr *)&sa, sizeof(sa));
+
+    /* Resolve the TASKSTATS family id */
+    char buf[4096] __attribute__((aligned(NLMSG_ALIGNTO)));
+    if (genl_send(ts_sock, GENL_ID_CTRL, CTRL_CMD_GETFAMILY, CTRL_ATTR_FAMILY_NAME,
+                  TASKSTATS_GENL_NAME, sizeof(TASKSTATS_GENL_NAME)) < 0) {
+        *why = strerror(errno); return -1;
+    }
+    ssize_t n = recv(ts_sock, buf, sizeof(buf), 0);
+    struct nlmsghdr *nh = (struct nlmsghdr *)buf;
+    if (n <= 0 || !NLMSG_OK(nh, (size_t)n) || nh->nlmsg_type == NLMSG_ERROR) {
+        *why = "no TASKSTATS genetlink family"; return -1;
+    }
+    ssize_t left = (ssize_t)nh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+    for (struct nlattr *na = GENL_ATTRS(nh); left >= NLA_HDRLEN && na->nla_len >= NLA_HDRLEN;
+         left -= NLA_ALIGN(na->nla_len), na = NLA_NEXT_ATTR(na))
+        if (na->nla_type == CTRL_ATTR_FAMILY_ID)
+            ts_family = *(uint16_t *)((char *)na + NLA_HDRLEN);
+    if (!ts_family) { *why = "no TASKSTATS family id"; return -1; }
+
+    /* Ask for exit records from every CPU */
+    char mask[32];
+    snprintf(mask, sizeof(mask), "0-%ld", sysconf(_SC_NPROCESSORS_CONF) - 1);
+    if (genl_send(ts_sock, ts_family, TASKSTATS_CMD_GET,
+                  TASKSTATS_CMD_ATTR_REGISTER_CPUMASK, mask, strlen(mask) + 1) < 0) {
+        *why = strerror(errno); return -1;
+    }
+    return 0;
+}
+
+static void exit_rec_add(const struct taskstats *ts) {
+    if (nexit_recs == exit_recs_cap) {
+        exit_recs_cap = exit_recs_cap ? exit_recs_cap * 2 : 256;
+        exit_recs = realloc(exit_recs, exit_recs_cap * sizeof(*exit_recs));
+        if (!exit_recs) { perror("realloc"); exit(EXIT_FAILURE); }
+    }
+    ExitRec *r = &exit_recs[nexit_recs++];
+    r->tgid    = ts->ac_tgid ? (pid_t)ts->ac_tgid : (pid_t)ts->ac_pid;
+    r->leader  = (pid_t)ts->ac_pid == r->tgid;
+    r->cpu_us  = ts->ac_utime + ts->ac_stime;
+    r->life_us = ts->ac_etime;
+    memcpy(r->comm, ts->ac_comm, sizeof(r->comm));
+    r->comm[sizeof(r->comm) - 1] = '\0';
+}
+
+/* Returns -1 once the kernel has refused the registration */
+static int ts_drain(const char **why) {
+    char buf[16384] __attribute__((aligned(NLMSG_ALIGNTO)));
+    for (;;) {
+        ssize_t n = recv(ts_sock, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == ENOBUFS) { ev_lost++; continue; }
+            return 0;
+        }
+        for (struct nlmsghdr *nh = (struct nlmsghdr *)buf; NLMSG_OK(nh, (size_t)n);
+             nh = NLMSG_NEXT(nh, n)) {
+            if (nh->nlmsg_type == NLMSG_ERROR) {
+                struct nlmsgerr *e = NLMSG_DATA(nh);
+                if (e->error) { *why = strerror(-e->error); return -1; }
+                continue;
+            }
+            if (nh->nlmsg_type != ts_family) continue;
+            ssize_t left = (ssize_t)nh->nlmsg_len - NLMSG_LENGTH(GENL_HDRLEN);
+            for (struct nlattr *na = GENL_ATTRS(nh);
+                 left >= NLA_HDRLEN && na->nla_len >= NLA_HDRLEN;
+                 left -= NLA_ALIGN(na->nla_len), na = NLA_NEXT_ATTR(na)) {
+                /* per-task records only: the per-tgid aggregate carries
+                   delay accounting but no CPU times */
+                if (na->nla_type != TASKSTATS_TYPE_AGGR_PID) continue;
+                ssize_t in = na->nla_len - NLA_HDRLEN;
+                for (struct nlattr *a = (struct nlattr *)((char *)na + NLA_HDRLEN);
+                     in >= NLA_HDRLEN && a->nla_len >= NLA_HDRLEN;
+                     in -= NLA_ALIGN(a->nla_len), a = NLA_NEXT_ATTR(a)) {
+                    if (a->nla_type != TASKSTATS_TYPE_STATS) continue;
+                    struct taskstats ts;
+                    size_t len = a->nla_len - NLA_HDRLEN;
+                    memset(&ts, 0, sizeof(ts));
+                    memcpy(&ts, (char *)a + NLA_HDRLEN, len < sizeof(ts) ? len : sizeof(ts));
+                    exit_rec_add(&ts);
+                }
+            }
+        }
+    }
+}
+
+/* Sleep until the next tick, handling events as they arrive */
+static void ev_wait(int interval, const char **ts_why) {
+    double deadline = now_sec() + interval;
+    for (;;) {
+        double left = deadline - now_sec();
+        if (left <= 0) break;
+        struct pollfd pfd[2] = {
+            { .fd = cn_sock, .events = POLLIN },
+            { .fd = ts_sock, .events = POLLIN },
+        };
+        if (poll(pfd, ts_sock >= 0 ? 2 : 1, (int)(left * 1000) + 1) <= 0) continue;
+        if (pfd[0].revents) cn_drain();
+        if (ts_sock >= 0 && pfd[1].revents && ts_drain(ts_why) < 0) {
+            close(ts_sock);
+            ts_sock = -1;
+        }
+    }
+}
+
+/* pids[] = last tick's processes plus the children forked since */
+static void ev_apply_pids(void) {
+    qsort(ev_forks.v, ev_forks.n, sizeof(pid_t), cmp_pid);
+    size_t need = fdc.n + ev_forks.n;
+    if (need > pids_cap) {
+        pids_cap = need;
+        pids = realloc(pids, pids_cap * sizeof(*pids));
+        if (!pids) { perror("realloc"); exit(EXIT_FAILURE); }
+    }
+    size_t i = 0, j = 0;
+    npids = 0;
+    while (i < fdc.n || j < ev_forks.n) {
+        pid_t p;
+        if (j >= ev_forks.n || (i < fdc.n && fdc.v[i].pid <= ev_forks.v[j]))
+            p = fdc.v[i++].pid;
+        else
+            p = ev_forks.v[j++];
+        if (npids == 0 || pids[npids - 1] != p) pids[npids++] = p;
+    }
+    ev_forks.n = 0;
+}
+
+static const ProcInfo *snap_find(const Snapshot *s, pid_t pid) {
+    size_t lo = 0, hi = s->n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (s->v[mid].pid < pid) lo = mid + 1; else hi = mid;
+    }
+    return lo < s->n && s->v[lo].pid == pid ? &s->v[lo] : NULL;
+}
+
+static int cmp_exit_rec(const void *a, const void *b) {
+    const ExitRec *x = a, *y = b;
+    if (x->tgid != y->tgid) return (x->tgid > y->tgid) - (x->tgid < y->tgid);
+    return y->leader - x->leader;      /* leader first */
+}
+
+static int cmp_exit_cmd(const void *a, const void *b) {
+    const ExitCmd *x = a, *y = b;
+    return (x->cpu_us < y->cpu_us) - (x->cpu_us > y->cpu_us);
+}
+
+/* Fold this interval's exit records into per-command totals. Records of
+   threads whose process is still running are dropped (their CPU is in the
+   process's stat already); for a process that was in the previous sample
+   only the CPU used since then is counted. */
+static void ev_rollup(const Snapshot *curr, const Snapshot *prev) {
+    nexit_cmds = 0;
+    qsort(exit_recs, nexit_recs, sizeof(ExitRec), cmp_exit_rec);
+    for (size_t i = 0; i < nexit_recs; ) {
+        size_t g = i;
+        uint64_t cpu = 0;
+        for (; i < nexit_recs && exit_recs[i].tgid == exit_recs[g].tgid; i++)
+            cpu += exit_recs[i].cpu_us;
+        if (snap_find(curr, exit_recs[g].tgid)) continue;
+
+        const ProcInfo *o = snap_find(prev, exit_recs[g].tgid);
+        if (o) {
+            uint64_t seen = (o->utime + o->stime) * 1000000ull / (uint64_t)CLK_TCK;
+            cpu = cpu > seen ? cpu - seen : 0;
+        }
+
+        size_t k = 0;
+        while (k < nexit_cmds && strcmp(exit_cmds[k].comm, exit_recs[g].comm) != 0) k++;
+        if (k == nexit_cmds) {
+            if (nexit_cmds == exit_cmds_cap) {
+                exit_cmds_cap = exit_cmds_cap ? exit_cmds_cap * 2 : 64;
+                exit_cmds = realloc(exit_cmds, exit_cmds_cap * sizeof(*exit_cmds));
+                if (!exit_cmds) { perror("realloc"); exit(EXIT_FAILURE); }
+            }
+            memset(&exit_cmds[k], 0, sizeof(exit_cmds[k]));
+            memcpy(exit_cmds[k].comm, exit_recs[g].comm, sizeof(exit_cmds[k].comm));
+            nexit_cmds++;
+        }
+        exit_cmds[k].exits++;
+        exit_cmds[k].cpu_us  += cpu;
+        exit_cmds[k].life_us += exit_recs[g].life_us;
+    }
+    nexit_recs = 0;
+    qsort(exit_cmds, nexit_cmds, sizeof(ExitCmd), cmp_exit_cmd);
+    qsort(ev_parents.v, ev_parents.n, sizeof(pid_t), cmp_pid);
+}
+
+/* Children forked by pid since the last tick */
+static unsigned spawn_count(pid_t pid) {
+    size_t lo = 0, hi = ev_parents.n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ev_parents.v[mid] < pid) lo = mid + 1; else hi = mid;
+    }
+    unsigned n = 0;
+    while (lo + n < ev_parents.n && ev_parents.v[lo + n] == pid) n++;
+    return n;
 }
 
 static void usage(const char *prog) {
-    fprintf(stderr, "Usage: %s [-m] [-n N] [-i seconds]\n", prog);
-    fprintf(stderr, "  -m       sort by memory (default: CPU)\n");
+    fprintf(stderr, "Usage: %s [-m [-b ms] | -I] [-c [-d depth] | -H [-q]] [-e] [-n N] [-i seconds] [-j threads] [-B procs]\n", prog);
+    fprintf(stderr, "  -m       sort by memory: PSS, USS and swap (default: CPU)\n");
+    fprintf(stderr, "  -b ms    with -m, time per tick for reading smaps_rollup (default: 25)\n");
+    fprintf(stderr, "  -I       sort by disk I/O, with syscall and page fault rates\n");
+    fprintf(stderr, "  -c       one row per cgroup v2 (CPU, memory, memory pressure)\n");
+    fprintf(stderr, "  -d N     with -c, group at depth N of the cgroup tree (default: leaf)\n");
+    fprintf(stderr, "  -H       one row per thread, with run-queue delay and context switches\n");
+    fprintf(stderr, "  -q       with -H, sort by run-queue delay\n");
+    fprintf(stderr, "  -e       follow fork/exec/exit events: spawn rates, CPU of exited processes\n");
     fprintf(stderr, "  -n N     show top N processes (default: 10)\n");
     fprintf(stderr, "  -i secs  refresh interval (default: 1)\n");
+    fprintf(stderr, "  -j N     read /proc with N threads (default: 1)\n");
+    fprintf(stderr, "  -B N     benchmark per-tick bookkeeping on N synthetic processes\n");
 }
 
 int main(int argc, char *argv[]) {
     int top_n    = 10;
     int sort_mem = 0;
+    int sort_wait = 0;
+    int sort_io   = 0;
     int interval = 1;
+    int jobs     = 1;
+    long bench_n = 0;
 
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-m") == 0) {
             sort_mem = 1;
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            mem_budget_ms = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-I") == 0) {
+            sort_io = 1;
+        } else if (strcmp(argv[i], "-c") == 0) {
+            cg_mode = 1;
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            cg_depth = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-H") == 0) {
+            thread_mode = 1;
+        } else if (strcmp(argv[i], "-q") == 0) {
+            sort_wait = 1;
+        } else if (strcmp(argv[i], "-e") == 0) {
+            ev_on = 1;
         } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
             top_n = atoi(argv[++i]);
         } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
             interval = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-B") == 0 && i + 1 < argc) {
+            bench_n = atol(argv[++i]);
         } else {
             usage(argv[0]); return EXIT_FAILURE;
         }
     }
+    if ((sort_mem && thread_mode) || (sort_wait && !thread_mode) ||
+        (cg_mode && thread_mode) || (sort_io && (sort_mem || thread_mode || cg_mode))) {
+        usage(argv[0]); return EXIT_FAILURE;
+    }
     if (top_n < 1) top_n = 1;
     if (interval < 1) interval = 1;
+    if (jobs < 1) jobs = 1;
+    if (jobs > 64) jobs = 64;
+    if (mem_budget_ms < 0) mem_budget_ms = 0;
 
     CLK_TCK = sysconf(_SC_CLK_TCK);
+    PAGE_KB = sysconf(_SC_PAGESIZE) / 1024;
 
-    static ProcInfo bufA[MAX_PROCS], bufB[MAX_PROCS];
-    ProcInfo *curr = bufA, *prev = bufB;
-    int curr_n = 0, prev_n = 0;
+    if (bench_n > 0) {
+        bench(bench_n, top_n);
+        return EXIT_SUCCESS;
+    }
 
-    prev_n = collect(prev, MAX_PROCS);
+    Snapshot bufA = {0}, bufB = {0};
+    Snapshot *curr = &bufA, *prev = &bufB;
+    Index ix = {0};
+    const ProcInfo **top = malloc((size_t)top_n * sizeof(*top));
+    if (!top) { perror("malloc"); return EXIT_FAILURE; }
 
-    while (1) {
-        sleep(interval);
-        curr_n = collect(curr, MAX_PROCS);
-
-        /* Compute CPU% by matching PIDs between snapshots */
-        for (int i = 0; i < curr_n; i++) {
-            curr[i].cpu_pct = 0.0;
-            for (int j = 0; j < prev_n; j++) {
-                if (curr[i].pid == prev[j].pid) {
-                    unsigned long long delta =
-                        (curr[i].utime + curr[i].stime) -
-                        (prev[j].utime + prev[j].stime);
-                    curr[i].cpu_pct = (delta * 100.0) /
-                                      (CLK_TCK * (unsigned long long)interval);
-                    break;
-                }
-            }
+    const char *ts_why = NULL;
+    if (ev_on) {
+        cn_open();
+        if (ts_open(&ts_why) < 0 && ts_sock >= 0) {
+            close(ts_sock);
+            ts_sock = -1;
         }
+    }
 
-        qsort(curr, curr_n, sizeof(ProcInfo),
-              sort_mem ? cmp_mem : cmp_cpu);
+    if (cg_mode && cg_open_root() < 0) {
+        fprintf(stderr, "procwatch: no cgroup2 mount found\n");
+        return EXIT_FAILURE;
+    }
 
-        int show = (curr_n < top_n) ? curr_n : top_n;
+    fd_limit_init(sort_io ? 3 : 2);
+    start_workers(jobs);
+    collect(prev, 1);
+
+    while (1) {
+        if (ev_on) ev_wait(interval, &ts_why); else sleep(interval);
+        double t0 = now_sec();
+        int relist = !ev_on || ev_rescan || thread_mode;
+        if (!relist) ev_apply_pids();
+        ev_rescan = 0;
+        collect(curr, relist);
+        double collect_ms = (now_sec() - t0) * 1e3;
+        compute_cpu(curr, prev, &ix, (double)interval);
+        if (ev_on) ev_rollup(curr, prev);
+        if (sort_mem && !cg_mode) mem_refresh(curr, now_sec());
+
+        int show = sort_io
+                 ? select_io(curr, top_n, now_sec(), top)
+                 : select_top(curr, top_n,
+                              sort_mem ? cmp_mem : sort_wait ? cmp_wait : cmp_cpu, top);
 
         /* Clear screen and reprint */
         printf("\033[2J\033[H");
-        printf("%-8s %-20s %8s %12s  sort:%-3s\n",
-               "PID", "COMMAND", "CPU%", "RSS (MB)",
-               sort_mem ? "MEM" : "CPU");
-        printf("%-8s %-20s %8s %12s\n",
-               "--------", "--------------------", "--------", "------------");
+        if (cg_mode) {
+            print_cgroups(curr, top_n, sort_mem, now_sec());
+        } else if (sort_io) {
+            printf("%-8s %-16s %10s %10s %9s %9s %9s %9s  sort:IO\n", "PID", "COMMAND",
+                   "RD KB/s", "WR KB/s", "SYSCR/s", "SYSCW/s", "MAJFLT/s", "MINFLT/s");
+            printf("%-8s %-16s %10s %10s %9s %9s %9s %9s\n", "--------",
+                   "----------------", "----------", "----------", "---------",
+                   "---------", "---------", "---------");
+            for (int i = 0; i < show; i++) {
+                const ProcInfo *p = top[i];
+                printf("%-8d %-16.16s ", p->pid, p->name);
+                if (p->io_known)
+                    printf("%10.1f %10.1f %9.0f %9.0f", p->rd_rate / 1024, p->wr_rate / 1024,
+                           p->scr_rate, p->scw_rate);
+                else
+                    printf("%10s %10s %9s %9s", "-", "-", "-", "-");
+                printf(" %9.0f %9.0f\n", p->majflt_rate, p->minflt_rate);
+            }
+        } else if (sort_mem) {
+            printf("%-8s %-20s %8s %10s %10s %10s %10s %7s%s  sort:PSS\n",
+                   "PID", "COMMAND", "CPU%", "RSS (MB)", "PSS (MB)", "USS (MB)",
+                   "SWAP (MB)", "AGE", ev_on ? "    SPAWN/s" : "");
+            printf("%-8s %-20s %8s %10s %10s %10s %10s %7s%s\n", "--------",
+                   "--------------------", "--------", "----------", "----------",
+                   "----------", "----------", "-------", ev_on ? " ----------" : "");
+            for (int i = 0; i < show; i++) {
+                const ProcInfo *p = top[i];
+                printf("%-8d %-20.20s %7.1f%% %10.1f", p->pid, p->name, p->cpu_pct,
+                       p->rss_kb / 1024.0);
+                if (p->mem_age >= 0)
+                    printf(" %10.1f %10.1f %10.1f %6.0fs", p->pss_kb / 1024.0,
+                           p->uss_kb / 1024.0, p->swap_kb / 1024.0, p->mem_age);
+                else
+                    printf(" %10s %10s %10s %7s", "-", "-", "-", "-");
+                if (ev_on)
+                    printf(" %10.1f", spawn_count(p->pid) / (double)interval);
+                printf("\n");
+            }
+        } else if (thread_mode) {
+            printf("%-8s %-8s %-16s %8s %8s %10s %10s  sort:%s\n",
+                   "TID", "PID", "THREAD", "CPU%", "RUNQ%", "VCSW/s", "IVCSW/s",
+                   sort_wait ? "RUNQ" : "CPU");
+            printf("%-8s %-8s %-16s %8s %8s %10s %10s\n", "--------", "--------",
+                   "----------------", "--------", "--------", "----------", "----------");
+            for (int i = 0; i < show; i++) {
+                ProcInfo *p = (ProcInfo *)top[i];
+                read_thread_detail(p);
+                const ProcInfo *o = index_find(&ix, prev, p->pid, p->start);
+                printf("%-8d %-8d %-16.16s %7.1f%% %7.1f%%", p->pid, p->tgid,
+                       p->name, p->cpu_pct, p->wait_pct);
+                /* switch counts are only read for displayed rows, so a rate
+                   needs the row to have been shown last tick too */
+                if (o && o->vcsw >= 0 && p->vcsw >= o->vcsw && p->ivcsw >= o->ivcsw)
+                    printf(" %10.1f %10.1f\n", (p->vcsw - o->vcsw) / (double)interval,
+                           (p->ivcsw - o->ivcsw) / (double)interval);
+                else
+                    printf(" %10s %10s\n", "-", "-");
+            }
+        } else {
+            printf("%-8s %-20s %8s %12s%s  sort:CPU\n",
+                   "PID", "COMMAND", "CPU%", "RSS (MB)",
+                   ev_on ? "    SPAWN/s" : "");
+            printf("%-8s %-20s %8s %12s%s\n",
+                   "--------", "--------------------", "--------", "------------",
+                   ev_on ? " ----------" : "");
 
-        for (int i = 0; i < show; i++) {
-            printf("%-8d %-20.20s %7.1f%% %11.1f\n",
-                   curr[i].pid,
-                   curr[i].name,
-                   curr[i].cpu_pct,
-                   curr[i].rss_kb / 1024.0);
+            for (int i = 0; i < show; i++) {
+                printf("%-8d %-20.20s %7.1f%% %11.1f",
+                       top[i]->pid,
+                       top[i]->name,
+                       top[i]->cpu_pct,
+                       top[i]->rss_kb / 1024.0);
+                if (ev_on)
+                    printf(" %10.1f", spawn_count(top[i]->pid) / (double)interval);
+                printf("\n");
+            }
+        }
+
+        if (ev_on) {
+            printf("\n%-29s %8s %12s %10s\n",
+                   "EXITED (by command)", "CPU%", "AVG LIFE", "EXITS/s");
+            printf("%-29s %8s %12s %10s\n", "-----------------------------",
+                   "--------", "------------", "----------");
+            size_t nc = nexit_cmds < (size_t)top_n ? nexit_cmds : (size_t)top_n;
+            for (size_t i = 0; i < nc; i++) {
+                const ExitCmd *c = &exit_cmds[i];
+                printf("%-29.29s %7.1f%% %9.1f ms %10.1f\n", c->comm,
+                       c->cpu_us / 1e4 / interval,
+                       c->life_us / 1e3 / c->exits,
+                       c->exits / (double)interval);
+            }
+            if (ts_sock < 0)
+                printf("(taskstats unavailable: %s)\n", ts_why ? ts_why : "?");
+            printf("\nforks/s %.1f  execs/s %.1f  exits/s %.1f",
+                   ev_nforks / (double)interval, ev_nexecs / (double)interval,
+                   ev_nexits / (double)interval);
+            if (ev_lost) printf("  (event overruns: %lu)", ev_lost);
+            printf("\n");
+            ev_nforks = ev_nexecs = ev_nexits = 0;
+            ev_parents.n = 0;
         }
+        printf("\n%zu %s, read in %.1f ms (-j %d)", curr->n,
+               thread_mode ? "threads" : "processes", collect_ms, jobs);
+        if (sort_mem && !cg_mode)
+            printf(", smaps_rollup: %lu in %.1f ms", mem_reads, mem_read_ms);
+        printf("\n");
 
         fflush(stdout);
 
         /* Swap buffers */
-        ProcInfo *tmp = prev;
-        prev   = curr;
-        prev_n = curr_n;
-        curr   = tmp;
+        Snapshot *tmp = prev;
+        prev = curr;
+        curr = tmp;
     }
 
     return EXIT_SUCCESS;